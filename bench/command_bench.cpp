@@ -0,0 +1,115 @@
+/*
+ * command_bench.cpp
+ *
+ * Parse-and-dispatch time per command: the command registry, compared with
+ * the chain of strncasecmp() calls it replaced
+ */
+
+// sources: src/commands.cpp
+
+#include "commands.h"
+#include <chrono>
+#include <cstdio>
+
+static volatile uint32_t sink;
+
+static const uint32_t N_CALLS = 2000000;
+
+// Commands of the former chain, in its order; the registry has them all too
+static const char* chain_commands[] = {"PIN", "TGL", "PPL", "NPL", "BST", "ENP", "DSP", "WFC", "WFD", "WFG", "GO!", "ARM", "PAU", "RSM", "STP", "CLR", "RST", "GET", "SET", "STA", "FUN", "LAT", "PRF", "TRC", "QUE", "CON", "STR", "ALX"};
+
+#define N_CHAIN_COMMANDS (sizeof(chain_commands) / sizeof(chain_commands[0]))
+
+static void _handler(const DataPacket* data)
+{
+	sink = data->arg1;
+}
+
+// _parse_UART_command() before the registry, with every handler replaced
+__attribute__((noinline)) static void _parse_chain(const DataPacket* data)
+{
+	if (strncasecmp(data->cmd, "PIN", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "TGL", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "PPL", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "NPL", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "BST", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "ENP", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "DSP", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "WFC", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "WFD", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "WFG", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "GO!", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "ARM", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "PAU", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "RSM", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "STP", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "CLR", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "RST", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "GET", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "SET", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "STA", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "FUN", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "LAT", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "PRF", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "TRC", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "QUE", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "CON", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "STR", 3) == 0) { _handler(data); }
+	else if (strncasecmp(data->cmd, "ALX", 3) == 0) { _handler(data); }
+	else { printf("ERR: unknown command '%.3s'\n", data->cmd); }
+}
+
+__attribute__((noinline)) static void _parse_registry(const DataPacket* data)
+{
+	if (!dispatch_command(data))
+	{
+		printf("ERR: unknown command '%.3s'\n", data->cmd);
+	}
+}
+
+template <typename F>
+static double _ns_per_call(F parse, const char* name)
+{
+	DataPacket packet = {};
+	memcpy(packet.cmd, name, 3);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < N_CALLS; i++)
+	{
+		packet.arg1 = i;
+		parse(&packet);
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / N_CALLS;
+}
+
+int main()
+{
+	// As many commands as the firmware registers, so the table is as full
+	for (const char* name : chain_commands)
+	{
+		register_command(name, _handler);
+	}
+	static const char* module_commands[] = {"BCF", "BCW", "BCN", "BCP", "BON", "BOF", "GRP", "GRC", "GRW",
+	                                        "PWC", "PWD", "PWS", "PWP", "BAU"};
+	for (const char* name : module_commands)
+	{
+		register_command(name, _handler);
+	}
+
+	printf("ns per command (%lu calls each)\n", (unsigned long) N_CALLS);
+	printf("cmd    chain   registry\n");
+	double sum_chain = 0, sum_registry = 0, max_chain = 0, max_registry = 0;
+	for (const char* name : chain_commands)
+	{
+		double t_chain = _ns_per_call(_parse_chain, name);
+		double t_registry = _ns_per_call(_parse_registry, name);
+		printf("%.3s  %6.1f   %6.1f\n", name, t_chain, t_registry);
+		sum_chain += t_chain;
+		sum_registry += t_registry;
+		max_chain = (t_chain > max_chain) ? t_chain : max_chain;
+		max_registry = (t_registry > max_registry) ? t_registry : max_registry;
+	}
+	printf("mean %6.1f   %6.1f\n", sum_chain / N_CHAIN_COMMANDS, sum_registry / N_CHAIN_COMMANDS);
+	printf("max  %6.1f   %6.1f\n", max_chain, max_registry);
+	return 0;
+}
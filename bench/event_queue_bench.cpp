@@ -0,0 +1,256 @@
+/*
+ * event_queue_bench.cpp
+ *
+ * Dispatch and scheduling cost of the event queue backends (static heap and
+ * timing wheel), compared with the std::priority_queue of 28-byte events
+ * they replaced
+ */
+
+#include "events.h"
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <cstdio>
+
+// Defined in events.cpp, which isn't part of the benchmark
+uint64_t event_ts_base = 0;
+
+static volatile uint32_t sink;
+
+static const uint64_t N_DISPATCH = 5000000;
+static const uint32_t N_RUNS = 9;  // the median is reported
+static const size_t QUEUE_SIZES[] = {16, 50, 200, 450, 700, 1000};
+
+
+/************************************************************************/
+/*                 PREVIOUS EVENT QUEUE                                 */
+/************************************************************************/
+
+typedef void (*EventFunc)(uint32_t arg1, uint32_t arg2);
+
+static void _nop_func(uint32_t arg1, uint32_t arg2)
+{
+	sink = arg1 + arg2;
+}
+
+// Event before the compaction: function pointer and 64-bit timestamp
+typedef struct __attribute__((packed)) OldEvent
+{
+	EventFunc func;
+	uint32_t  arg1;
+	uint32_t  arg2;
+	uint64_t  ts64_cts;
+	uint32_t  N;
+	uint32_t  interv_cts;
+
+	OldEvent() : func(_nop_func), arg1(0), arg2(0), ts64_cts(0), N(0), interv_cts(0) {}
+
+	bool operator<(const OldEvent& other) const {
+		return this->ts64_cts > other.ts64_cts;
+	}
+} OldEvent;  // 28 bytes
+
+
+/************************************************************************/
+/*                 WORKLOAD                                             */
+/************************************************************************/
+
+typedef struct {
+	uint32_t ts_cts;
+	uint32_t interv_cts;
+} EventSpec;
+
+// Repeating events of a pTIRF protocol: strobe edges, laser alternation,
+// and camera frames, with random phases
+static std::vector<EventSpec> _make_workload(size_t n_events)
+{
+	static const uint32_t intervals_us[] = {50, 100, 200, 1000, 5000, 10000, 33333, 100000};
+	std::mt19937 rng(1234);
+	std::vector<EventSpec> specs;
+	for (size_t i = 0; i < n_events; i++)
+	{
+		uint32_t interv_cts = intervals_us[rng() % 8] * SYS_TC_TICKS_PER_US;
+		specs.push_back({(uint32_t) (rng() % interv_cts), interv_cts});
+	}
+	return specs;
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double _ns_per_op(Clock::time_point t0, uint64_t n_ops)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / n_ops;
+}
+
+static double _median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+
+/************************************************************************/
+/*                 BENCHMARKS                                           */
+/************************************************************************/
+
+// Repeating events: fire the earliest one and put it back one interval later
+static double _dispatch_old(const std::vector<EventSpec>& specs)
+{
+	std::priority_queue<OldEvent> queue;
+	for (const EventSpec& s : specs)
+	{
+		OldEvent* event = new OldEvent();  // like event_from_datapacket() did
+		event->ts64_cts = s.ts_cts;
+		event->interv_cts = s.interv_cts;
+		queue.push(*event);
+		delete event;
+	}
+
+	Clock::time_point t0 = Clock::now();
+	for (uint64_t i = 0; i < N_DISPATCH; i++)
+	{
+		OldEvent event = queue.top();
+		event.func(event.arg1, event.arg2);
+		queue.pop();
+		event.ts64_cts += event.interv_cts;
+		queue.push(event);
+	}
+	return _ns_per_op(t0, N_DISPATCH);
+}
+
+// Same as rebase_event_queue(), driven by the dispatched timestamps
+template <typename Queue>
+static void _rebase(Queue& queue, uint64_t now_cts)
+{
+	uint64_t ahead = now_cts - event_ts_base;
+	if (ahead < EVENT_REBASE_THRESHOLD_CTS)
+	{
+		return;
+	}
+	if (!queue.empty() && queue.top().ts_ofs_cts < ahead)
+	{
+		ahead = queue.top().ts_ofs_cts;
+	}
+	uint32_t delta = (uint32_t) (ahead & ~((uint64_t) EVENT_REBASE_ALIGN_CTS - 1));
+	event_ts_base += delta;
+	queue.for_each([delta](Event& e) {
+		e.ts_ofs_cts -= delta;
+	});
+}
+
+template <typename Queue>
+static double _dispatch_new(Queue& queue, const std::vector<EventSpec>& specs)
+{
+	queue.clear();
+	event_ts_base = 0;
+	for (const EventSpec& s : specs)
+	{
+		Event event;
+		event.ts_ofs_cts = s.ts_cts;
+		event.interv_cts = s.interv_cts;
+		queue.push(event);
+	}
+
+	Clock::time_point t0 = Clock::now();
+	for (uint64_t i = 0; i < N_DISPATCH; i++)
+	{
+		Event event = queue.top();
+		sink = event.op + event.arg;
+		event.ts_ofs_cts += event.interv_cts;
+		queue.replace_top(event);
+		if ((i & 1023) == 0)  // the main loop rebases now and then
+		{
+			_rebase(queue, event_ts(&queue.top()));
+		}
+	}
+	return _ns_per_op(t0, N_DISPATCH);
+}
+
+// One-shot events: schedule a batch of commands, then fire them all
+static double _schedule_old(const std::vector<EventSpec>& specs, uint32_t reps)
+{
+	Clock::time_point t0 = Clock::now();
+	for (uint32_t r = 0; r < reps; r++)
+	{
+		std::priority_queue<OldEvent> queue;
+		for (const EventSpec& s : specs)
+		{
+			OldEvent* event = new OldEvent();
+			event->ts64_cts = s.ts_cts;
+			queue.push(*event);
+			delete event;
+		}
+		while (!queue.empty())
+		{
+			sink = queue.top().arg1;
+			queue.pop();
+		}
+	}
+	return _ns_per_op(t0, (uint64_t) reps * specs.size());
+}
+
+template <typename Queue>
+static double _schedule_new(Queue& queue, const std::vector<EventSpec>& specs, uint32_t reps)
+{
+	queue.clear();
+	event_ts_base = 0;
+	Clock::time_point t0 = Clock::now();
+	for (uint32_t r = 0; r < reps; r++)
+	{
+		event_ts_base += EVENT_REBASE_ALIGN_CTS;  // time goes on between the batches
+		for (const EventSpec& s : specs)
+		{
+			Event event;
+			event.ts_ofs_cts = s.ts_cts;
+			queue.push(event);
+		}
+		while (!queue.empty())
+		{
+			sink = queue.top().arg;
+			queue.pop();
+		}
+	}
+	return _ns_per_op(t0, (uint64_t) reps * specs.size());
+}
+
+
+static StaticHeap<Event, MAX_N_EVENTS> heap;
+static TimingWheel<Event, MAX_N_EVENTS, EventTimestamp> wheel;
+
+int main()
+{
+	printf("Repeating events, ns per dispatch (median of %lu runs of %llu)\n",
+	       (unsigned long) N_RUNS, (unsigned long long) N_DISPATCH);
+	printf("queued   priority_queue     heap    wheel   (wheel, M events/s)\n");
+	for (size_t n : QUEUE_SIZES)
+	{
+		std::vector<EventSpec> specs = _make_workload(n);
+		std::vector<double> t_old, t_heap, t_wheel;
+		for (uint32_t run = 0; run < N_RUNS; run++)
+		{
+			t_old.push_back(_dispatch_old(specs));
+			t_heap.push_back(_dispatch_new(heap, specs));
+			t_wheel.push_back(_dispatch_new(wheel, specs));
+		}
+		printf("%6zu   %14.1f   %6.1f   %6.1f   (%5.1f)\n", n, _median(t_old), _median(t_heap),
+		       _median(t_wheel), 1e3 / _median(t_wheel));
+	}
+
+	printf("\nOne-shot events, ns per schedule and dispatch\n");
+	printf("queued   priority_queue     heap    wheel\n");
+	for (size_t n : QUEUE_SIZES)
+	{
+		std::vector<EventSpec> specs = _make_workload(n);
+		uint32_t reps = 2000000 / n;
+		std::vector<double> t_old, t_heap, t_wheel;
+		for (uint32_t run = 0; run < N_RUNS; run++)
+		{
+			t_old.push_back(_schedule_old(specs, reps));
+			t_heap.push_back(_schedule_new(heap, specs, reps));
+			t_wheel.push_back(_schedule_new(wheel, specs, reps));
+		}
+		printf("%6zu   %14.1f   %6.1f   %6.1f\n", n, _median(t_old), _median(t_heap), _median(t_wheel));
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""
+Host benchmarks of the firmware data structures.
+
+Builds every *_bench.cpp in this directory with the host C++ compiler against
+the firmware headers and runs it. The include paths and definitions are taken
+from microsync/microsync.cppproj, so the benchmarks always see the same
+headers as the firmware. Extra firmware sources a benchmark needs are listed
+in a "// sources:" line of the benchmark, relative to microsync/.
+
+Usage: python bench/run_benchmarks.py [name ...]
+       e.g. python bench/run_benchmarks.py event_queue
+
+The numbers are host numbers: they compare implementations with each other,
+not with the cycle counts on the Due (see the PRF command for those).
+"""
+
+import os
+import re
+import subprocess
+import sys
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent.parent
+BENCH_DIR = ROOT / "bench"
+FIRMWARE_DIR = ROOT / "microsync"
+BUILD_DIR = BENCH_DIR / "build"
+
+CXX = os.environ.get("CXX", "g++")
+CXXFLAGS = ["-O2", "-std=gnu++14", "-fpermissive", "-w"]
+
+# Definitions for the host: the SAM3X8E register map, without the ARM-only
+# parts of CMSIS that the benchmarks don't call
+HOST_DEFINES = ["-DBOARD=ARDUINO_DUE_X", "-D__SAM3X8E__", "-DNDEBUG", "-D__ARMCC_VERSION=0"]
+
+
+def get_include_dirs():
+    """Get the firmware include paths from the project file"""
+    project = (FIRMWARE_DIR / "microsync.cppproj").read_text()
+    dirs = []
+    for value in re.findall(r"<Value>\.\./(src[^<]*)</Value>", project):
+        path = FIRMWARE_DIR / value
+        if path.is_dir() and path not in dirs:
+            dirs.append(path)
+    return ["-I" + str(d) for d in dirs]
+
+
+def get_sources(bench_file):
+    """Get the firmware sources listed in the "// sources:" line of a benchmark"""
+    match = re.search(r"^// sources:(.*)$", bench_file.read_text(), re.MULTILINE)
+    if not match:
+        return []
+    return [str(FIRMWARE_DIR / s) for s in match.group(1).split()]
+
+
+def build(bench_file):
+    """Build a benchmark and return the path of the executable, or None"""
+    BUILD_DIR.mkdir(exist_ok=True)
+    exe = BUILD_DIR / bench_file.stem
+    cmd = [CXX] + CXXFLAGS + HOST_DEFINES + get_include_dirs() + \
+          [str(bench_file)] + get_sources(bench_file) + ["-o", str(exe)]
+    result = subprocess.run(cmd, capture_output=True, text=True)
+    if result.returncode != 0:
+        print(f"Error building {bench_file.name}:\n{result.stderr}")
+        return None
+    return exe
+
+
+def main():
+    names = sys.argv[1:]
+    benches = sorted(BENCH_DIR.glob("*_bench.cpp"))
+    if names:
+        benches = [b for b in benches if b.stem[:-len("_bench")] in names]
+    if not benches:
+        print("No benchmarks found")
+        return False
+
+    ok = True
+    for bench_file in benches:
+        print(f"\n=== {bench_file.stem} ===", flush=True)
+        exe = build(bench_file)
+        if exe is None or subprocess.run([str(exe)]).returncode != 0:
+            ok = False
+    return ok
+
+
+if __name__ == "__main__":
+    sys.exit(0 if main() else 1)
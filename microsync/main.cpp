@@ -12,7 +12,14 @@ extern "C" {
 #include "uart_comm.h"
 #include "events.h"
 #include "interlock.h"
+#include "gate.h"
+#include "profiler.h"
 #include "props.h"
+#include "ext_pTIRF.h"
+#include "pin_group.h"
+#include "burst.h"
+#include "pwm.h"
+#include "usb_cdc.h"
 
 
 /**
@@ -138,14 +145,20 @@ int main() {
 	// Initialize all peripheral systems
 	sysclk_init();
 	board_init();
+	init_profiler();
 	init_uart_comm();
+	init_usb_cdc();
 	init_pins();	
 	init_sys_timer();
-	init_burst_timer();
 	
 	init_props();
+	init_pTIRF();
+	init_pin_groups();
+	init_bursts();
+	init_pwm();
 	
 	init_interlock();
+	init_gate();
 	
 	printf("Sync device is ready. Firmware version: %s\n", VERSION);
 	
@@ -160,6 +173,8 @@ int main() {
 		}
 
 		poll_uart();
+		poll_usb();
+		rebase_event_queue();  // keeps event timestamps within their 32-bit offsets
 
 		// Indicates execution of the main loop
 		err_led_on();
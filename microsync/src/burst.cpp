@@ -0,0 +1,353 @@
+/*
+ * burst.cpp
+ *
+ * Hardware pulse trains on the TC2 compare outputs
+ */
+
+#include "burst.h"
+#include "events.h"
+#include "commands.h"
+
+/************************************************************************/
+/*                 BURST CHANNELS                                       */
+/************************************************************************/
+
+typedef struct {
+	uint32_t pin_idx;  // IOPORT index of the output pin (TIOA, peripheral B)
+	uint32_t id;       // peripheral ID of the channel
+} BurstChannel;
+
+static const BurstChannel burst_channels[N_BURST_CHANNELS] = {
+	{BURST_PIN,   ID_TC6},
+	{BURST_B_PIN, ID_TC7},
+	{BURST_C_PIN, ID_TC8},
+};
+
+typedef struct {
+	uint32_t period;   // MCK/2 ticks, 0 if not configured
+	uint32_t width;    // MCK/2 ticks
+	uint32_t count;    // number of pulses, 0 = until stopped
+	uint32_t phase_us; // delay of the first pulse after the start event
+} BurstConfig;
+
+static BurstConfig configs[N_BURST_CHANNELS];
+
+// Block mode for a counted train: XC of the counter is the TIOA of the train,
+// and XC of the train is the TIOA of the counter (its BURST gate). ASF names
+// of the TC2XC2S values don't match the datasheet: 2 is TIOA0, 3 is TIOA1.
+static const uint32_t counter_bmr[N_BURST_CHANNELS] = {
+	TC_BMR_TC0XC0S_TIOA1 | TC_BMR_TC1XC1S_TIOA0,        // channel 0, counted by channel 1
+	TC_BMR_TC1XC1S_TIOA2 | (3u << TC_BMR_TC2XC2S_Pos),  // channel 1, counted by channel 2
+	TC_BMR_TC0XC0S_TIOA2 | (2u << TC_BMR_TC2XC2S_Pos),  // channel 2, counted by channel 0
+};
+
+// Waveform mode: high from the start of the period to RA, low until RC
+#define BURST_CMR (TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | \
+                   TC_CMR_ASWTRG_SET | TC_CMR_ACPA_CLEAR | TC_CMR_ACPC_SET)
+
+// One-shot counter: high from the trigger until RC, then the clock stops
+#define COUNTER_CMR (TC_CMR_WAVE | TC_CMR_WAVSEL_UP | TC_CMR_CPCSTOP | \
+                     TC_CMR_ASWTRG_SET | TC_CMR_ACPC_CLEAR)
+
+static uint32_t counted_channel = N_BURST_CHANNELS;  // train that runs with a counter, if any
+static uint32_t paused_channels = 0;  // bitmask of channels frozen by pause_bursts()
+
+
+static inline uint32_t _counter_of(uint32_t ch)
+{
+	return (ch + 1) % N_BURST_CHANNELS;
+}
+
+static inline bool _valid_channel(uint32_t ch)
+{
+	if (ch >= N_BURST_CHANNELS)
+	{
+		printf("ERR: burst channel must be from 0 to %u\n", N_BURST_CHANNELS - 1);
+		return false;
+	}
+	return true;
+}
+
+static inline bool _valid_mask(uint32_t mask)
+{
+	if (mask == 0 || (mask >> N_BURST_CHANNELS))
+	{
+		printf("ERR: invalid burst channel mask 0x%lx\n", mask);
+		return false;
+	}
+	return true;
+}
+
+static inline void _release_pin(uint32_t ch)
+{
+	// Give the pin back to PIO, driven low
+	uint32_t pin = burst_channels[ch].pin_idx;
+	pio_set_output(arch_ioport_pin_to_base(pin), arch_ioport_pin_to_mask(pin), 0, 0, 0);
+}
+
+static inline void _connect_pin(uint32_t ch)
+{
+	uint32_t pin = burst_channels[ch].pin_idx;
+	pio_set_peripheral(arch_ioport_pin_to_base(pin), PIO_PERIPH_B, arch_ioport_pin_to_mask(pin));
+}
+
+
+/************************************************************************/
+/*                 CHANNEL CONFIGURATION                                */
+/************************************************************************/
+
+void init_bursts()
+{
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		sysclk_enable_peripheral_clock(burst_channels[ch].id);
+		BURST_TC->TC_CHANNEL[ch].TC_CMR = BURST_CMR;
+	}
+
+	register_command("BCF", [](const DataPacket* data) { configure_burst(data->arg1, data->arg2); });
+	register_command("BCW", [](const DataPacket* data) { set_burst_width(data->arg1, data->arg2); });
+	register_command("BCN", [](const DataPacket* data) { set_burst_count(data->arg1, data->arg2); });
+	register_command("BCP", [](const DataPacket* data) { set_burst_phase(data->arg1, data->arg2); });
+	register_command("BON", schedule_burst_start);
+	register_command("BOF", schedule_burst_stop);
+}
+
+void configure_burst(uint32_t ch, uint32_t period)
+{
+	if (!_valid_channel(ch))
+	{
+		return;
+	}
+	if (period < 8)
+	{
+		printf("ERR: burst period must be at least 8 ticks\n");
+		return;
+	}
+	// Keep the width, count, and phase unless the width no longer fits
+	BurstConfig* c = &configs[ch];
+	c->period = period;
+	if (c->width == 0 || c->width >= period ||
+	    (c->count > 0 && period - c->width < BURST_MIN_GAP_TICKS))
+	{
+		c->width = period >> 3;
+	}
+}
+
+void set_burst_width(uint32_t ch, uint32_t width)
+{
+	if (!_valid_channel(ch))
+	{
+		return;
+	}
+	BurstConfig* c = &configs[ch];
+	if (width == 0 || width >= c->period)
+	{
+		printf("ERR: burst pulse width must be shorter than the period\n");
+		return;
+	}
+	if (c->count > 0 && c->period - width < BURST_MIN_GAP_TICKS)
+	{
+		printf("ERR: counted pulses need a gap of %u ticks\n", BURST_MIN_GAP_TICKS);
+		return;
+	}
+	c->width = width;
+}
+
+void set_burst_count(uint32_t ch, uint32_t count)
+{
+	if (!_valid_channel(ch))
+	{
+		return;
+	}
+	if (count > 0)
+	{
+		for (uint32_t i = 0; i < N_BURST_CHANNELS; i++)
+		{
+			if (i != ch && configs[i].count > 0)
+			{
+				printf("ERR: burst channel %lu already counts pulses\n", i);
+				return;
+			}
+		}
+		if (configs[ch].period - configs[ch].width < BURST_MIN_GAP_TICKS)
+		{
+			printf("ERR: counted pulses need a gap of %u ticks\n", BURST_MIN_GAP_TICKS);
+			return;
+		}
+	}
+	configs[ch].count = count;
+}
+
+void set_burst_phase(uint32_t ch, uint32_t phase_us)
+{
+	if (_valid_channel(ch))
+	{
+		configs[ch].phase_us = phase_us;
+	}
+}
+
+
+/************************************************************************/
+/*                 TRAIN SCHEDULING                                     */
+/************************************************************************/
+
+void schedule_burst_start(const DataPacket* data)
+{
+	if (!_valid_mask(data->arg1))
+	{
+		return;
+	}
+
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		if (!(data->arg1 & (1UL << ch)))
+		{
+			continue;
+		}
+		if (configs[ch].period == 0)
+		{
+			printf("ERR: burst channel %lu is not configured\n", ch);
+			return;
+		}
+		uint32_t counted = (ch + N_BURST_CHANNELS - 1) % N_BURST_CHANNELS;
+		if (configs[counted].count > 0)
+		{
+			printf("ERR: burst channel %lu counts pulses of channel %lu\n", ch, counted);
+			return;
+		}
+	}
+
+	Event event = event_from_datapacket(data, OP_BURST_CH_ON);
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		if (data->arg1 & (1UL << ch))
+		{
+			Event start = event;
+			start.idx = ch;
+			if (start.ts_ofs_cts != EVENT_TS_INVALID)
+			{
+				set_event_ts(&start, event_ts(&start) + us2cts(configs[ch].phase_us));
+			}
+			schedule_event(&start);
+		}
+	}
+}
+
+void schedule_burst_stop(const DataPacket* data)
+{
+	if (!_valid_mask(data->arg1))
+	{
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_BURST_CH_OFF);
+	event.idx = data->arg1;
+	schedule_event(&event);
+}
+
+
+/************************************************************************/
+/*                 FUNCTIONS TO USE WITHIN EVENTS                       */
+/************************************************************************/
+
+void start_burst_train(uint32_t ch, uint32_t period, uint32_t width, uint32_t count)
+{
+	TcChannel* tc = &BURST_TC->TC_CHANNEL[ch];
+	uint32_t mode = BURST_CMR;
+
+	tc->TC_CCR = TC_CCR_CLKDIS;
+	if (counted_channel == ch)
+	{
+		BURST_TC->TC_CHANNEL[_counter_of(ch)].TC_CCR = TC_CCR_CLKDIS;
+		counted_channel = N_BURST_CHANNELS;
+	}
+
+	if (count > 0)
+	{
+		uint32_t cnt = _counter_of(ch);
+		TcChannel* counter = &BURST_TC->TC_CHANNEL[cnt];
+
+		counter->TC_CCR = TC_CCR_CLKDIS;
+		_release_pin(cnt);
+		BURST_TC->TC_BMR = counter_bmr[ch];
+
+		// A trigger is only taken into account on an edge of the selected
+		// clock, so open the gate with the internal clock first, then
+		// switch the counter to the falling edges of the train.
+		counter->TC_CMR = COUNTER_CMR | TC_CMR_TCCLKS_TIMER_CLOCK1;
+		counter->TC_RC = UINT32_MAX;
+		counter->TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+		while (!(counter->TC_SR & TC_SR_MTIOA));
+		counter->TC_CMR = COUNTER_CMR | (TC_CMR_TCCLKS_XC0 + cnt) | TC_CMR_CLKI;
+		counter->TC_RC = counter->TC_CV + count;
+
+		mode |= (ch + 1) << TC_CMR_BURST_Pos;  // clock is ANDed with XC<ch>, the counter output
+		counted_channel = ch;
+	}
+
+	tc->TC_CMR = mode;
+	tc->TC_RA = width;
+	tc->TC_RC = period;
+	_connect_pin(ch);
+	tc->TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+}
+
+void start_burst_channel_func(uint32_t arg1_ch, uint32_t arg2_unused)
+{
+	const BurstConfig* c = &configs[arg1_ch % N_BURST_CHANNELS];
+	if (c->period > 0)
+	{
+		start_burst_train(arg1_ch % N_BURST_CHANNELS, c->period, c->width, c->count);
+	}
+}
+
+void stop_burst_channels_func(uint32_t arg1_ch_mask, uint32_t arg2_unused)
+{
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		if (!(arg1_ch_mask & (1UL << ch)) ||
+		    (counted_channel < N_BURST_CHANNELS && _counter_of(counted_channel) == ch))
+		{
+			continue;  // a running pulse counter is stopped with its train
+		}
+		BURST_TC->TC_CHANNEL[ch].TC_CCR = TC_CCR_CLKDIS;
+		if (counted_channel == ch)
+		{
+			BURST_TC->TC_CHANNEL[_counter_of(ch)].TC_CCR = TC_CCR_CLKDIS;
+			counted_channel = N_BURST_CHANNELS;
+		}
+		_release_pin(ch);
+	}
+}
+
+void stop_bursts()
+{
+	stop_burst_channels_func((1UL << N_BURST_CHANNELS) - 1, 0);
+}
+
+void pause_bursts()
+{
+	paused_channels = 0;
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		TcChannel* tc = &BURST_TC->TC_CHANNEL[ch];
+		if (tc->TC_SR & TC_SR_CLKSTA)
+		{
+			tc->TC_CCR = TC_CCR_CLKDIS;
+			paused_channels |= (1UL << ch);
+		}
+	}
+}
+
+void resume_bursts()
+{
+	for (uint32_t ch = 0; ch < N_BURST_CHANNELS; ch++)
+	{
+		if (paused_channels & (1UL << ch))
+		{
+			// No SWTRG: the counter continues from where it was frozen
+			BURST_TC->TC_CHANNEL[ch].TC_CCR = TC_CCR_CLKEN;
+		}
+	}
+	paused_channels = 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file burst.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Hardware pulse trains on the TC2 compare outputs.
+ *
+ * Every channel of TC2 drives its own pin: channel 0 - D5, channel 1 - D3,
+ * channel 2 - D11. A channel is configured with the period and the pulse
+ * width in MCK/2 ticks (23.8 ns), a pulse count, and a phase delay. The
+ * pulse starts at the beginning of every period, so the edges come from
+ * the RA (falling) and RC (rising) compare outputs without CPU involvement.
+ *
+ * With a non-zero pulse count, the next channel of the block counts the
+ * falling edges of the train on its external clock input. When the count
+ * is reached, the counter output closes the BURST gate of the train
+ * channel, so exactly N pulses are produced and the train ends by itself,
+ * with no stop event and no interrupt. Only one channel can count pulses
+ * at a time, and its counter channel is not available for trains.
+ *
+ * Channels are configured with BCF, BCW, BCN, and BCP, and started and
+ * stopped by scheduled BON and BOF events. BST keeps using channel 0 with
+ * the 1/8 duty cycle.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Enable the TC2 channels and register the burst commands.
+ */
+void init_bursts();
+
+/**
+ * @brief Set the period of a burst channel.
+ * @param ch Channel index, from 0 to N_BURST_CHANNELS - 1
+ * @param period Period in MCK/2 ticks
+ *
+ * The pulse width, count, and phase delay are kept. The width is set to
+ * 1/8 of the period if the channel had none, or if it doesn't fit the new
+ * period with the gap counted pulses need.
+ */
+void configure_burst(uint32_t ch, uint32_t period);
+
+/**
+ * @brief Set the pulse width of a burst channel.
+ * @param ch Channel index
+ * @param width Pulse width in MCK/2 ticks, shorter than the period
+ */
+void set_burst_width(uint32_t ch, uint32_t width);
+
+/**
+ * @brief Set the number of pulses in a train.
+ * @param ch Channel index
+ * @param count Number of pulses, 0 for a train that runs until stopped
+ */
+void set_burst_count(uint32_t ch, uint32_t count);
+
+/**
+ * @brief Set the delay of the first pulse after the start event.
+ * @param ch Channel index
+ * @param phase_us Delay in microseconds
+ *
+ * Channels started by the same BON event keep their relative phases.
+ */
+void set_burst_phase(uint32_t ch, uint32_t phase_us);
+
+/**
+ * @brief Schedule the start of burst trains.
+ * @param data Pointer to DataPacket containing the start parameters
+ *
+ * data->arg1 is the bitmask of channels to start. Timestamp, N, and interval
+ * have the usual meaning; a restarted train begins from its first pulse.
+ */
+void schedule_burst_start(const DataPacket* data);
+
+/**
+ * @brief Schedule the stop of burst trains.
+ * @param data Pointer to DataPacket containing the stop parameters
+ *
+ * data->arg1 is the bitmask of channels to stop.
+ */
+void schedule_burst_stop(const DataPacket* data);
+
+/**
+ * @brief Start a pulse train on a channel.
+ * @param ch Channel index
+ * @param period Period in MCK/2 ticks
+ * @param width Pulse width in MCK/2 ticks
+ * @param count Number of pulses, 0 for a train that runs until stopped
+ */
+void start_burst_train(uint32_t ch, uint32_t period, uint32_t width, uint32_t count);
+
+/**
+ * @brief Event function that starts the configured train of a channel.
+ * @param arg1_ch Channel index
+ * @param arg2_unused Unused parameter (for event function compatibility)
+ */
+void start_burst_channel_func(uint32_t arg1_ch, uint32_t arg2_unused);
+
+/**
+ * @brief Event function that stops burst trains.
+ * @param arg1_ch_mask Bitmask of channels to stop
+ * @param arg2_unused Unused parameter (for event function compatibility)
+ *
+ * The pins are returned to PIO control and driven low.
+ */
+void stop_burst_channels_func(uint32_t arg1_ch_mask, uint32_t arg2_unused);
+
+/**
+ * @brief Stop all burst channels.
+ */
+void stop_bursts();
+
+/**
+ * @brief Freeze the running burst channels.
+ *
+ * Used by pause_sys_timer(). Output levels are held while the channels are
+ * frozen, and the pulse counters keep their values.
+ */
+void pause_bursts();
+
+/**
+ * @brief Continue the channels frozen by pause_bursts().
+ */
+void resume_bursts();
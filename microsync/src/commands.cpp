@@ -0,0 +1,66 @@
+/*
+ * commands.cpp
+ *
+ * Registry of UART commands
+ */
+
+#include "commands.h"
+
+static_assert((MAX_N_COMMANDS & (MAX_N_COMMANDS - 1)) == 0, "MAX_N_COMMANDS must be a power of 2");
+
+typedef struct {
+	uint32_t code;           // 0 marks an empty slot
+	CommandHandler handler;
+} CommandSlot;
+
+static CommandSlot commands[MAX_N_COMMANDS];
+static uint32_t n_commands = 0;
+
+
+// Fibonacci hashing; the top bits of the product are the best mixed
+static inline uint32_t _slot_of(uint32_t code)
+{
+	return (uint32_t) (code * 2654435761UL) >> (32 - __builtin_ctz(MAX_N_COMMANDS));
+}
+
+bool register_command(const char* name, CommandHandler handler)
+{
+	uint32_t code = cmd_code(name);
+
+	// Keep the table at most half full, so that probe sequences stay short
+	if (n_commands >= MAX_N_COMMANDS / 2)
+	{
+		printf("ERR: no room for command '%.3s'\n", name);
+		return false;
+	}
+
+	uint32_t i = _slot_of(code);
+	while (commands[i].code)
+	{
+		if (commands[i].code == code)
+		{
+			printf("ERR: command '%.3s' is already registered\n", name);
+			return false;
+		}
+		i = (i + 1) & (MAX_N_COMMANDS - 1);
+	}
+	commands[i].code = code;
+	commands[i].handler = handler;
+	n_commands++;
+	return true;
+}
+
+bool dispatch_command(const DataPacket* data)
+{
+	uint32_t code = cmd_code(data->cmd);
+
+	for (uint32_t i = _slot_of(code); commands[i].code; i = (i + 1) & (MAX_N_COMMANDS - 1))
+	{
+		if (commands[i].code == code)
+		{
+			commands[i].handler(data);
+			return true;
+		}
+	}
+	return false;
+}
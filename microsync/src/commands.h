@@ -0,0 +1,52 @@
+/**
+ * @file commands.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Registry of UART commands.
+ *
+ * Every command is identified by its 3-character name, which is packed into
+ * a 32-bit code with cmd_code(). Letters are converted to upper case, so the
+ * names stay case-insensitive. Handlers are kept in an open-addressing hash
+ * table with MAX_N_COMMANDS slots, so a command is found with a single
+ * multiply and usually one comparison, no matter how many commands exist.
+ *
+ * Modules add their commands with register_command() during initialization;
+ * the core commands are registered by init_uart_comm().
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Command handler; receives the whole packet with the arguments.
+ */
+using CommandHandler = void (*)(const DataPacket* data);
+
+/**
+ * @brief Pack a 3-character command name into a 32-bit code.
+ * @param name Command name; only the first 3 characters are used
+ * @return Code with the characters in bytes 0-2, upper case
+ */
+static inline constexpr uint32_t cmd_code(const char* name)
+{
+	return ((uint32_t) (uint8_t) (name[0] - ((name[0] >= 'a' && name[0] <= 'z') ? 32 : 0))) |
+	       ((uint32_t) (uint8_t) (name[1] - ((name[1] >= 'a' && name[1] <= 'z') ? 32 : 0)) << 8) |
+	       ((uint32_t) (uint8_t) (name[2] - ((name[2] >= 'a' && name[2] <= 'z') ? 32 : 0)) << 16);
+}
+
+/**
+ * @brief Add a command to the registry.
+ * @param name 3-character command name
+ * @param handler Function that executes the command
+ * @return false if the name is already taken or the table is full
+ */
+bool register_command(const char* name, CommandHandler handler);
+
+/**
+ * @brief Execute the handler of a command.
+ * @param data Received packet; data->cmd selects the handler
+ * @return false if the command is not registered
+ */
+bool dispatch_command(const DataPacket* data);
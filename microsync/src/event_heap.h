@@ -0,0 +1,208 @@
+/**
+ * @file event_heap.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Fixed-capacity binary heap used as the event queue.
+ *
+ * This module provides a statically sized priority queue that never touches
+ * the heap allocator. The storage is part of the object itself, so a global
+ * instance is placed in .bss and constructed at compile time. In addition to
+ * the usual push/pop interface, it offers replace_top() which reschedules the
+ * top element with a single sift-down.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Statically sized max-heap with std::priority_queue ordering.
+ *
+ * Elements are ordered with operator<, exactly like std::priority_queue:
+ * top() returns the element for which no other element compares greater.
+ *
+ * @tparam T Element type; must be copyable and provide operator<
+ * @tparam Capacity Maximum number of elements
+ */
+template <typename T, size_t Capacity>
+class StaticHeap {
+private:
+	T items[Capacity]; /**< Heap storage, items[0] is the top */
+	size_t n;          /**< Number of elements in the heap */
+
+	/**
+	 * @brief Move the element at index i up until the heap property holds.
+	 * @param i Index of the element to sift up
+	 */
+	void sift_up(size_t i)
+	{
+		T item = items[i];
+		while (i > 0)
+		{
+			size_t parent = (i - 1) >> 1;
+			if (!(items[parent] < item))
+			{
+				break;
+			}
+			items[i] = items[parent];
+			i = parent;
+		}
+		items[i] = item;
+	}
+
+	/**
+	 * @brief Move the element at index i down until the heap property holds.
+	 * @param i Index of the element to sift down
+	 *
+	 * The hole is moved down to a leaf along the higher-priority children,
+	 * then the element is sifted up from there. The element usually belongs
+	 * near the bottom (a rescheduled event is later than most others), so
+	 * this needs one comparison per level instead of two.
+	 */
+	void sift_down(size_t i)
+	{
+		T item = items[i];
+		size_t child;
+		while ((child = 2 * i + 1) < n)
+		{
+			// pick the child with the higher priority
+			if (child + 1 < n && items[child] < items[child + 1])
+			{
+				child++;
+			}
+			items[i] = items[child];
+			i = child;
+		}
+		items[i] = item;
+		sift_up(i);
+	}
+
+public:
+	/**
+	 * @brief Construct an empty heap.
+	 *
+	 * The constructor is constexpr so that global instances are
+	 * initialized at compile time and don't need a static constructor.
+	 */
+	constexpr StaticHeap() : items(), n(0) {}
+
+	/**
+	 * @brief Maximum number of elements the heap can hold.
+	 * @return Heap capacity
+	 */
+	static constexpr size_t capacity() { return Capacity; }
+
+	/**
+	 * @brief Number of elements in the heap.
+	 * @return Current heap size
+	 */
+	size_t size() const { return n; }
+
+	/**
+	 * @brief Check whether the heap is empty.
+	 * @return true if there are no elements in the heap
+	 */
+	bool empty() const { return n == 0; }
+
+	/**
+	 * @brief Check whether the heap is full.
+	 * @return true if no more elements can be pushed
+	 */
+	bool full() const { return n >= Capacity; }
+
+	/**
+	 * @brief Access the element with the highest priority.
+	 * @return Reference to the top element; undefined if the heap is empty
+	 */
+	const T& top() const { return items[0]; }
+
+	/**
+	 * @brief Insert a new element.
+	 * @param item Element to insert
+	 * @return false if the heap is full and the element was dropped
+	 */
+	bool push(const T& item)
+	{
+		if (full())
+		{
+			return false;
+		}
+		items[n] = item;
+		sift_up(n++);
+		return true;
+	}
+
+	/**
+	 * @brief Remove the top element.
+	 */
+	void pop()
+	{
+		if (n == 0)
+		{
+			return;
+		}
+		if (--n > 0)
+		{
+			items[0] = items[n];
+			sift_down(0);
+		}
+	}
+
+	/**
+	 * @brief Replace the top element and restore the heap order.
+	 * @param item Element that takes the place of the current top
+	 *
+	 * Equivalent to pop() followed by push(item), but it needs only one
+	 * sift-down. Used to reschedule repeating events in place.
+	 */
+	void replace_top(const T& item)
+	{
+		items[0] = item;
+		if (n == 0)
+		{
+			n = 1;
+		}
+		sift_down(0);
+	}
+
+	/**
+	 * @brief Remove all elements.
+	 */
+	void clear() { n = 0; }
+
+	/**
+	 * @brief Copy the element stored at a given storage index.
+	 * @param i Storage index, from 0 to capacity() - 1
+	 * @param item Output, receives a copy of the element
+	 * @return false if the storage slot is empty
+	 *
+	 * Elements are visited in heap order, not in priority order.
+	 */
+	bool at(size_t i, T* item) const
+	{
+		if (i >= n)
+		{
+			return false;
+		}
+		*item = items[i];
+		return true;
+	}
+
+	/**
+	 * @brief Modify every element in place.
+	 * @param f Callable taking `T&`
+	 *
+	 * The heap is not reordered, so f must preserve the relative order of
+	 * the elements, e.g. shift all keys by the same amount.
+	 */
+	template <typename F>
+	void for_each(F f)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			f(items[i]);
+		}
+	}
+};
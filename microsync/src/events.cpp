@@ -8,14 +8,35 @@
 
 
 #include "events.h"
+#include "hw_pulse.h"
+#include "waveform.h"
+#include "latency.h"
+#include "profiler.h"
+#include "trace.h"
+#include "ext_pTIRF.h"
+#include "pin_group.h"
+#include "burst.h"
+#include "pwm.h"
 
 volatile uint32_t default_pulse_duration_us = 100;
 
-// Create a table of events
-std::priority_queue<Event> event_queue;
+// Create a table of events; the storage is statically allocated
+EventQueue event_queue;
+
+uint64_t event_ts_base = 0;
+
+static_assert(N_EVENT_OPS <= PROF_MAX_FUNCS, "the profiler needs a slot for every event function");
+
+// Timestamp of the event that is being fired
+static volatile uint64_t dispatched_ts = 0;
 
 volatile bool sys_timer_running = false;
+volatile bool sys_timer_paused = false;
+volatile bool sys_timer_armed = false;
+volatile uint32_t sys_tc_trig_latency_cts = 0;
 volatile uint64_t sys_tc_ovf_count = 0;
+volatile uint32_t sys_tc_last_cv = 0;
+volatile uint32_t sys_tc_presc_shift = __builtin_ctz(SYS_TC_DEFAULT_PRESCALER);
 
 /************************************************************************/
 /*                  INTERNAL FUNCTION PROTOTYPES                        */
@@ -24,6 +45,7 @@ static inline void _update_ra();
 static inline void _enable_event_irq();
 static inline void _disable_event_irq();
 static inline bool _update_event(Event *event);
+static inline void _dispatch_event(const Event* event);
 static inline void _enqueue_event(const Event* event);  // thread-safe
 
 /************************************************************************/
@@ -32,35 +54,141 @@ static inline void _enqueue_event(const Event* event);  // thread-safe
 
 void process_events()
 {
+	PROF_SCOPE(PROF_PROCESS_EVENTS);
 	static Event event;
+	uint64_t batch_ts = 0;
 	
 	_disable_event_irq();
-		while (!event_queue.empty())		{
+	// Pin writes of events on the same tick are merged into single port writes
+	pins_begin_batch();
+		while (!event_queue.empty())
+		{
 			// Keep processing events from the queue while they are pending
-			event = event_queue.top();			if (event.ts64_cts > current_time_cts() + TS_TOLERANCE_CTS)  // it's a future event			{				// Update the RA register for compare interrupt
-				tc_write_ra(SYS_TC, SYS_TC_CH, event.ts_lo32_cts);				tc_write_rc(SYS_TC, SYS_TC_CH, event.ts_lo32_cts + 1);				break;  // Our job is done			}			// Fire the event function			event.func(event.arg1, event.arg2);			event_queue.pop();  // remove the event from the queue, preserving order			if (_update_event(&event))  // Needs to be rescheduled?
+			event = event_queue.top();
+			uint64_t now_cts = current_time_cts();
+			uint64_t ts_cts = event_ts(&event);
+			if (ts_cts > now_cts + TS_TOLERANCE_CTS)  // it's a future event
+			{
+				// Update the RA register for compare interrupt
+				tc_write_ra(SYS_TC, SYS_TC_CH, (uint32_t) ts_cts);
+				tc_write_rc(SYS_TC, SYS_TC_CH, (uint32_t) ts_cts + 1);
+				break;  // Our job is done
+			}
+
+			// Apply edges of the previous tick before moving to the next one
+			if (ts_cts != batch_ts)
+			{
+				pins_flush_batch();
+				batch_ts = ts_cts;
+			}
+
+			int64_t late_cts = (int64_t) (now_cts - ts_cts);
+			record_lateness(late_cts);
+			trace_event(event.op, event.idx, event.arg, ts_cts, (int32_t) late_cts);
+
+			// Fire the event function
+			dispatched_ts = ts_cts;
+			PROF_CALL_EVENT_FUNC(event.op, _dispatch_event(&event));
+
+			if (_update_event(&event))  // Needs to be rescheduled?
 			{
-				// Put updated event back, preserving order of the queue
-				event_queue.push(event);
-			}		}
+				// Put updated event back in place of the fired one, preserving order of the queue
+				event_queue.replace_top(event);
+			}
+			else
+			{
+				event_queue.pop();  // remove the event from the queue, preserving order
+			}
+		}
+	pins_commit_batch();
 	_enable_event_irq();
 }
 
 
-void init_burst_timer()
+uint64_t dispatched_event_ts()
 {
-	sysclk_enable_peripheral_clock(ID_TC6); // TC2, channel 0
-	tc_init(TC2, 0,
-	TC_CMR_TCCLKS_TIMER_CLOCK1 |  // same time unit as the main clock
-	TC_CMR_WAVE |          // waveform mode
-	TC_CMR_ASWTRG_SET |  // set on timer start
-	TC_CMR_ACPA_CLEAR |      // clear on compare event A
-	TC_CMR_ACPC_SET |    // set on compare event C
-	TC_CMR_WAVSEL_UP_RC    // reset timer on event C
-	);
-}// Process the event metadatastatic inline bool _update_event(Event *event)
+	return dispatched_ts;
+}
+
+
+// Execute the event function selected by the opcode. The switch compiles to a
+// jump table, and the pin functions of this file are inlined into it.
+static inline void _dispatch_event(const Event* event)
 {
-	if (event->interv_cts >= MIN_EVENT_INTERVAL) // repeating event	{		event->ts64_cts += event->interv_cts;		if (event->N == 0){  // infinite event - reschedule			return true;		}		// if (N == 1), it was a last call, and we drop it		if (event->N > 1) {  // reschedule the event			event->N--;			return true;		}	}	return false;
+	switch (event->op)
+	{
+		case OP_TGL_PIN:
+			tgl_pin_event_func(event->idx, event->arg);
+			break;
+		case OP_SET_PIN:
+			set_pin_event_func(event->idx, event->arg);
+			break;
+		case OP_BURST_ON:
+			start_burst_func(event->idx, event->arg);
+			break;
+		case OP_BURST_OFF:
+			stop_burst_func(event->idx, event->arg);
+			break;
+		case OP_EN_PIN:
+			enable_pin_func(event->idx, event->arg);
+			break;
+		case OP_DIS_PIN:
+			disable_pin_func(event->idx, event->arg);
+			break;
+		case OP_OPEN_SHUTTERS:
+			open_shutters(event->idx);
+			break;
+		case OP_CLOSE_SHUTTERS:
+			close_shutters(event->idx);
+			break;
+		case OP_WAVEFORM_ON:
+			start_waveform_func(event->idx, event->arg);
+			break;
+		case OP_WAVEFORM_OFF:
+			stop_waveform_func(event->idx, event->arg);
+			break;
+		case OP_HW_PULSE_ARM:
+			arm_hw_pulse_func(event->idx, event->arg);
+			break;
+		case OP_GROUP_WRITE:
+			write_pin_group_func(event->idx, event->arg);
+			break;
+		case OP_BURST_CH_ON:
+			start_burst_channel_func(event->idx, event->arg);
+			break;
+		case OP_BURST_CH_OFF:
+			stop_burst_channels_func(event->idx, event->arg);
+			break;
+		case OP_PWM_DUTY:
+			set_pwm_duty_func(event->idx, event->arg);
+			break;
+		case OP_PWM_STEP:
+			step_pwm_duty_func(event->idx, event->arg);
+			break;
+		case OP_PWM_PERIOD:
+			set_pwm_period_func(event->idx, event->arg);
+			break;
+		default:
+			event_func_not_set(event->idx, event->arg);
+	}
+}
+
+// Process the event metadata
+static inline bool _update_event(Event *event)
+{
+	if (event->interv_cts >= MIN_EVENT_INTERVAL) // repeating event
+	{
+		event->ts_ofs_cts += event->interv_cts;  // can't overflow, see rebase_event_queue()
+		if (event->N == 0){  // infinite event - reschedule
+			return true;
+		}
+		// if (N == 1), it was a last call, and we drop it
+		if (event->N > 1) {  // reschedule the event
+			event->N--;
+			return true;
+		}
+	}
+	return false;
 }
 
 /************************************************************************/
@@ -69,23 +197,64 @@ void init_burst_timer()
 
 // Create an Event with data from a DataPacket.
 // All timestamps are converted from microseconds to SYS_TC counts
-// NOTE: you will have to deallocate memory yourself!
-Event* event_from_datapacket(const DataPacket* packet, EventFunc func)
+Event event_from_datapacket(const DataPacket* packet, EventOp op)
 {
-	Event* new_event = new Event();
+	Event new_event;
 	// Copy fields from DataPacket to Event
-	new_event->func = func;
-	new_event->arg1 = packet->arg1;
-	new_event->arg2 = packet->arg2;
-	new_event->ts64_cts = us2cts(packet->ts_us) + UNIFORM_TIME_DELAY_CTS;
+	new_event.op = op;
+	new_event.arg = packet->arg2;
+	set_event_ts(&new_event, us2cts(packet->ts_us) + UNIFORM_TIME_DELAY_CTS);
 	
 	// N is 1 (one-time event) if interval is too small
-	new_event->N = (packet->interv_us < MIN_EVENT_INTERVAL) ? 1 : packet->N;
-	new_event->interv_cts = us2cts(packet->interv_us);
+	set_event_repeat(&new_event, (packet->interv_us < MIN_EVENT_INTERVAL) ? 1 : packet->N,
+	                 us2cts(packet->interv_us));
 	
 	return new_event;
 }
 
+void set_event_repeat(Event* event, uint32_t N, uint64_t interv_cts)
+{
+	if (N == 1)
+	{
+		interv_cts = 0;  // one-time event, the interval doesn't matter
+	}
+	if (N > UINT16_MAX || interv_cts >= EVENT_MAX_INTERVAL_CTS)
+	{
+		printf("ERR: N must not exceed %u, interval must be below %lu us\n",
+		       UINT16_MAX, (uint32_t) cts2us(EVENT_MAX_INTERVAL_CTS));
+		event->ts_ofs_cts = EVENT_TS_INVALID;
+		return;
+	}
+	event->N = N;
+	event->interv_cts = (uint32_t) interv_cts;
+}
+
+void rebase_event_queue()
+{
+	uint64_t ahead = current_time_cts() - event_ts_base;
+	if (!sys_timer_running || ahead < EVENT_REBASE_THRESHOLD_CTS)
+	{
+		return;
+	}
+
+	_disable_event_irq();
+		// The base doesn't pass the earliest event, so no offset is clamped
+		// and the order of the events is kept
+		if (!event_queue.empty() && event_queue.top().ts_ofs_cts < ahead)
+		{
+			ahead = event_queue.top().ts_ofs_cts;
+		}
+		uint32_t delta = (uint32_t) (ahead & ~((uint64_t) EVENT_REBASE_ALIGN_CTS - 1));
+
+		// The base moves first, so the timestamps (base + offset) the timing
+		// wheel is keyed by stay the same while it relinks the events
+		event_ts_base += delta;
+		event_queue.for_each([delta](Event& e) {
+			e.ts_ofs_cts -= delta;
+		});
+	_enable_event_irq();
+}
+
 
 // Schedule event relative to t=0
 void schedule_event(const Event *event_p, bool relative)
@@ -93,16 +262,27 @@ void schedule_event(const Event *event_p, bool relative)
 	static Event relative_event;
 	
 	// Do we have enough memory?
-	if (event_queue.size() >= MAX_N_EVENTS)
+	if (event_queue.full())
 	{
 		uart_tx("ERR: event table is full!\n");
 		return;
 	}
 	
+	if (event_p->ts_ofs_cts == EVENT_TS_INVALID)
+	{
+		uart_tx("ERR: event can't be scheduled that far ahead\n");
+		return;
+	}
+	
 	if (relative & sys_timer_running)
 	{
 		relative_event = *event_p;
-		relative_event.ts64_cts += current_time_cts();
+		set_event_ts(&relative_event, event_ts(&relative_event) + current_time_cts());
+		if (relative_event.ts_ofs_cts == EVENT_TS_INVALID)
+		{
+			uart_tx("ERR: event can't be scheduled that far ahead\n");
+			return;
+		}
 
 		_enqueue_event(&relative_event);
 	}
@@ -122,8 +302,8 @@ static inline void _update_ra()
 	_disable_event_irq();
 		next_event = event_queue.top();
 		// Update the RA register for compare interrupt
-		tc_write_ra(SYS_TC, SYS_TC_CH, next_event.ts64_cts);
-		tc_write_rc(SYS_TC, SYS_TC_CH, next_event.ts64_cts + 1);
+		tc_write_ra(SYS_TC, SYS_TC_CH, (uint32_t) event_ts(&next_event));
+		tc_write_rc(SYS_TC, SYS_TC_CH, (uint32_t) event_ts(&next_event) + 1);
 	_enable_event_irq();
 }
 
@@ -144,13 +324,17 @@ static inline void _enqueue_event(const Event* event)
 // data->arg2 is polarity (0 or 1)
 void schedule_pin(const DataPacket *data)
 {
-	Event* event_p = event_from_datapacket(data, set_pin_event_func);
+	Event event = event_from_datapacket(data, OP_SET_PIN);
 
 	// Convert pin name to ioport index for the event function
-	event_p->arg1 = pin_name_to_ioport_id(data->arg1);
+	uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+	if (pin_idx == PIN_ID_INVALID)
+	{
+		return;  // reported by pin_name_to_ioport_id()
+	}
+	event.idx = pin_idx;
 
-	schedule_event(event_p);
-	delete event_p;
+	schedule_event(&event);
 }
 
 
@@ -159,26 +343,42 @@ void schedule_pin(const DataPacket *data)
 // data->arg2 is the pulse duration in us
 void schedule_pulse(const DataPacket *data, bool is_positive)
 {
-	Event* event_p = event_from_datapacket(data, set_pin_event_func);
+	Event event = event_from_datapacket(data, OP_SET_PIN);
 
 	// Convert pin name to ioport index for the event function
-	event_p->arg1 = pin_name_to_ioport_id(data->arg1);
-	event_p->arg2 = is_positive ? 1 : 0;
+	uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+	if (pin_idx == PIN_ID_INVALID)
+	{
+		return;  // reported by pin_name_to_ioport_id()
+	}
+	event.idx = pin_idx;
+	event.arg = is_positive ? 1 : 0;
+
+	uint32_t duration_us = (data->arg2 > 0) ? data->arg2 : default_pulse_duration_us;
 
 	// Schedule front of the pulse
-	if (sys_timer_running)
+	if (sys_timer_running && event.ts_ofs_cts != EVENT_TS_INVALID)
 	{
-		event_p->ts64_cts += current_time_cts();
+		set_event_ts(&event, event_ts(&event) + current_time_cts());
+	}
+
+	// Let the timer generate both edges if the pin supports it
+	if (hw_pulses_enabled && hw_pulse_capable(event.idx))
+	{
+		schedule_hw_pulse(&event, is_positive, duration_us);
+		return;
 	}
 	
-	schedule_event(event_p, false);
+	schedule_event(&event, false);
 
 	// Schedule back of the pulse
-	event_p->ts64_cts += us2cts((data->arg2 > 0) ? data->arg2 : default_pulse_duration_us);
-	event_p->arg2 = is_positive ? 0 : 1;
-	schedule_event(event_p, false);
+	if (event.ts_ofs_cts != EVENT_TS_INVALID)
+	{
+		set_event_ts(&event, event_ts(&event) + us2cts(duration_us));
+	}
+	event.arg = is_positive ? 0 : 1;
+	schedule_event(&event, false);
 
-	delete event_p;
 }
 
 
@@ -188,16 +388,25 @@ void schedule_pulse(uint32_t pin_idx, uint32_t pulse_duration_us, uint64_t times
 	uint64_t now_cts = (relative && sys_timer_running) ? current_time_cts() : 0;
 	
 	Event event;
-	event.func = set_pin_event_func;
-	event.arg1 = pin_idx;
-	event.arg2 = 1;  // rising edge
-	event.ts64_cts = us2cts(timestamp_us) + now_cts;
-	event.N = N;
-	event.interv_cts = us2cts(interval_us);
+	event.op = OP_SET_PIN;
+	event.idx = pin_idx;
+	event.arg = 1;  // rising edge
+	set_event_ts(&event, us2cts(timestamp_us) + now_cts);
+	set_event_repeat(&event, N, us2cts(interval_us));
+
+	if (hw_pulses_enabled && hw_pulse_capable(pin_idx))
+	{
+		schedule_hw_pulse(&event, true, pulse_duration_us);
+		return;
+	}
+
 	schedule_event(&event, false);
 	
-	event.arg2 = 0;  // falling edge
-	event.ts64_cts += us2cts(pulse_duration_us);
+	event.arg = 0;  // falling edge
+	if (event.ts_ofs_cts != EVENT_TS_INVALID)
+	{
+		set_event_ts(&event, event_ts(&event) + us2cts(pulse_duration_us));
+	}
 	schedule_event(&event, false);
 }
 
@@ -207,90 +416,103 @@ void schedule_pulse(uint32_t pin_idx, uint32_t pulse_duration_us, uint64_t times
 // data->arg2 is ignored
 void schedule_toggle(const DataPacket *data)
 {
-	Event* event_p = event_from_datapacket(data, tgl_pin_event_func);
+	Event event = event_from_datapacket(data, OP_TGL_PIN);
 
 	// Convert pin name to ioport index for the event function
-	event_p->arg1 = pin_name_to_ioport_id(data->arg1);
+	uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+	if (pin_idx == PIN_ID_INVALID)
+	{
+		return;  // reported by pin_name_to_ioport_id()
+	}
+	event.idx = pin_idx;
 
-	schedule_event(event_p);
-	delete event_p;
+	schedule_event(&event);
 }
 
 
 void schedule_burst(const DataPacket *data)
 {
-	Event* event_p = event_from_datapacket(data, start_burst_func);
+	Event event = event_from_datapacket(data, OP_BURST_ON);
 
 	// Convert us to TC2[0] counts (runs at 42MHz)
-	event_p->arg1 = data->arg1 * 42;
+	event.arg = data->arg1 * 42;
 
 	// Schedule front of the burst
-	if (sys_timer_running)
+	if (sys_timer_running && event.ts_ofs_cts != EVENT_TS_INVALID)
 	{
-		event_p->ts64_cts += current_time_cts();
+		set_event_ts(&event, event_ts(&event) + current_time_cts());
 	}
 	
-	schedule_event(event_p, false);
+	schedule_event(&event, false);
 
 	// Schedule stop of the burst
-	event_p->func = stop_burst_func;
-	event_p->ts64_cts += us2cts((data->arg2 > 0) ? data->arg2 : default_pulse_duration_us);
-	schedule_event(event_p, false);
+	event.op = OP_BURST_OFF;
+	if (event.ts_ofs_cts != EVENT_TS_INVALID)
+	{
+		set_event_ts(&event, event_ts(&event) + us2cts((data->arg2 > 0) ? data->arg2 : default_pulse_duration_us));
+	}
+	schedule_event(&event, false);
 
-	delete event_p;
 }
 
 
 void schedule_enable_pin(const DataPacket *data)
 {
-	Event* event_p = event_from_datapacket(data, enable_pin_func);
+	Event event = event_from_datapacket(data, OP_EN_PIN);
 
 	// Convert pin name to ioport index for the event function
-	event_p->arg1 = pin_name_to_ioport_id(data->arg1);
+	uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+	if (pin_idx == PIN_ID_INVALID)
+	{
+		return;  // reported by pin_name_to_ioport_id()
+	}
+	event.idx = pin_idx;
 
-	schedule_event(event_p);
-	delete event_p;
+	schedule_event(&event);
 }
 
 void schedule_disable_pin(const DataPacket *data)
 {
-	Event* event_p = event_from_datapacket(data, disable_pin_func);
+	Event event = event_from_datapacket(data, OP_DIS_PIN);
 
 	// Convert pin name to ioport index for the event function
-	event_p->arg1 = pin_name_to_ioport_id(data->arg1);
+	uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+	if (pin_idx == PIN_ID_INVALID)
+	{
+		return;  // reported by pin_name_to_ioport_id()
+	}
+	event.idx = pin_idx;
 
-	schedule_event(event_p);
-	delete event_p;
+	schedule_event(&event);
 }
 
 /************************************************************************/
 /*                 FUNCTION TO USE WITHIN EVENTS                        */
 /************************************************************************/
 
+void event_func_not_set(uint32_t arg1_unused, uint32_t arg2_unused)
+{
+	printf("ERR: Event func not set!\n");
+}
+
 void tgl_pin_event_func(uint32_t arg1_pin_idx, uint32_t arg2_unused)
 {
-	pins[arg1_pin_idx].toggle();
+	pins[arg1_pin_idx].stage_level(!pins[arg1_pin_idx].get_level());
 }
 
 void set_pin_event_func(uint32_t arg1_pin_idx, uint32_t arg2_level)
 {
-	pins[arg1_pin_idx].set_level(arg2_level);
+	pins[arg1_pin_idx].stage_level(arg2_level);
 }
 
-void start_burst_func(uint32_t arg1_period, uint32_t arg2_unused)
+void start_burst_func(uint32_t arg1_unused, uint32_t arg2_period)
 {
-	tc_stop(TC2, 0);
-	TC2->TC_CHANNEL[0].TC_RA = arg1_period >> 3; // 1/8th of the period
-	TC2->TC_CHANNEL[0].TC_RC = arg1_period;
-	pio_set_peripheral(PIOC, PIO_PERIPH_B, PIO_PC25);
-	tc_start(TC2, 0);
+	start_burst_train(0, arg2_period, arg2_period >> 3, 0);  // 1/8th of the period
 }
 
 void stop_burst_func(uint32_t arg1_unused, uint32_t arg2_unused)
 {
-	tc_stop(TC2, 0);
-	pio_set_output(PIOC, PIO_PC25, 0, 0, 0);
-	pio_set_pin_low(PIO_PC25_IDX);
+	stop_burst_channels_func(1UL << 0, 0);
 }
 
 void enable_pin_func(uint32_t arg1_pin_idx, uint32_t arg2)
@@ -319,21 +541,124 @@ float current_time_s()
 	return ((float) cts2us(current_time_cts())) / 1000000.0;
 }
 
+// External trigger inputs of the system timer. The TCLK pins of the TC1
+// block reach the channel through the XC0..XC2 external clock signals.
+typedef struct {
+	uint32_t pin_idx;  // IOPORT index of the input pin
+	uint32_t periph;   // IOPORT mode of the TCLK function
+	uint32_t bmr;      // block mode selecting the TCLK for the XC signal
+	uint32_t bmr_msk;
+	uint32_t eevt;     // external event selection of the channel mode
+} TrigInput;
+
+static const TrigInput trig_inputs[] = {
+	{PIO_PA22_IDX, IOPORT_MODE_MUX_B, TC_BMR_TC0XC0S_TCLK0, TC_BMR_TC0XC0S_Msk, TC_CMR_EEVT_XC0},  //  A3, TCLK3
+	{PIO_PA23_IDX, IOPORT_MODE_MUX_B, TC_BMR_TC1XC1S_TCLK1, TC_BMR_TC1XC1S_Msk, TC_CMR_EEVT_XC1},  //  A2, TCLK4
+	{PIO_PB16_IDX, IOPORT_MODE_MUX_A, TC_BMR_TC2XC2S_TCLK2, TC_BMR_TC2XC2S_Msk, TC_CMR_EEVT_XC2},  // A13, TCLK5
+};
+
+#define N_TRIG_INPUTS (sizeof(trig_inputs) / sizeof(trig_inputs[0]))
+
+// Trigger input switched to its TCLK function by arm_sys_timer(), if any
+static const TrigInput* armed_input = nullptr;
+
+// Drop a pending external trigger
+static inline void _disarm_sys_timer()
+{
+	SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IDR = TC_IDR_ETRGS;
+	SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR &= ~TC_CMR_ENETRG;
+	sys_timer_armed = false;
+
+	// A2 and A3 are shutter outputs otherwise; give them back to the PIO.
+	// A13 stays as it is, the gate module owns it.
+	if (armed_input && armed_input->pin_idx != GATE_PIN)
+	{
+		ioport_set_pin_mode(armed_input->pin_idx, 0);
+		ioport_set_pin_dir(armed_input->pin_idx, IOPORT_DIR_OUTPUT);
+		ioport_enable_pin(armed_input->pin_idx);
+		pins[armed_input->pin_idx].update();
+	}
+	armed_input = nullptr;
+}
+
+void arm_sys_timer(uint32_t pin_idx, uint32_t edge)
+{
+	const TrigInput* in = nullptr;
+	for (uint32_t i = 0; i < N_TRIG_INPUTS; i++)
+	{
+		if (trig_inputs[i].pin_idx == pin_idx)
+		{
+			in = &trig_inputs[i];
+		}
+	}
+	if (!in)
+	{
+		printf("ERR: pin %lu can't trigger the system timer; use A2, A3, or A13\n", pin_idx);
+		return;
+	}
+	if (edge > 2)
+	{
+		printf("ERR: trigger edge must be 0 (rising), 1 (falling), or 2 (both)\n");
+		return;
+	}
+	if (sys_timer_running)
+	{
+		printf("ERR: stop the system timer before arming it\n");
+		return;
+	}
+
+	_disarm_sys_timer();  // releases the input of a previous ARM
+	ioport_set_pin_mode(in->pin_idx, in->periph | IOPORT_MODE_PULLUP);
+	ioport_disable_pin(in->pin_idx);
+	armed_input = in;
+
+	irqflags_t flags = cpu_irq_save();
+		SYS_TC->TC_BMR = (SYS_TC->TC_BMR & ~in->bmr_msk) | in->bmr;
+
+		uint32_t cmr = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR & ~(TC_CMR_EEVT_Msk | TC_CMR_EEVTEDG_Msk);
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR = cmr | in->eevt | ((edge + 1) << TC_CMR_EEVTEDG_Pos) | TC_CMR_ENETRG;
+
+		// The counter free-runs until the trigger resets it to 0. Events are
+		// held back by the running flag, which is set in the trigger interrupt.
+		sys_tc_ovf_count = 0;
+		sys_tc_last_cv = 0;
+		sys_tc_trig_latency_cts = 0;
+		tc_get_status(SYS_TC, SYS_TC_CH);  // drop a stale trigger flag
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IER = TC_IER_ETRGS;
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CCR = TC_CCR_CLKEN;
+		sys_timer_armed = true;
+	cpu_irq_restore(flags);
+}
+
+uint32_t get_trig_latency_ns()
+{
+	return (uint32_t) (((uint64_t) sys_tc_trig_latency_cts << sys_tc_presc_shift) * 1000UL / SYS_TC_TICKS_PER_US);
+}
+
 // Start timer from 0
 void start_sys_timer()
 {
 	if (!sys_timer_running)
 	{
-		sys_timer_running = true;
+		_disarm_sys_timer();
+
+		// The counter restarts from 0; set the running flag afterwards so
+		// that the time is never read from the stale counter value
+		sys_tc_last_cv = 0;
 		tc_start(SYS_TC, SYS_TC_CH);
+		sys_timer_running = true;
 	}
 }
 
 // Stop system timer
 void stop_sys_timer()
 {
+	event_ts_base = 0;  // the time restarts from 0; the queue gets cleared by the caller
+	_disarm_sys_timer();
 	sys_timer_running = false;
 	sys_tc_ovf_count = 0;
+	sys_tc_last_cv = 0;
+	sys_timer_paused = false;
 	tc_stop(SYS_TC, SYS_TC_CH);
 }
 
@@ -363,14 +688,85 @@ void init_sys_timer()
 	NVIC_SetPriority(SYS_TC_IRQn, 1); // The highest priority is 0 (reserved for watchdog)
 }
 
-// This re-adjusts timestamps of scheduled events so we can pause and continue
+uint32_t get_sys_timer_prescaler()
+{
+	return SYS_TC_PRESCALER;
+}
+
+void set_sys_timer_prescaler(uint32_t prescaler)
+{
+	if (prescaler != 2 && prescaler != 8 && prescaler != 32 && prescaler != 128)
+	{
+		printf("ERR: prescaler must be 2, 8, 32, or 128\n");
+		return;
+	}
+	if (sys_timer_running || !event_queue.empty())
+	{
+		printf("ERR: stop the system timer and clear events before changing the prescaler\n");
+		return;
+	}
+
+	sys_tc_presc_shift = __builtin_ctz(prescaler);
+
+	// Update the clock selection, keep the rest of the channel mode
+	uint32_t cmr = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR;
+	SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR = (cmr & ~TC_CMR_TCCLKS_Msk) | SYS_TC_CMR_TCCLKS_TIMER_CLOCK;
+}
+
+bool sys_timer_gated()
+{
+	return (SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR & TC_CMR_BURST_Msk) == SYS_TC_CMR_BURST_GATE;
+}
+
+void set_sys_timer_gate(bool enabled)
+{
+	irqflags_t flags = cpu_irq_save();
+		SYS_TC->TC_BMR = (SYS_TC->TC_BMR & ~SYS_TC_GATE_BMR_Msk) | SYS_TC_GATE_BMR;
+
+		// Update the burst selection, keep the rest of the channel mode
+		uint32_t cmr = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR & ~TC_CMR_BURST_Msk;
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CMR = cmr | (enabled ? SYS_TC_CMR_BURST_GATE : TC_CMR_BURST_NONE);
+	cpu_irq_restore(flags);
+}
+
+// Freeze the timeline. The system timer clock is disabled, so the counter
+// holds its value and all pending timestamps stay valid without rebasing.
+// Other timers that take part in the timeline are frozen as well.
 void pause_sys_timer()
 {
-	tc_stop(SYS_TC, SYS_TC_CH);
-	//uint32_t stopped_at = tc_read_cv(SYS_TC, SYS_TC_CH);
-	
-	// update all pending events in the event table
-	printf("ERR: pause_sys_timer() - NOT IMPLEMENTED");
+	if (!sys_timer_running || sys_timer_paused)
+	{
+		return;
+	}
+
+	irqflags_t flags = cpu_irq_save();
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CCR = TC_CCR_CLKDIS;
+
+		pause_bursts();
+		pause_hw_pulses();
+		pause_waveform();
+
+		sys_timer_paused = true;
+	cpu_irq_restore(flags);
+}
+
+// Continue the timeline from the point where it has been frozen
+void resume_sys_timer()
+{
+	if (!sys_timer_paused)
+	{
+		return;
+	}
+
+	irqflags_t flags = cpu_irq_save();
+		resume_waveform();
+		resume_hw_pulses();
+		resume_bursts();
+
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CCR = TC_CCR_CLKEN;
+
+		sys_timer_paused = false;
+	cpu_irq_restore(flags);
 }
 
 
@@ -383,15 +779,25 @@ void pause_sys_timer()
 // one event.
 void SYS_TC_Handler()
 {
+	PROF_SCOPE(PROF_SYS_TC_ISR);
+
     // Read Timer Counter Status to clear the interrupt flag
 	uint32_t status = tc_get_status(SYS_TC, SYS_TC_CH);
-	
-    if (status & TC_SR_CPAS) {  // RA match
+
+	if ((status & TC_SR_ETRGS) && sys_timer_armed) {  // external trigger has started the timeline
+		// The counter has been reset by the trigger edge; its value is the latency of this interrupt
+		sys_tc_trig_latency_cts = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CV;
+		_disarm_sys_timer();
+		sys_timer_running = true;
+		status |= TC_SR_CPAS;  // catch up with the events due before now
+	}
+
+    if ((status & TC_SR_CPAS) && sys_timer_running) {  // RA match
 		process_events();
     }
 
     if (status & TC_SR_COVFS) {  // overflow
-	    sys_tc_ovf_count += (1ULL << 32);
+	    current_time_cts();  // registers the counter wrap, unless it's been done already
     }
 }
 
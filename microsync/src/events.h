@@ -5,7 +5,8 @@
  * 
  * This module implements a priority queue-based event scheduler that provides
  * microsecond-precision timing control for microscope synchronization. The system
- * can handle up to 450 scheduled events with 64-bit timestamp precision.
+ * can handle up to 450 scheduled events with 64-bit timestamp precision. The queue
+ * is statically allocated, so scheduling and dispatch never allocate memory.
  * 
  * @version \projectnumber
  */
@@ -21,8 +22,6 @@
 #undef max
 #endif
 
-#include <queue>          // priority queue, FIFO queue
-
 #ifndef UNIT_TEST
 #include <asf.h>
 #include "pins.h"
@@ -30,6 +29,8 @@
 
 #include "globals.h"
 #include "uart_comm.h"
+#include "event_heap.h"
+#include "timing_wheel.h"
 
 /**
  * @brief Default pulse duration in microseconds.
@@ -40,51 +41,159 @@
 extern volatile uint32_t default_pulse_duration_us;
 
 /**
- * @brief Function pointer type for event execution.
- * 
- * Event functions receive two 32-bit arguments and perform the actual
- * hardware control operations (pin setting, toggling, etc.).
- * 
- * @param arg1 First argument (typically pin index or duration)
- * @param arg2 Second argument (typically additional parameters)
+ * @brief Placeholder event function for events without a function.
+ * @param arg1 Unused parameter (for event function compatibility)
+ * @param arg2 Unused parameter (for event function compatibility)
+ *
+ * Reports an error if an event without a function gets executed.
+ */
+void event_func_not_set(uint32_t arg1, uint32_t arg2);
+
+/**
+ * @brief Event opcodes.
+ *
+ * Events store a 1-byte opcode instead of a function pointer. The event
+ * functions receive the event index and argument as two 32-bit arguments;
+ * process_events() selects them with a switch, so that the functions of
+ * events.cpp are inlined into the dispatcher.
+ *
+ * The opcodes are a stable part of the host protocol: they appear in the
+ * QUE dump, the execution trace, and the profiler output. New opcodes go
+ * to the end of the list.
+ */
+enum EventOp : uint8_t {
+	OP_NOT_SET = 0,       /**< event_func_not_set() */
+	OP_TGL_PIN,           /**< tgl_pin_event_func() */
+	OP_SET_PIN,           /**< set_pin_event_func() */
+	OP_BURST_ON,          /**< start_burst_func() */
+	OP_BURST_OFF,         /**< stop_burst_func() */
+	OP_EN_PIN,            /**< enable_pin_func() */
+	OP_DIS_PIN,           /**< disable_pin_func() */
+	OP_OPEN_SHUTTERS,     /**< open_shutters() */
+	OP_CLOSE_SHUTTERS,    /**< close_shutters() */
+	OP_WAVEFORM_ON,       /**< start_waveform_func() */
+	OP_WAVEFORM_OFF,      /**< stop_waveform_func() */
+	OP_HW_PULSE_ARM,      /**< arm_hw_pulse_func() */
+	OP_GROUP_WRITE,       /**< write_pin_group_func() */
+	OP_BURST_CH_ON,       /**< start_burst_channel_func() */
+	OP_BURST_CH_OFF,      /**< stop_burst_channels_func() */
+	OP_PWM_DUTY,          /**< set_pwm_duty_func() */
+	OP_PWM_STEP,          /**< step_pwm_duty_func() */
+	OP_PWM_PERIOD,        /**< set_pwm_period_func() */
+	N_EVENT_OPS
+};
+
+/**
+ * @brief Base of all event timestamps, in clock ticks.
+ *
+ * Events store their timestamp as a 32-bit offset from this base. The base
+ * follows the current time in steps of EVENT_REBASE_ALIGN_CTS, see
+ * rebase_event_queue(). It's only changed with the event interrupt disabled.
+ */
+extern uint64_t event_ts_base;
+
+/**
+ * @brief Timestamp offset of an event that can't be scheduled.
+ *
+ * Marks events whose time, repetition count, or interval doesn't fit into
+ * the compact event; schedule_event() rejects them.
  */
-using EventFunc = void (*)(uint32_t, uint32_t);
+#define EVENT_TS_INVALID UINT32_MAX
 
 /**
  * @brief Event structure for priority queue scheduling.
  * 
  * This structure represents a single scheduled event in the system.
  * Events are ordered by timestamp in a priority queue for precise execution.
- * The structure is packed to minimize memory usage.
  * 
- * @note The Event struct is 28 bytes in total. The event timestamp is stored as a 64-bit integer (ts64_cts), which can also be accessed as two 32-bit fields: ts_lo32_cts (lower 32 bits) and ts_hi32_cts (upper 32 bits).
+ * @note The Event struct is 16 bytes and naturally aligned, so the queue
+ * never needs unaligned accesses. The absolute timestamp of the event is
+ * event_ts_base + ts_ofs_cts; use event_ts() and set_event_ts() to access it.
  */
-typedef struct  __attribute__((packed)) Event
+typedef struct Event
 {
-	EventFunc func;            /**< Pointer to the function that will be executed for this event (4 bytes) */
-	uint32_t	  arg1;        /**< First function argument (4 bytes) */
-	uint32_t	  arg2;        /**< Second function argument (4 bytes) */
-	union                      /**< 64-bit timestamp in clock ticks (8 bytes) */
-	{
-		uint64_t  ts64_cts;    /**< Full 64-bit timestamp, shared with ts_lo32_cts and ts_hi32_cts */
-		struct {
-			uint32_t ts_lo32_cts;  /**< Lower 32 bits of the 64-bit timestamp - value of the hardware timer/counter */
-			uint32_t ts_hi32_cts;  /**< Upper 32 bits of the 64-bit timestamp - number of timer/counter overflows */
-		};
-	};
-	uint32_t	  N;           /**< Number of remaining event repetitions (4 bytes) */
-	uint32_t	  interv_cts;  /**< Interval between event repetitions in clock ticks (4 bytes) */
-
-   // Constructor
-   Event() : func([](uint32_t, uint32_t) { printf("ERR: Event func not set!\n"); }),
-	   arg1(0), arg2(0), ts64_cts(0), N(0), interv_cts(0) {}
+	uint32_t ts_ofs_cts;   /**< Timestamp in clock ticks, relative to event_ts_base (4 bytes) */
+	uint32_t interv_cts;   /**< Interval between event repetitions in clock ticks (4 bytes) */
+	uint32_t arg;          /**< Second argument of the event function (4 bytes) */
+	uint8_t  op;           /**< EventOp of the function that will be executed for this event (1 byte) */
+	uint8_t  idx;          /**< First argument of the event function, e.g. a pre-resolved IOPORT pin index (1 byte) */
+	uint16_t N;            /**< Number of remaining event repetitions, 0 for infinite (2 bytes) */
 
+	// Constructor; constexpr so that the event queue storage is built at compile time
+	constexpr Event() : ts_ofs_cts(0), interv_cts(0), arg(0), op(OP_NOT_SET), idx(0), N(0) {}
 
 	bool operator<(const Event& other) const {
-		return this->ts64_cts > other.ts64_cts;
+		return this->ts_ofs_cts > other.ts_ofs_cts;
 	}
-} Event;  // 28 bytes
+} Event;  // 16 bytes
 
+static_assert(sizeof(Event) == 16, "Event must stay 16 bytes");
+
+/**
+ * @brief Absolute timestamp of an event.
+ * @param event Event to read
+ * @return Timestamp in clock ticks
+ */
+inline uint64_t event_ts(const Event* event)
+{
+	return event_ts_base + event->ts_ofs_cts;
+}
+
+/**
+ * @brief Set the absolute timestamp of an event.
+ * @param event Event to update
+ * @param ts_cts Timestamp in clock ticks
+ *
+ * Timestamps before the base are clamped to it, since such events are due
+ * anyway. Timestamps too far in the future mark the event as invalid.
+ */
+inline void set_event_ts(Event* event, uint64_t ts_cts)
+{
+	uint64_t ofs = (ts_cts > event_ts_base) ? ts_cts - event_ts_base : 0;
+	event->ts_ofs_cts = (ofs < EVENT_TS_INVALID) ? (uint32_t) ofs : EVENT_TS_INVALID;
+}
+
+/**
+ * @brief Set the repetition count and interval of an event.
+ * @param event Event to update
+ * @param N Number of repetitions, 0 for infinite, up to 65535
+ * @param interv_cts Interval between repetitions in clock ticks, below EVENT_MAX_INTERVAL_CTS
+ *
+ * Marks the event as invalid and reports an error if the values don't fit.
+ */
+void set_event_repeat(Event* event, uint32_t N, uint64_t interv_cts);
+
+/**
+ * @brief Move the timestamp base forward if the current time is far ahead of it.
+ *
+ * Called from the main loop. Once the current time is EVENT_REBASE_THRESHOLD_CTS
+ * ahead of event_ts_base, the base advances by a multiple of EVENT_REBASE_ALIGN_CTS
+ * and the offsets of all queued events are reduced by the same amount, which
+ * keeps their order. The base doesn't pass the earliest queued event; such an
+ * event is already due and leaves the queue at once. Together with EVENT_MAX_INTERVAL_CTS, this guarantees
+ * that repeating events never overflow their offset, and that events up to
+ * 2^32 - EVENT_REBASE_THRESHOLD_CTS ticks in the future can always be scheduled.
+ */
+void rebase_event_queue();
+
+
+/**
+ * @brief Key of an event in the timing wheel - its timestamp.
+ */
+struct EventTimestamp {
+	static uint64_t key(const Event& event) { return event_ts(&event); }
+};
+
+/**
+ * @brief Event queue type - a fixed-capacity container holding MAX_N_EVENTS events.
+ *
+ * The backend is selected at build time in globals.h.
+ */
+#ifdef EVENT_QUEUE_TIMING_WHEEL
+using EventQueue = TimingWheel<Event, MAX_N_EVENTS, EventTimestamp>;
+#else
+using EventQueue = StaticHeap<Event, MAX_N_EVENTS>;
+#endif
 
 /**
  * @brief Priority queue of scheduled events.
@@ -92,7 +201,7 @@ typedef struct  __attribute__((packed)) Event
  * Events are automatically sorted by timestamp (earliest first).
  * The queue is processed by the system timer interrupt handler.
  */
-extern std::priority_queue<Event> event_queue;
+extern EventQueue event_queue;
 
 /**
  * @brief System timer overflow counter.
@@ -102,17 +211,26 @@ extern std::priority_queue<Event> event_queue;
  */
 extern volatile uint64_t sys_tc_ovf_count;
 
+/**
+ * @brief Last system timer counter value seen by current_time_cts().
+ * 
+ * Used to detect counter wraps in software, so that reading the time
+ * never depends on whether the overflow interrupt has run yet.
+ */
+extern volatile uint32_t sys_tc_last_cv;
+
 /**
  * @brief Create an event from a data packet.
  * 
- * Allocates memory and initializes an Event structure from the provided
- * data packet. If no function is specified, a default error handler is used.
+ * Initializes an Event structure from the provided data packet.
+ * No memory is allocated - the event is returned by value.
  * 
  * @param packet Pointer to the data packet containing event parameters
- * @param func Optional function pointer (defaults to nullptr)
- * @return Pointer to the allocated Event structure
+ * @param op Opcode of the event function (defaults to OP_NOT_SET)
+ * @return Event initialized from the data packet; arg is packet->arg2,
+ *         and idx must be set by the caller
  */
-Event* event_from_datapacket(const DataPacket* packet, EventFunc func=nullptr);
+Event event_from_datapacket(const DataPacket* packet, EventOp op=OP_NOT_SET);
 
 /**
  * @brief Schedule an event for execution.
@@ -136,7 +254,7 @@ void schedule_pulse(const DataPacket *data, bool is_positive);
 
 /**
  * @brief Schedule a pulse event with explicit parameters.
- * @param pin_idx IOPORT index of the pin to pulse (see pin_map_t in pins.cpp for pin names)
+ * @param pin_idx IOPORT index of the pin to pulse (see digital_pin_ids in pins.cpp for pin names)
  * @param pulse_duration_us Duration of the pulse in microseconds
  * @param timestamp_us Timestamp for the pulse in microseconds
  * @param N Number of pulses to generate
@@ -202,14 +320,6 @@ void schedule_disable_pin(const DataPacket *data);
  */
 void process_events();
 
-/**
- * @brief Initialize the burst timer.
- * 
- * Sets up the timer/counter used for generating burst pulse trains.
- * Configures the timer hardware and enables necessary interrupts.
- */
-void init_burst_timer();
-
 /**
  * @brief Initialize the system timer.
  * 
@@ -226,6 +336,25 @@ void init_sys_timer();
  */
 void start_sys_timer();
 
+/**
+ * @brief Arm the system timer to start on an external edge.
+ * @param pin_idx IOPORT index of the trigger input: A2, A3, or A13
+ * @param edge Trigger edge: 0 - rising, 1 - falling, 2 - both
+ *
+ * The trigger input is connected to the external event input of the
+ * timer channel (ENETRG), so the counter is reset to 0 by the edge itself
+ * and the timeline starts with the jitter of the timer clock only. The
+ * trigger interrupt then sets the running flag and starts event processing.
+ * The timer must be stopped; start_sys_timer() and stop_sys_timer() disarm it.
+ */
+void arm_sys_timer(uint32_t pin_idx, uint32_t edge);
+
+/**
+ * @brief Get the latency of the trigger interrupt after the last external start.
+ * @return Time between the trigger edge (t = 0) and the start of event processing, ns
+ */
+uint32_t get_trig_latency_ns();
+
 /**
  * @brief Stop the system timer.
  * 
@@ -237,11 +366,53 @@ void stop_sys_timer();
 /**
  * @brief Pause the system timer.
  * 
- * Temporarily stops the system timer without clearing the event queue.
- * Event processing can be resumed with start_sys_timer().
+ * Freezes the timeline without clearing the event queue. The system timer
+ * clock is disabled, so the counter holds its value and the pending events
+ * keep their position relative to it; the burst timer, hardware pulses, and
+ * waveform playback are frozen too. Event processing continues with
+ * resume_sys_timer(), as if all timestamps were shifted by the paused duration.
  */
 void pause_sys_timer();
 
+/**
+ * @brief Resume the system timer after pause_sys_timer().
+ */
+void resume_sys_timer();
+
+/**
+ * @brief Gate the system timer clock with the external gate input.
+ * @param enabled true to count only while GATE_PIN is high
+ *
+ * Uses the BURST input of the timer channel, so the timeline stalls and
+ * continues in hardware, within one timer tick of the gate edge and without
+ * any interrupt. The pin itself must be switched to its TCLK function by the
+ * caller (see gate.h). The burst timer, hardware pulses, and waveforms are
+ * not gated.
+ */
+void set_sys_timer_gate(bool enabled);
+
+/**
+ * @brief Check whether the system timer clock is gated by the external input.
+ * @return true if hardware gating is enabled
+ */
+bool sys_timer_gated();
+
+/**
+ * @brief Get the system timer prescaler.
+ * @return Prescaler value: 2, 8, 32, or 128
+ */
+uint32_t get_sys_timer_prescaler();
+
+/**
+ * @brief Change the system timer prescaler.
+ * @param prescaler New prescaler value: 2, 8, 32, or 128
+ * 
+ * The prescaler can only be changed while the system timer is stopped
+ * and the event queue is empty, because all scheduled timestamps are
+ * expressed in timer counts.
+ */
+void set_sys_timer_prescaler(uint32_t prescaler);
+
 /**
  * @brief System timer running state.
  * 
@@ -249,18 +420,59 @@ void pause_sys_timer();
  */
 extern volatile bool sys_timer_running;
 
+/**
+ * @brief System timer armed state.
+ * 
+ * Set by arm_sys_timer() until the external trigger starts the timer.
+ */
+extern volatile bool sys_timer_armed;
+
+/**
+ * @brief System timer paused state.
+ * 
+ * Set while the timeline is frozen by pause_sys_timer().
+ */
+extern volatile bool sys_timer_paused;
+
 /**
  * @brief Get current system time in native timer counts, including overflows.
  * @return Current system time in timer counts
  * 
  * Returns the current system time in native timer counts.
  * Uses the system timer and overflow counter for 64-bit precision.
+ * The read is tear-free: a counter wrap is detected by comparing with the
+ * previous counter value, and the overflow count is updated right here.
+ * The overflow interrupt calls this function too, which guarantees that
+ * no wrap is missed.
  */
 inline uint64_t current_time_cts()
 {
-	return (uint64_t) sys_timer_running * (sys_tc_ovf_count | SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CV);
+	if (!sys_timer_running)
+	{
+		return 0;
+	}
+
+	irqflags_t flags = cpu_irq_save();
+		uint32_t cv = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CV;
+		if (cv < sys_tc_last_cv)  // the counter has wrapped since the last read
+		{
+			sys_tc_ovf_count += (1ULL << 32);
+		}
+		sys_tc_last_cv = cv;
+		uint64_t now = sys_tc_ovf_count | cv;
+	cpu_irq_restore(flags);
+	return now;
 }
 
+/**
+ * @brief Get the timestamp of the event that is being fired.
+ * @return Scheduled timestamp of the current event in system timer counts
+ * 
+ * Valid only when called from an event function. Lets event functions
+ * refer to their exact scheduled time instead of the current time.
+ */
+uint64_t dispatched_event_ts();
+
 /**
  * @brief Get current system time in microseconds.
  * @return Current system time in microseconds
@@ -281,7 +493,7 @@ float current_time_s();
 
 /**
  * @brief Event function for toggling a pin.
- * @param arg1_pin_idx IOPORT index of the pin to toggle (see pin_map_t in pins.cpp for pin names)
+ * @param arg1_pin_idx IOPORT index of the pin to toggle (see digital_pin_ids in pins.cpp for pin names)
  * @param arg2 Unused parameter (for event function compatibility)
  * 
  * Event callback function that toggles the state of the specified pin.
@@ -291,7 +503,7 @@ void tgl_pin_event_func(uint32_t arg1_pin_idx, uint32_t arg2);
 
 /**
  * @brief Event function for setting a pin level.
- * @param arg1_pin_idx IOPORT index of the pin to set (see pin_map_t in pins.cpp for pin names)
+ * @param arg1_pin_idx IOPORT index of the pin to set (see digital_pin_ids in pins.cpp for pin names)
  * @param arg2 Pin level to set (0=low, 1=high)
  * 
  * Event callback function that sets the level of the specified pin.
@@ -301,13 +513,14 @@ void set_pin_event_func(uint32_t arg1_pin_idx, uint32_t arg2);
 
 /**
  * @brief Event function for starting a burst.
- * @param arg1_period Period of the burst in microseconds
- * @param arg2_unused Unused parameter (for event function compatibility)
+ * @param arg1_unused Unused parameter (for event function compatibility)
+ * @param arg2_period Period of the burst in burst timer counts (MCK/2)
  * 
- * Event callback function that starts a burst pulse train.
+ * Event callback function that starts a burst pulse train on burst
+ * channel 0 (D5) with a 1/8 duty cycle, see start_burst_train().
  * This function is used internally by the event system.
  */
-void start_burst_func  (uint32_t arg1_period,  uint32_t arg2_unused);
+void start_burst_func  (uint32_t arg1_unused,  uint32_t arg2_period);
 
 /**
  * @brief Event function for stopping a burst.
@@ -321,7 +534,7 @@ void stop_burst_func   (uint32_t arg1_unused,  uint32_t arg2_unused);
 
 /**
  * @brief Event function for enabling a pin.
- * @param arg1_pin_idx IOPORT index of the pin to enable (see pin_map_t in pins.cpp for pin names)
+ * @param arg1_pin_idx IOPORT index of the pin to enable (see digital_pin_ids in pins.cpp for pin names)
  * @param arg2 Unused parameter (for event function compatibility)
  * 
  * Event callback function that enables the specified pin.
@@ -331,7 +544,7 @@ void enable_pin_func   (uint32_t arg1_pin_idx, uint32_t arg2);
 
 /**
  * @brief Event function for disabling a pin.
- * @param arg1_pin_idx IOPORT index of the pin to disable (see pin_map_t in pins.cpp for pin names)	
+ * @param arg1_pin_idx IOPORT index of the pin to disable (see digital_pin_ids in pins.cpp for pin names)	
  * @param arg2 Unused parameter (for event function compatibility)
  * 
  * Event callback function that disables the specified pin.
@@ -346,8 +559,11 @@ inline bool is_event_missed()
 
 	if (sys_timer_running && !event_queue.empty())
 	{
+		// the queue may reorganize itself in top(), keep the event IRQ out
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IDR = TC_IDR_CPAS;
 		e = event_queue.top();
-		result = current_time_cts() > (e.ts64_cts + TS_MISSED_TOLERANCE_CTS);
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IER = TC_IER_CPAS;
+		result = current_time_cts() > (event_ts(&e) + TS_MISSED_TOLERANCE_CTS);
 	}
 	return result;
 }
@@ -8,6 +8,7 @@
 #include "ext_pTIRF.h"
 #include "events.h"
 #include "props.h"
+#include "commands.h"
 #include <cstdint>
 #include <algorithm>
 
@@ -38,7 +39,7 @@ void open_shutters(uint32_t mask)
 	{
 		if (mask & (1 << i))
 		{
-			pins[shutter_pins[i]].set_level(true);
+			pins[shutter_pins[i]].stage_level(true);
 		}
 	}
 }
@@ -53,7 +54,7 @@ void close_shutters(uint32_t mask)
 	{
 		if (mask & (1 << i))
 		{
-			pins[shutter_pins[i]].set_level(false);
+			pins[shutter_pins[i]].stage_level(false);
 		}
 	}
 }
@@ -93,22 +94,20 @@ void schedule_shutter_pulse(uint32_t pulse_duration_us,
 	uint64_t now_cts = (relative && sys_timer_running) ? current_time_cts() : 0;
 	
 	Event event;
-	event.func = open_shutters_func;
-	event.arg1 = selected_lasers();
-	event.ts64_cts = us2cts(timestamp_us) + now_cts;
-	event.N = N;
-	event.interv_cts = us2cts(interval_us);
+	event.op = OP_OPEN_SHUTTERS;
+	event.idx = selected_lasers();
+	set_event_ts(&event, us2cts(timestamp_us) + now_cts);
+	set_event_repeat(&event, N, us2cts(interval_us));
 	schedule_event(&event, false);
 	
-	event.func = close_shutters_func;
-	event.ts64_cts += us2cts(pulse_duration_us);
+	event.op = OP_CLOSE_SHUTTERS;
+	if (event.ts_ofs_cts != EVENT_TS_INVALID)
+	{
+		set_event_ts(&event, event_ts(&event) + us2cts(pulse_duration_us));
+	}
 	schedule_event(&event, false);
 }
 
-// Functions that can be used within even queue
-void open_shutters_func(uint32_t mask, uint32_t){open_shutters(mask);}
-void close_shutters_func(uint32_t mask, uint32_t){close_shutters(mask);}
-
 
 /************************************************************************/
 /*              SHORTCUTS FOR ACQUISITION MODES                         */
@@ -182,3 +181,10 @@ void start_ALEX_acq(const DataPacket* data) {
 	    }
     }
 }
+
+void init_pTIRF()
+{
+	register_command("CON", start_continuous_acq);
+	register_command("STR", start_stroboscopic_acq);
+	register_command("ALX", start_ALEX_acq);
+}
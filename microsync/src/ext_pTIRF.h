@@ -62,24 +62,6 @@ uint32_t selected_lasers();
  */
 void schedule_shutter_pulse(uint32_t pulse_duration_us, uint64_t timestamp_us, uint32_t N, uint32_t interval_us, bool relative);
 
-/**
- * @brief Event function wrapper for opening shutters.
- * @param mask Bitmask specifying which shutters to open
- * @param arg2 Unused parameter (for event function compatibility)
- * 
- * Wrapper function that can be used as an event callback to open shutters.
- */
-void open_shutters_func(uint32_t mask, uint32_t arg2);
-
-/**
- * @brief Event function wrapper for closing shutters.
- * @param mask Bitmask specifying which shutters to close
- * @param arg2 Unused parameter (for event function compatibility)
- * 
- * Wrapper function that can be used as an event callback to close shutters.
- */
-void close_shutters_func(uint32_t mask, uint32_t arg2);
-
 /**
  * @brief Start continuous acquisition mode.
  * @param data Data packet containing acquisition parameters
@@ -105,4 +87,9 @@ void start_stroboscopic_acq(const DataPacket* data);
  * Initiates ALEX acquisition mode for fluorescence resonance energy transfer (FRET) imaging.
  * This mode alternates between different laser excitations.
  */
-void start_ALEX_acq(const DataPacket* data);
\ No newline at end of file
+void start_ALEX_acq(const DataPacket* data);
+
+/**
+ * @brief Register the acquisition commands CON, STR, and ALX.
+ */
+void init_pTIRF();
@@ -0,0 +1,242 @@
+/*
+ * framing.cpp
+ *
+ * Decoder of the host byte stream: legacy packets and CRC-checked frames
+ */
+
+#include "framing.h"
+
+#define FRAME_HEADER_SIZE  4
+#define FRAME_CRC_SIZE     2
+#define FRAME_CMD_SIZE     4  // name and number of arguments
+#define FRAME_MAX_ARGS     5
+
+enum DecoderState : uint8_t {
+	DEC_IDLE,     // between packets
+	DEC_LEGACY,   // collecting a 24-byte DataPacket
+	DEC_HEADER,   // collecting the frame header
+	DEC_PAYLOAD,  // collecting the payload and the CRC
+};
+
+// CRC-16/CCITT of every 4-bit value
+static const uint16_t crc_nibble[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+uint16_t crc16_ccitt(uint16_t crc, uint8_t byte)
+{
+	crc = (crc << 4) ^ crc_nibble[(crc >> 12) ^ (byte >> 4)];
+	crc = (crc << 4) ^ crc_nibble[(crc >> 12) ^ (byte & 0x0F)];
+	return crc;
+}
+
+void init_decoder(StreamDecoder* dec, HostTransport transport)
+{
+	dec->transport = transport;
+	reset_decoder(dec);
+}
+
+void reset_decoder(StreamDecoder* dec)
+{
+	dec->state = DEC_IDLE;
+	dec->len = 0;
+	dec->replay_pos = 0;
+	dec->replay_end = 0;
+}
+
+static inline bool _is_cmd_char(uint8_t c)
+{
+	return c > ' ' && c < 0x7F;
+}
+
+
+/************************************************************************/
+/*                 FRAME EXECUTION                                      */
+/************************************************************************/
+
+// Check that the payload is a whole number of well-formed commands
+static bool _validate_payload(const uint8_t* payload, uint32_t len)
+{
+	uint32_t pos = 0;
+	while (pos < len)
+	{
+		if (len - pos < FRAME_CMD_SIZE)
+		{
+			return false;
+		}
+		uint32_t n_args = payload[pos + 3];
+		if (n_args > FRAME_MAX_ARGS)
+		{
+			return false;
+		}
+		pos += FRAME_CMD_SIZE + 4 * n_args;
+	}
+	return pos == len;
+}
+
+static void _execute_payload(const uint8_t* payload, uint32_t len)
+{
+	uint32_t pos = 0;
+	while (pos < len)
+	{
+		DataPacket packet = {};
+		memcpy(packet.cmd, &payload[pos], 3);
+
+		uint32_t n_args = payload[pos + 3];
+		memcpy(&packet.arg1, &payload[pos + FRAME_CMD_SIZE], 4 * n_args);  // args are contiguous
+		pos += FRAME_CMD_SIZE + 4 * n_args;
+
+		_parse_UART_command(&packet);
+	}
+}
+
+
+/************************************************************************/
+/*                 STREAM DECODING                                      */
+/************************************************************************/
+
+// Wait for the next packet or frame, keeping the bytes waiting for replay
+static inline void _restart(StreamDecoder* dec)
+{
+	dec->state = DEC_IDLE;
+	dec->len = 0;
+}
+
+/*
+ * Reject the start byte of the collected packet or frame and decode the bytes
+ * after it again, followed by the bytes still waiting for replay. Both parts
+ * are moved to the front of buf. While replaying, every byte is stored at or
+ * before the position it is read from, so buf holds both without overlap.
+ * The rest of a frame with a wrong CRC is searched for a sync byte only:
+ * its commands would pass for legacy packets.
+ */
+static void _rescan(StreamDecoder* dec, bool to_sync)
+{
+	uint32_t first = 1;
+	while (to_sync && first < dec->len && dec->buf[first] != FRAME_SYNC)
+	{
+		first++;
+	}
+
+	uint32_t n = dec->len - first;
+	uint32_t pending = dec->replay_end - dec->replay_pos;
+	memmove(&dec->buf[0], &dec->buf[first], n);
+	memmove(&dec->buf[n], &dec->buf[dec->replay_pos], pending);
+	dec->replay_pos = 0;
+	dec->replay_end = n + pending;
+	_restart(dec);
+}
+
+static void _decode_byte(StreamDecoder* dec, uint8_t byte)
+{
+	switch (dec->state)
+	{
+		case DEC_IDLE:
+			if (byte == FRAME_SYNC)
+			{
+				dec->state = DEC_HEADER;
+				dec->expected = FRAME_HEADER_SIZE;
+			}
+			else if (_is_cmd_char(byte))
+			{
+				dec->state = DEC_LEGACY;
+				dec->expected = sizeof(DataPacket);
+			}
+			else
+			{
+				break;  // noise between packets
+			}
+			dec->buf[0] = byte;
+			dec->len = 1;
+			break;
+
+		case DEC_LEGACY:
+			dec->buf[dec->len++] = byte;
+			if (dec->len == 4 && dec->buf[3] != '\0')
+			{
+				_rescan(dec, false);  // not a command name
+			}
+			else if (dec->len < 4 && !_is_cmd_char(byte))
+			{
+				_rescan(dec, false);
+			}
+			else if (dec->len == dec->expected)
+			{
+				set_host_transport((HostTransport) dec->transport);
+				_parse_UART_command((const DataPacket*) dec->buf);
+				_restart(dec);
+			}
+			break;
+
+		case DEC_HEADER:
+			dec->buf[dec->len++] = byte;
+			if (dec->len == FRAME_HEADER_SIZE)
+			{
+				uint32_t payload_len = dec->buf[1] | (dec->buf[2] << 8);
+				bool valid = (dec->buf[0] ^ dec->buf[1] ^ dec->buf[2]) == dec->buf[3] &&
+				             payload_len <= FRAME_MAX_PAYLOAD;
+				if (!valid)
+				{
+					_rescan(dec, false);
+					break;
+				}
+				dec->state = DEC_PAYLOAD;
+				dec->expected = FRAME_HEADER_SIZE + payload_len + FRAME_CRC_SIZE;
+				dec->crc = 0xFFFF;
+			}
+			break;
+
+		case DEC_PAYLOAD:
+		{
+			uint32_t crc_pos = dec->expected - FRAME_CRC_SIZE;
+			if (dec->len < crc_pos)
+			{
+				dec->crc = crc16_ccitt(dec->crc, byte);
+			}
+			dec->buf[dec->len++] = byte;
+
+			if (dec->len == dec->expected)
+			{
+				const uint8_t* payload = &dec->buf[FRAME_HEADER_SIZE];
+				uint32_t payload_len = crc_pos - FRAME_HEADER_SIZE;
+				uint16_t crc = dec->buf[crc_pos] | (dec->buf[crc_pos + 1] << 8);
+				if (crc != dec->crc)
+				{
+					// The sync byte may have been a false one in front of a real frame
+					printf("ERR: frame CRC mismatch, %lu bytes rescanned\n", payload_len);
+					_rescan(dec, true);
+				}
+				else if (!_validate_payload(payload, payload_len))
+				{
+					printf("ERR: malformed frame, %lu bytes dropped\n", payload_len);
+					_restart(dec);
+				}
+				else
+				{
+					set_host_transport((HostTransport) dec->transport);
+					_execute_payload(payload, payload_len);
+					_restart(dec);
+				}
+			}
+			break;
+		}
+	}
+}
+
+void decode_rx_bytes(StreamDecoder* dec, const uint8_t* data, uint32_t len)
+{
+	uint32_t i = 0;
+	while (i < len || dec->replay_pos < dec->replay_end)
+	{
+		// Bytes given back by a rejected packet or frame come first
+		if (dec->replay_pos < dec->replay_end)
+		{
+			_decode_byte(dec, dec->buf[dec->replay_pos++]);
+		}
+		else
+		{
+			_decode_byte(dec, data[i++]);
+		}
+	}
+}
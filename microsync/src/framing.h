@@ -0,0 +1,78 @@
+/**
+ * @file framing.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Decoder of the host byte stream: legacy packets and CRC-checked frames.
+ *
+ * The host sends either legacy 24-byte DataPackets or frames, and may mix
+ * them freely. A frame carries any number of commands of different sizes:
+ *
+ *     [FRAME_SYNC] [len lo] [len hi] [header check] [payload] [CRC lo] [CRC hi]
+ *
+ * The header check is the XOR of the first three bytes, so a false sync byte
+ * is rejected after four bytes. The CRC is CRC-16/CCITT (polynomial 0x1021,
+ * initial value 0xFFFF) of the payload. The payload is a sequence of commands,
+ * each made of a 3-character name, the number of 32-bit arguments (0-5), and
+ * the arguments themselves. The arguments fill arg1, arg2, ts_us, N, and
+ * interv_us of a DataPacket in this order; the omitted ones are 0. None of
+ * the commands of a frame is executed unless the whole frame is valid.
+ *
+ * A legacy packet starts with a printable character and has a null fourth
+ * byte; any other byte outside of a packet or frame is skipped. When a
+ * packet, a frame header, or a frame CRC turns out to be invalid, the decoder
+ * decodes the bytes after its first byte again, so a stray sync byte in front
+ * of a frame doesn't swallow it. Resynchronization takes microseconds instead
+ * of the communication timeout.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief State of a stream decoder; every transport has its own.
+ */
+typedef struct StreamDecoder
+{
+	uint8_t  buf[FRAME_MAX_PAYLOAD + 6];  /**< Packet, or frame with header and CRC */
+	uint32_t len;                         /**< Bytes collected in buf */
+	uint32_t expected;                    /**< Bytes to collect in the current state */
+	uint32_t replay_pos;                  /**< Next byte of buf to decode again */
+	uint32_t replay_end;                  /**< End of the bytes of buf to decode again */
+	uint16_t crc;                         /**< Running CRC of the payload */
+	uint8_t  state;                       /**< What is being collected */
+	uint8_t  transport;                   /**< HostTransport the bytes come from */
+} StreamDecoder;
+
+/**
+ * @brief Update a CRC-16/CCITT with one byte.
+ * @param crc CRC so far, 0xFFFF initially
+ * @param byte Next byte
+ * @return Updated CRC
+ */
+uint16_t crc16_ccitt(uint16_t crc, uint8_t byte);
+
+/**
+ * @brief Prepare a decoder for the bytes of a transport.
+ * @param dec Pointer to the decoder
+ * @param transport Link the bytes come from; replies to its commands go back there
+ */
+void init_decoder(StreamDecoder* dec, HostTransport transport);
+
+/**
+ * @brief Drop the partial packet or frame, e.g. after a communication timeout.
+ * @param dec Pointer to the decoder
+ */
+void reset_decoder(StreamDecoder* dec);
+
+/**
+ * @brief Decode received bytes and execute the complete commands.
+ * @param dec Pointer to the decoder
+ * @param data Received bytes
+ * @param len Number of bytes
+ *
+ * Every complete packet and every valid frame is passed to
+ * _parse_UART_command(), one command at a time.
+ */
+void decode_rx_bytes(StreamDecoder* dec, const uint8_t* data, uint32_t len);
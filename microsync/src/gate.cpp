@@ -0,0 +1,116 @@
+/*
+ * gate.cpp
+ *
+ * External gate input for the system timeline
+ */
+
+#include "gate.h"
+#include "events.h"
+
+static volatile uint32_t gate_mode = GATE_OFF;
+static volatile bool paused_by_gate = false;  // PAU/RSM commands are not overridden by the gate
+
+#define GATE_PIO    PIOB     // must match GATE_PIN
+#define GATE_PIO_ID ID_PIOB
+#define GATE_MASK   arch_ioport_pin_to_mask(GATE_PIN)
+
+
+// Bring the timeline in line with the current gate level
+static void _apply_gate_level()
+{
+	if (ioport_get_pin_level(GATE_PIN))
+	{
+		if (paused_by_gate)
+		{
+			resume_sys_timer();
+			paused_by_gate = false;
+		}
+	}
+	else if (sys_timer_running && !sys_timer_paused)
+	{
+		pause_sys_timer();
+		paused_by_gate = true;
+	}
+}
+
+static void _gate_handler(uint32_t id, uint32_t mask)
+{
+	if (gate_mode == GATE_PAUSE)
+	{
+		_apply_gate_level();
+	}
+}
+
+
+// Route the gate pin either to PIO (edge interrupt) or to TCLK5 (clock gating)
+static void _set_gate_pin_periph(bool tclk)
+{
+	if (tclk)
+	{
+		ioport_set_pin_mode(GATE_PIN, GATE_PIN_PERIPH | IOPORT_MODE_PULLUP);
+		ioport_disable_pin(GATE_PIN);
+	}
+	else
+	{
+		ioport_set_pin_mode(GATE_PIN, IOPORT_MODE_PULLUP);
+		ioport_set_pin_dir(GATE_PIN, IOPORT_DIR_INPUT);
+		ioport_enable_pin(GATE_PIN);
+	}
+}
+
+
+void init_gate()
+{
+	sysclk_enable_peripheral_clock(GATE_PIO_ID);
+
+	_set_gate_pin_periph(false);
+
+	pio_handler_set(GATE_PIO, GATE_PIO_ID, GATE_MASK, PIO_IT_EDGE, _gate_handler);
+
+	NVIC_EnableIRQ(PIOB_IRQn);
+	NVIC_SetPriority(PIOB_IRQn, 1);  // same as the system timer, so they never preempt each other
+}
+
+
+uint32_t get_gate_mode()
+{
+	return gate_mode;
+}
+
+void set_gate_mode(uint32_t mode)
+{
+	if (mode > GATE_HARDWARE)
+	{
+		printf("ERR: invalid gate mode %lu\n", mode);
+		return;
+	}
+
+	irqflags_t flags = cpu_irq_save();
+		gate_mode = mode;
+
+		// Software gate
+		if (mode == GATE_PAUSE)
+		{
+			pio_get_interrupt_status(GATE_PIO);  // drop edges seen while the gate was off
+			pio_enable_interrupt(GATE_PIO, GATE_MASK);
+		}
+		else
+		{
+			pio_disable_interrupt(GATE_PIO, GATE_MASK);
+		}
+
+		// Hardware gate
+		set_sys_timer_gate(mode == GATE_HARDWARE);
+		_set_gate_pin_periph(mode == GATE_HARDWARE);
+
+		if (mode == GATE_PAUSE)
+		{
+			_apply_gate_level();
+		}
+		else if (paused_by_gate)
+		{
+			resume_sys_timer();
+			paused_by_gate = false;
+		}
+	cpu_irq_restore(flags);
+}
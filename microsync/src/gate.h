@@ -0,0 +1,59 @@
+/**
+ * @file gate.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief External gate input for the system timeline.
+ *
+ * This module lets an external signal on GATE_PIN (A13) hold the timeline,
+ * so the scheduled events fire only while the gate is high. There are two
+ * ways to do it:
+ *
+ * - GATE_PAUSE: the gate edges raise an interrupt that calls
+ *   pause_sys_timer() or resume_sys_timer(). The burst timer, hardware
+ *   pulses, and waveforms are frozen together with the timeline, at the
+ *   cost of a few microseconds of interrupt latency.
+ * - GATE_HARDWARE: the pin is switched to TCLK5 and gates the clock of the
+ *   system timer directly (see set_sys_timer_gate()). The timeline stalls
+ *   and continues within one timer tick of the gate edge, without CPU
+ *   involvement, but the other timers keep running.
+ *
+ * The input has a pull-up, so an unconnected gate never holds the timeline.
+ *
+ * The mode is exposed as the rw_GATE_MODE property.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+
+/**
+ * @brief Gate input modes.
+ */
+enum GateMode : uint32_t {
+	GATE_OFF      = 0,  /**< Gate input is ignored */
+	GATE_PAUSE    = 1,  /**< Timeline is paused by an interrupt while the gate input is low */
+	GATE_HARDWARE = 2,  /**< System timer clock is gated in hardware by the gate input */
+};
+
+/**
+ * @brief Initialize the gate input pin and its interrupt handler.
+ *
+ * The gate starts in GATE_OFF mode.
+ */
+void init_gate();
+
+/**
+ * @brief Get the current gate mode.
+ * @return GateMode value
+ */
+uint32_t get_gate_mode();
+
+/**
+ * @brief Set the gate mode.
+ * @param mode GateMode value
+ *
+ * Enabling GATE_PAUSE while the gate input is low pauses a running timeline
+ * immediately. Leaving GATE_PAUSE resumes the timeline if it has been paused
+ * by the gate.
+ */
+void set_gate_mode(uint32_t mode);
@@ -72,8 +72,61 @@ inline void dbg_pin_dn(){
 	ioport_set_pin_level(DBG_PIN, 0);
 }
 
-// Burst pulse train pin
-#define BURST_PIN    PIO_PC25_IDX	// D5, TIOA6  (TC2, channel 0)
+// Burst pulse trains (see burst.h). TC2 channels run at MCK/2; a channel
+// that counts pulses borrows the next channel of the block as its counter.
+#define BURST_TC             TC2
+#define N_BURST_CHANNELS     3
+#define BURST_PIN            PIO_PC25_IDX  // D5,  TIOA6  (TC2, channel 0)
+#define BURST_B_PIN          PIO_PC28_IDX  // D3,  TIOA7  (TC2, channel 1)
+#define BURST_C_PIN          PIO_PD7_IDX   // D11, TIOA8  (TC2, channel 2)
+#define BURST_MIN_GAP_TICKS  4             // low time that lets the counter close the gate
+
+// PWM outputs (see pwm.h): channels 0-3 on PWMH0-3 (D35, D37, D39, D41),
+// channels 4-7 on PWML4-7 (D9, D8, D7, D6)
+#define N_PWM_CHANNELS       8
+#define PWM_MAX_PERIOD_TICKS 0xFFFFUL      // 16-bit channel counter
+#define PWM_DUTY_ONE         (1UL << 16)   // 100% duty cycle, Q16
+
+// DMA waveform playback (see waveform.h). The DMAC can't be paced by a
+// timer channel on SAM3X, so SPI0 (no pins attached) is used as a pacer:
+// every sample waits for the SPI0 transmitter through the DMAC handshake.
+#define WAVEFORM_MAX_SAMPLES   256UL
+#define WAVEFORM_MIN_PERIOD_NS 500UL   // limited by the DMAC descriptor fetches
+#define WAVEFORM_DMAC_CH       0
+#define WAVEFORM_DMAC_PER      1       // SPI0 TX handshake interface, datasheet table 22-2
+
+// Pin groups written as parallel buses (see pin_group.h)
+#define MAX_PIN_GROUPS         8
+#define PIN_GROUP_MAX_PINS     32      // one bit of the written value per pin
+
+// Hardware compare-output pulses (see hw_pulse.h). TC0 channels 1 and 2 run
+// at MCK/2 and generate the pulse edges on their TIOA/TIOB outputs.
+#define HW_PULSE_TC            TC0
+#define HW_PULSE_A_PIN         PIO_PA2_IDX   // A7, TIOA1  (TC0, channel 1)
+#define HW_PULSE_B_PIN         PIO_PA6_IDX   // A4, TIOB2  (TC0, channel 2)
+#define HW_PULSE_LEAD_US       50UL          // the timer is armed this long before the pulse
+
+
+// Cycle-accurate profiling of interrupt handlers, event dispatch, and event
+// functions with the DWT cycle counter (see profiler.h). Comment out to
+// remove the instrumentation from the build.
+#define PROFILING
+#define PROF_MAX_FUNCS         32      // distinct event functions tracked by the profiler
+
+
+// Dispatch lateness statistics (see latency.h). Bin 0 counts events fired
+// on time or early, bin k counts lateness of [2^(k-1), 2^k) timer ticks,
+// and the last bin collects everything later than that.
+#define LATENCY_HIST_BINS      16
+
+
+// Execution trace of fired events (see trace.h)
+#define TRACE_BUFFER_SIZE      256     // records, must be a power of 2
+#define TRACE_RECORDS_PER_TX   32      // records per UART message when streaming the trace
+
+
+// External gate input (see gate.h). The timeline is held while the gate is low.
+#define GATE_PIN               PIO_PB16_IDX  // A13
 
 
 // Interlock configuration (see datasheet table 36-4)
@@ -92,13 +145,24 @@ inline void dbg_pin_dn(){
 #define INTLCK_TC_Handler     TC0_Handler
 #define INTLCK_TC_IRQn		  TC0_IRQn
 #define INTLCK_TC_PERIOD_US	  25000UL
+#define INTLCK_TC_CMR_TCCLKS_TIMER_CLOCK TC_CMR_TCCLKS_TIMER_CLOCK4  // MCK/128
+#define INTLCK_TC_PERIOD_CTS  (INTLCK_TC_PERIOD_US * (BOARD_MCK / 1000000UL) / 128UL)
 
 /************************************************************************/
 /*                    UART AND DMA CONFIGURATION                        */
 /************************************************************************/
-#define UART_BUFFER_SIZE 512   // Size of DMA-controlled UART buffers
-#define UART_BAUDRATE 115200   // bits per second
-#define UART_TIMEOUT  25       // ms - timeout for UART communication
+#define UART_BUFFER_SIZE 512   // Size of the printf line buffer
+#define UART_BAUDRATE 115200   // bits per second - rate after reset, see the BAU command
+#define UART_TIMEOUT  25       // ms - timeout for UART communication at UART_BAUDRATE
+#define UART_MIN_TIMEOUT   5   // ms - the timeout shrinks with faster rates down to this
+#define UART_MAX_BAUD_ERROR 2  // % - largest deviation of the generated rate from the requested one
+#define BAUD_VERIFY_TIMEOUT 1000  // ms - time for the host to confirm a new rate before fallback
+#define MAX_N_COMMANDS 128     // slots of the command table; a power of 2, kept at most half full
+#define UART_RX_RING_SIZE 1024 // bytes received but not decoded yet; a power of 2
+#define UART_RX_SEGMENTS     4 // the PDC fills the receive ring one segment at a time
+#define UART_TX_RING_SIZE 4096 // bytes waiting for transmission; a power of 2
+#define FRAME_SYNC        0xA5 // first byte of a framed message, see framing.h
+#define FRAME_MAX_PAYLOAD  512 // bytes of commands in a single frame
 // UART uses timer 4 (module TC1 channel 1)
 #define ID_UART_TC           ID_TC4
 #define UART_TC              TC1	// ID / 3
@@ -106,14 +170,35 @@ inline void dbg_pin_dn(){
 #define UART_TIMEOUT_Handler TC4_Handler
 #define UART_TC_IRQn	     TC4_IRQn
 
+// Native USB port (see usb_cdc.h), enumerated as a CDC-ACM serial port with
+// the VID/PID of the Arduino Due native port
+#define USB_VID              0x2341
+#define USB_PID              0x003E
+#define USB_EP0_SIZE         64
+#define USB_TX_TIMEOUT       25        // ms - drop replies if the host stops reading
+#define USB_TX_RING_SIZE     2048      // bytes waiting for the bulk IN endpoint; a power of 2
+
 
 /************************************************************************/
 /*                      EVENT HANDLING                                  */
 /************************************************************************/
 #define WATCHDOG_TIMEOUT  100UL  // ms
 
-// Maximum allowed number of events in the event table
-#define MAX_N_EVENTS	450UL
+// Maximum allowed number of events in the event table (16 bytes each, 16 KB;
+// the timing wheel adds a 4-byte link per event). Fits in the 21 KB that the
+// 768 packed 28-byte events used to take.
+#define MAX_N_EVENTS	1024UL
+
+// Event timestamps are 32-bit offsets from a common 64-bit base, which
+// follows the current time (see rebase_event_queue() in events.h)
+#define EVENT_REBASE_THRESHOLD_CTS (1UL << 30)  // rebase when the time is this far ahead of the base
+#define EVENT_REBASE_ALIGN_CTS     (1UL << 26)  // the base moves in multiples of this
+#define EVENT_MAX_INTERVAL_CTS     (1UL << 31)  // longest interval of repeating events
+
+// Event queue backend. Options are EVENT_QUEUE_HEAP (binary heap) and
+// EVENT_QUEUE_TIMING_WHEEL (hierarchical timing wheel, O(1) insert and dispatch
+// of near-term events)
+#define EVENT_QUEUE_HEAP
 
 // Uniform time delay added to every single scheduled event, us
 // It should be long enough to ensure correct event processing
@@ -133,42 +218,45 @@ inline void dbg_pin_dn(){
 /************************************************************************/
 
 // Timer prescaler configuration. See SAM3X TC_CMR register, datasheet p883
-// Options are 2, 8, 32, and 128
-#define PRESC32
+// Options are 2, 8, 32, and 128:
+//   PRESC2   - 1ct = 24ns,   overflow after 102s  (1min 42s)
+//   PRESC8   - 1ct = 95ns,   overflow after 409s  (6min 49s)
+//   PRESC32  - 1ct = 381ns,  overflow after 1636s (27min 16s)
+//   PRESC128 - 1ct = 1524ns, overflow after 6544s (1h 49min)
+// This is the prescaler after reset; it can be changed at runtime through
+// the rw_SYS_TIMER_PRESCALER property while the system timer is stopped.
+#define SYS_TC_DEFAULT_PRESCALER 32UL
 
-#ifdef PRESC2    // 1ct = 24ns, overflow after 102s  (1min 42s)
-#define SYS_TC_PRESCALER 2UL
-#define SYS_TC_CMR_TCCLKS_TIMER_CLOCK TC_CMR_TCCLKS_TIMER_CLOCK1
-#endif
+// log2 of the current prescaler: 1, 3, 5, or 7
+extern volatile uint32_t sys_tc_presc_shift;
 
-#ifdef PRESC8    // 1ct = 95ns, overflow after 409s  (6min 49s)
-#define SYS_TC_PRESCALER 8UL
-#define SYS_TC_CMR_TCCLKS_TIMER_CLOCK TC_CMR_TCCLKS_TIMER_CLOCK2
-#endif
+#define SYS_TC_PRESCALER (1UL << sys_tc_presc_shift)
 
-#ifdef PRESC32   // 1ct = 381ns, overflow after 1636s (27min 16s)
-#define SYS_TC_PRESCALER 32UL
-#define SYS_TC_CMR_TCCLKS_TIMER_CLOCK TC_CMR_TCCLKS_TIMER_CLOCK3
-#endif
+// TC_CMR clock selection for the current prescaler: MCK/2, /8, /32, /128
+#define SYS_TC_CMR_TCCLKS_TIMER_CLOCK ((sys_tc_presc_shift - 1) >> 1)
 
-#ifdef PRESC128  // 1ct = 1524ns, overflow after 6544s (1h 49min)
-#define SYS_TC_PRESCALER 128UL
-#define SYS_TC_CMR_TCCLKS_TIMER_CLOCK TC_CMR_TCCLKS_TIMER_CLOCK4
-#endif
+#define SYS_TC_TICKS_PER_US (BOARD_MCK / 1000000UL)  // 84 MCK cycles per microsecond
 
-#define SYS_TC_CONVERSION_MULTIPLIER (8400000UL/SYS_TC_PRESCALER)
-#define TS_TOLERANCE_CTS (TS_TOLERANCE * SYS_TC_CONVERSION_MULTIPLIER / 100000UL)
-#define TS_MISSED_TOLERANCE_CTS (TS_MISSED_TOLERANCE * SYS_TC_CONVERSION_MULTIPLIER / 100000UL)
-#define UNIFORM_TIME_DELAY_CTS (UNIFORM_TIME_DELAY * SYS_TC_CONVERSION_MULTIPLIER / 100000UL)
+#define TS_TOLERANCE_CTS        us2cts(TS_TOLERANCE)
+#define TS_MISSED_TOLERANCE_CTS us2cts(TS_MISSED_TOLERANCE)
+#define UNIFORM_TIME_DELAY_CTS  us2cts(UNIFORM_TIME_DELAY)
 
-// microseconds to counts
+// microseconds to counts; exact, cts = us * 84 / prescaler
 static inline uint64_t us2cts(uint64_t us) {
-	return us * SYS_TC_CONVERSION_MULTIPLIER / 100000ULL;
+	return (us * SYS_TC_TICKS_PER_US) >> sys_tc_presc_shift;
 }
 
-// counts to microseconds
+// counts to microseconds; exact, us = cts * prescaler / 84.
+// Division by 84 is done with multiply-shift to avoid a software 64-bit divide:
+// y = hi * 2^32 + lo = 84 * hi * 51130563 + 4 * hi + lo, and x / 84 = (x / 4) / 21,
+// where z / 21 == (z * ceil(2^36 / 21)) >> 36 for any z < 2^31 + 2^30.
+// Valid for cts < 2^55.
 static inline uint64_t cts2us(uint64_t cts) {
-	return cts * 100000ULL / SYS_TC_CONVERSION_MULTIPLIER;
+	uint64_t y = cts << sys_tc_presc_shift;
+	uint32_t hi = (uint32_t) (y >> 32);
+	uint32_t lo = (uint32_t) y;
+	uint64_t z = ((uint64_t) hi * 4 + lo) >> 2;
+	return (uint64_t) hi * 51130563UL + ((z * 3272356036ULL) >> 36);
 }
 
 
@@ -179,3 +267,10 @@ static inline uint64_t cts2us(uint64_t cts) {
 #define SYS_TC_Handler  TC3_Handler
 #define SYS_TC_IRQn		TC3_IRQn
 
+// Hardware clock gating of the system timer. XC2 of the TC1 block is TCLK5,
+// which is GATE_PIN in peripheral A mode. The timer counts only while it is high.
+#define SYS_TC_GATE_BMR         TC_BMR_TC2XC2S_TCLK2  // block-relative TCLK2 = TCLK5
+#define SYS_TC_GATE_BMR_Msk     TC_BMR_TC2XC2S_Msk
+#define SYS_TC_CMR_BURST_GATE   TC_CMR_BURST_XC2
+#define GATE_PIN_PERIPH         IOPORT_MODE_MUX_A
+
@@ -0,0 +1,240 @@
+/*
+ * hw_pulse.cpp
+ *
+ * Jitter-free pulses on timer compare outputs
+ */
+
+#include "hw_pulse.h"
+#include "pins.h"
+
+volatile uint32_t hw_pulses_enabled = 0;
+
+static uint32_t paused_channels = 0;  // bitmask of channels frozen by pause_hw_pulses()
+
+// Timer clock is MCK/2
+#define HW_PULSE_TICKS_PER_US (BOARD_MCK / 2 / 1000000UL)
+
+/************************************************************************/
+/*                 HARDWARE PULSE CHANNELS                              */
+/************************************************************************/
+
+typedef struct {
+	uint32_t pin_idx;  // IOPORT index of the output pin
+	uint32_t pin_mask; // PIOA mask of the output pin
+	uint32_t ch;       // channel of HW_PULSE_TC
+	uint32_t id;       // peripheral ID of the channel
+	IRQn_Type irq;     // interrupt of the channel
+	bool     tiob;     // the output is TIOB instead of TIOA
+} HwPulseChannel;
+
+static const HwPulseChannel hw_channels[] = {
+	{HW_PULSE_A_PIN, PIO_PA2A_TIOA1, 1, ID_TC1, TC1_IRQn, false},
+	{HW_PULSE_B_PIN, PIO_PA6A_TIOB2, 2, ID_TC2, TC2_IRQn, true},
+};
+
+#define N_HW_CHANNELS (sizeof(hw_channels) / sizeof(hw_channels[0]))
+
+static inline int _find_channel(uint32_t pin_idx)
+{
+	for (uint32_t i = 0; i < N_HW_CHANNELS; i++)
+	{
+		if (hw_channels[i].pin_idx == pin_idx)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Waveform mode, one-shot: the clock stops at RC compare
+static inline uint32_t _channel_mode(const HwPulseChannel* c, bool is_positive)
+{
+	uint32_t mode = TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP | TC_CMR_CPCSTOP;
+
+	if (c->tiob)
+	{
+		mode |= TC_CMR_EEVT_XC0;  // TIOB is an output only if it's not the external event
+		mode |= is_positive ?
+			(TC_CMR_BSWTRG_CLEAR | TC_CMR_BCPB_SET | TC_CMR_BCPC_CLEAR) :
+			(TC_CMR_BSWTRG_SET | TC_CMR_BCPB_CLEAR | TC_CMR_BCPC_SET);
+	}
+	else
+	{
+		mode |= is_positive ?
+			(TC_CMR_ASWTRG_CLEAR | TC_CMR_ACPA_SET | TC_CMR_ACPC_CLEAR) :
+			(TC_CMR_ASWTRG_SET | TC_CMR_ACPA_CLEAR | TC_CMR_ACPC_SET);
+	}
+	return mode;
+}
+
+
+/************************************************************************/
+/*                 PULSE SCHEDULING                                     */
+/************************************************************************/
+
+bool hw_pulse_capable(uint32_t pin_idx)
+{
+	return _find_channel(pin_idx) >= 0;
+}
+
+void schedule_hw_pulse(const Event* pulse, bool is_positive, uint32_t duration_us)
+{
+	int ch = _find_channel(pulse->idx);
+	if (ch < 0)
+	{
+		printf("ERR: pin %u has no timer compare output\n", pulse->idx);
+		return;
+	}
+	if (pulse->ts_ofs_cts == EVENT_TS_INVALID)
+	{
+		printf("ERR: pulse can't be scheduled that far ahead\n");
+		return;
+	}
+
+	uint64_t lead_cts = us2cts(HW_PULSE_LEAD_US);
+	if (pulse->N != 1 && pulse->interv_cts <= lead_cts + us2cts(duration_us))
+	{
+		printf("ERR: hardware pulse interval must exceed duration + %lu us\n", HW_PULSE_LEAD_US);
+		return;
+	}
+
+	Event arm = *pulse;
+	arm.op = OP_HW_PULSE_ARM;
+	arm.idx = ch | (is_positive ? (1UL << 7) : 0);
+	arm.arg = duration_us * HW_PULSE_TICKS_PER_US;
+	uint64_t pulse_ts = event_ts(pulse);
+	set_event_ts(&arm, (pulse_ts > lead_cts) ? pulse_ts - lead_cts : 0);
+	schedule_event(&arm, false);
+}
+
+
+/************************************************************************/
+/*                 FUNCTIONS TO USE WITHIN EVENTS                       */
+/************************************************************************/
+
+void arm_hw_pulse_func(uint32_t arg1_ch_polarity, uint32_t arg2_duration)
+{
+	if (!sys_timer_running)
+	{
+		return;
+	}
+
+	const HwPulseChannel* c = &hw_channels[(arg1_ch_polarity & 0x7F) % N_HW_CHANNELS];
+	bool is_positive = arg1_ch_polarity & (1UL << 7);
+	TcChannel* tc = &HW_PULSE_TC->TC_CHANNEL[c->ch];
+	uint64_t target_cts = dispatched_event_ts() + us2cts(HW_PULSE_LEAD_US);
+
+	sysclk_enable_peripheral_clock(c->id);
+	tc->TC_CCR = TC_CCR_CLKDIS;
+	tc->TC_CMR = _channel_mode(c, is_positive);
+	pio_set_peripheral(PIOA, PIO_PERIPH_A, c->pin_mask);
+
+	irqflags_t flags = cpu_irq_save();
+
+	// Start the channel right at a system timer tick, so that the sub-tick
+	// phase is known and the delay is exact to a few MCK cycles. A timer
+	// gated by the external input may stall, so don't wait for it then.
+	uint64_t now_cts = current_time_cts();
+	if (!sys_timer_gated())
+	{
+		uint32_t cv;
+		do {
+			cv = SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CV;
+		} while (cv == (uint32_t) now_cts);
+		now_cts += (uint32_t) (cv - (uint32_t) now_cts);
+	}
+
+	uint32_t delay = 2;  // minimal delay if we are already late
+	if (target_cts > now_cts)
+	{
+		delay = (uint32_t) (target_cts - now_cts) << (sys_tc_presc_shift - 1);  // MCK/2 ticks
+	}
+	if (c->tiob)
+	{
+		tc->TC_RB = delay;
+	}
+	else
+	{
+		tc->TC_RA = delay;
+	}
+	tc->TC_RC = delay + ((arg2_duration > 0) ? arg2_duration : 1);
+	tc->TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+
+	cpu_irq_restore(flags);
+
+	// The RC compare ends the pulse and gives the pin back to PIO
+	tc->TC_SR;
+	tc->TC_IER = TC_IER_CPCS;
+	NVIC_SetPriority(c->irq, 15);  // only the pin handover; the edges are already in hardware
+	NVIC_EnableIRQ(c->irq);
+}
+
+// The pulse is over and the channel has stopped at RC compare. Hand the pin
+// over to PIO at the level the channel left it at, so that PIN and TGL work
+// on it again.
+static void _release_channel(const HwPulseChannel* c)
+{
+	TcChannel* tc = &HW_PULSE_TC->TC_CHANNEL[c->ch];
+	uint32_t status = tc->TC_SR;
+	if (!(status & TC_SR_CPCS))
+	{
+		return;
+	}
+	tc->TC_IDR = TC_IDR_CPCS;
+
+	pins[c->pin_idx].set_level(status & (c->tiob ? TC_SR_MTIOB : TC_SR_MTIOA));
+	ioport_enable_pin(c->pin_idx);
+}
+
+void stop_hw_pulses()
+{
+	for (uint32_t i = 0; i < N_HW_CHANNELS; i++)
+	{
+		HW_PULSE_TC->TC_CHANNEL[hw_channels[i].ch].TC_IDR = TC_IDR_CPCS;
+		HW_PULSE_TC->TC_CHANNEL[hw_channels[i].ch].TC_CCR = TC_CCR_CLKDIS;
+		// Give the pin back to PIO, driven low
+		pio_set_output(PIOA, hw_channels[i].pin_mask, 0, 0, 0);
+	}
+}
+
+void pause_hw_pulses()
+{
+	paused_channels = 0;
+	for (uint32_t i = 0; i < N_HW_CHANNELS; i++)
+	{
+		TcChannel* tc = &HW_PULSE_TC->TC_CHANNEL[hw_channels[i].ch];
+		if (tc->TC_SR & TC_SR_CLKSTA)
+		{
+			tc->TC_CCR = TC_CCR_CLKDIS;
+			paused_channels |= (1UL << i);
+		}
+	}
+}
+
+void resume_hw_pulses()
+{
+	for (uint32_t i = 0; i < N_HW_CHANNELS; i++)
+	{
+		if (paused_channels & (1UL << i))
+		{
+			// No SWTRG: the counter continues from where it was frozen
+			HW_PULSE_TC->TC_CHANNEL[hw_channels[i].ch].TC_CCR = TC_CCR_CLKEN;
+		}
+	}
+	paused_channels = 0;
+}
+
+
+/************************************************************************/
+/*                 HARDWARE PULSE INTERRUPTS                            */
+/************************************************************************/
+
+void TC1_Handler(void)
+{
+	_release_channel(&hw_channels[0]);
+}
+
+void TC2_Handler(void)
+{
+	_release_channel(&hw_channels[1]);
+}
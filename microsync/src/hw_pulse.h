@@ -0,0 +1,77 @@
+/**
+ * @file hw_pulse.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Jitter-free pulses on timer compare outputs.
+ *
+ * This module generates pulses with the compare outputs of the spare TC0
+ * channels instead of toggling the pins from the event interrupt. The
+ * scheduler fires an arm event HW_PULSE_LEAD_US before the pulse. The arm
+ * event loads RA/RC (or RB/RC) of the channel with the remaining delay and
+ * the pulse duration, and the edges are produced by the timer itself with
+ * 24 ns resolution, independent of the interrupt latency.
+ *
+ * Supported pins are A7 (TIOA1) and A4 (TIOB2). When the rw_HW_PULSES
+ * property is set, PPL/NPL pulses on these pins are routed to hardware. The
+ * pin is switched to the timer output when the channel is armed, and back to
+ * PIO by the channel interrupt once the pulse is over, so that PIN and TGL
+ * keep working on it between pulses.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "events.h"
+
+/**
+ * @brief Route PPL/NPL pulses on capable pins to timer compare outputs.
+ *
+ * Disabled by default; exposed as the rw_HW_PULSES property.
+ */
+extern volatile uint32_t hw_pulses_enabled;
+
+/**
+ * @brief Check whether a pin can output hardware pulses.
+ * @param pin_idx IOPORT index of the pin
+ * @return true if the pin is connected to a timer compare output
+ */
+bool hw_pulse_capable(uint32_t pin_idx);
+
+/**
+ * @brief Schedule a hardware pulse.
+ * @param pulse Pulse event with absolute timestamp; idx is the IOPORT index of the pin
+ * @param is_positive true for a positive pulse, false for a negative pulse
+ * @param duration_us Pulse duration in microseconds
+ *
+ * Schedules an arm event HW_PULSE_LEAD_US ahead of the pulse. N and the
+ * interval of the pulse event are preserved; the interval must be longer
+ * than the pulse duration plus the lead time.
+ */
+void schedule_hw_pulse(const Event* pulse, bool is_positive, uint32_t duration_us);
+
+/**
+ * @brief Event function that arms a timer channel for a single pulse.
+ * @param arg1_ch_polarity Channel index in bits 0-6, pulse polarity in bit 7 (1 = positive)
+ * @param arg2_duration Pulse duration in MCK/2 ticks
+ *
+ * The pulse starts HW_PULSE_LEAD_US after the timestamp of the arm event.
+ */
+void arm_hw_pulse_func(uint32_t arg1_ch_polarity, uint32_t arg2_duration);
+
+/**
+ * @brief Stop all hardware pulse channels and return their pins to PIO control.
+ */
+void stop_hw_pulses();
+
+/**
+ * @brief Freeze the running hardware pulse channels.
+ *
+ * Used by pause_sys_timer(), so that pending pulses keep their position
+ * on the timeline. Output levels are held while the channels are frozen.
+ */
+void pause_hw_pulses();
+
+/**
+ * @brief Continue the channels frozen by pause_hw_pulses().
+ */
+void resume_hw_pulses();
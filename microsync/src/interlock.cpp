@@ -8,6 +8,7 @@
 #include "interlock.h"
 #include "globals.h"
 #include "pins.h"
+#include "profiler.h"
 
 /** @brief First interlock condition match flag */
 volatile bool intlck_match_1 = false;
@@ -42,7 +43,7 @@ void _init_interlock_timer()
 {
     sysclk_enable_peripheral_clock(ID_INTLCK_TC);
     tc_init(INTLCK_TC, INTLCK_TC_CH,
-        SYS_TC_CMR_TCCLKS_TIMER_CLOCK |  // same prescaler as the system timer
+        INTLCK_TC_CMR_TCCLKS_TIMER_CLOCK |  // fixed prescaler, independent of the system timer
         TC_CMR_WAVE |                 // waveform generation mode
         TC_CMR_EEVT_XC0 |             // External event selection - enables TIOB
 #ifdef INTLCK_TIOA
@@ -60,13 +61,13 @@ void _init_interlock_timer()
     );
 
 #ifdef INTLCK_TIOA
-    tc_write_ra(INTLCK_TC, INTLCK_TC_CH, us2cts(INTLCK_TC_PERIOD_US >> 4));
+    tc_write_ra(INTLCK_TC, INTLCK_TC_CH, INTLCK_TC_PERIOD_CTS >> 4);
     tc_enable_interrupt(INTLCK_TC, INTLCK_TC_CH, TC_IER_CPAS);
 #else
-    tc_write_rb(INTLCK_TC, INTLCK_TC_CH, us2cts(INTLCK_TC_PERIOD_US >> 4));
+    tc_write_rb(INTLCK_TC, INTLCK_TC_CH, INTLCK_TC_PERIOD_CTS >> 4);
     tc_enable_interrupt(INTLCK_TC, INTLCK_TC_CH, TC_IER_CPBS);
 #endif
-    tc_write_rc(INTLCK_TC, INTLCK_TC_CH, us2cts(INTLCK_TC_PERIOD_US));
+    tc_write_rc(INTLCK_TC, INTLCK_TC_CH, INTLCK_TC_PERIOD_CTS);
     tc_enable_interrupt(INTLCK_TC, INTLCK_TC_CH, TC_IER_CPCS);
     
     NVIC_EnableIRQ(INTLCK_TC_IRQn);
@@ -113,6 +114,8 @@ void disable_lasers()
 
 void INTLCK_TC_Handler()
 {
+    PROF_SCOPE(PROF_INTLCK_ISR);
+
     // Read Timer Counter Status to clear the interrupt flag
     uint32_t status = tc_get_status(INTLCK_TC, INTLCK_TC_CH);
     
@@ -0,0 +1,65 @@
+/*
+ * latency.cpp
+ *
+ * Dispatch lateness statistics of the event queue
+ */
+
+#include "latency.h"
+
+LatencyStats latency_stats = {0, 0, INT32_MAX, INT32_MIN, 0, {0}};
+
+
+// Timer ticks to nanoseconds for the current prescaler, clamped to the
+// int32_t range past about 2.1 s (newlib-nano printf has no %lld)
+static int32_t _cts2ns(int64_t cts)
+{
+	int64_t ns = (cts * (int64_t) (1000UL << sys_tc_presc_shift)) / (int64_t) SYS_TC_TICKS_PER_US;
+	if (ns > INT32_MAX)
+	{
+		return INT32_MAX;
+	}
+	if (ns < INT32_MIN)
+	{
+		return INT32_MIN;
+	}
+	return (int32_t) ns;
+}
+
+void reset_latency_stats()
+{
+	irqflags_t flags = cpu_irq_save();
+		latency_stats.count = 0;
+		latency_stats.missed = 0;
+		latency_stats.min_cts = INT32_MAX;
+		latency_stats.max_cts = INT32_MIN;
+		latency_stats.sum_cts = 0;
+		for (uint32_t i = 0; i < LATENCY_HIST_BINS; i++)
+		{
+			latency_stats.hist[i] = 0;
+		}
+	cpu_irq_restore(flags);
+}
+
+void send_latency_stats()
+{
+	// Take a consistent snapshot; printing is slow
+	irqflags_t flags = cpu_irq_save();
+		LatencyStats s = latency_stats;
+	cpu_irq_restore(flags);
+
+	if (s.count == 0)
+	{
+		s.min_cts = 0;
+		s.max_cts = 0;
+	}
+	int64_t mean_cts = s.count ? s.sum_cts / (int64_t) s.count : 0;
+
+	printf("%lu %lu %ld %ld %ld\n", s.count, s.missed,
+	       _cts2ns(s.min_cts), _cts2ns(s.max_cts), _cts2ns(mean_cts));
+
+	for (uint32_t i = 0; i < LATENCY_HIST_BINS; i++)
+	{
+		int32_t upper_ns = (i == LATENCY_HIST_BINS - 1) ? -1 : _cts2ns(1LL << i);
+		printf("%ld %lu\n", upper_ns, s.hist[i]);
+	}
+}
@@ -0,0 +1,74 @@
+/**
+ * @file latency.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Dispatch lateness statistics of the event queue.
+ *
+ * process_events() records, for every fired event, how late it was
+ * dispatched relative to its timestamp. The lateness is accumulated into
+ * a log2 histogram (LATENCY_HIST_BINS bins) together with min/max/mean and
+ * the number of events that exceeded TS_MISSED_TOLERANCE. Recording takes
+ * a handful of instructions and uses the counter value that the dispatch
+ * loop has already read, so it stays enabled all the time.
+ *
+ * The statistics are reported and reset with the LAT command.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+
+/**
+ * @brief Accumulated lateness statistics, in system timer ticks.
+ */
+typedef struct {
+	uint32_t count;                     /**< Number of dispatched events */
+	uint32_t missed;                    /**< Events later than TS_MISSED_TOLERANCE */
+	int32_t  min_cts;                   /**< Smallest lateness; negative if fired early */
+	int32_t  max_cts;                   /**< Largest lateness */
+	int64_t  sum_cts;                   /**< Sum of lateness, for the mean */
+	uint32_t hist[LATENCY_HIST_BINS];   /**< log2 histogram of lateness */
+} LatencyStats;
+
+/**
+ * @brief Lateness statistics since the last reset.
+ *
+ * Updated by process_events() only, which keeps the event interrupt
+ * disabled while running, so the updates never race with each other.
+ */
+extern LatencyStats latency_stats;
+
+/**
+ * @brief Record the lateness of a dispatched event.
+ * @param late_cts Counter value at dispatch minus the event timestamp
+ */
+inline void record_lateness(int64_t late_cts)
+{
+	int32_t late = (late_cts > INT32_MAX) ? INT32_MAX : (late_cts < INT32_MIN) ? INT32_MIN : (int32_t) late_cts;
+	uint32_t bin = (late > 0) ? 32 - __builtin_clz((uint32_t) late) : 0;
+
+	latency_stats.hist[(bin < LATENCY_HIST_BINS) ? bin : LATENCY_HIST_BINS - 1]++;
+	latency_stats.count++;
+	latency_stats.sum_cts += late;
+	latency_stats.min_cts = (late < latency_stats.min_cts) ? late : latency_stats.min_cts;
+	latency_stats.max_cts = (late > latency_stats.max_cts) ? late : latency_stats.max_cts;
+	if (late > (int32_t) TS_MISSED_TOLERANCE_CTS)
+	{
+		latency_stats.missed++;
+	}
+}
+
+/**
+ * @brief Clear the lateness statistics.
+ */
+void reset_latency_stats();
+
+/**
+ * @brief Print the lateness statistics over UART.
+ *
+ * The first line is "count missed min_ns max_ns mean_ns". It's followed by
+ * LATENCY_HIST_BINS lines "upper_ns count", one per histogram bin; upper_ns
+ * is the exclusive upper edge of the bin, or -1 for the last, open-ended bin.
+ * Times past the int32_t range (about 2.1 s) are clamped to it.
+ */
+void send_latency_stats();
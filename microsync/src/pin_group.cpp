@@ -0,0 +1,124 @@
+/*
+ * pin_group.cpp
+ *
+ * Pin groups written as parallel digital buses
+ */
+
+#include "pin_group.h"
+#include "pins.h"
+#include "events.h"
+#include "commands.h"
+
+typedef struct {
+	uint32_t n_pins;
+	uint8_t pin_ids[PIN_GROUP_MAX_PINS];  // IOPORT index of every bit
+} PinGroup;
+
+static PinGroup groups[MAX_PIN_GROUPS];
+
+
+static inline bool _valid_group(uint32_t group)
+{
+	if (group >= MAX_PIN_GROUPS)
+	{
+		printf("ERR: pin group must be from 0 to %lu\n", MAX_PIN_GROUPS - 1);
+		return false;
+	}
+	return true;
+}
+
+
+/************************************************************************/
+/*                 GROUP CONFIGURATION                                  */
+/************************************************************************/
+
+void init_pin_groups()
+{
+	register_command("GRP", [](const DataPacket* data) {
+		uint32_t pin_idx = pin_name_to_ioport_id(data->arg2);
+		if (pin_idx != PIN_ID_INVALID)  // otherwise reported by the lookup
+		{
+			add_pin_to_group(data->arg1, pin_idx);
+		}
+	});
+	register_command("GRC", [](const DataPacket* data) { clear_pin_group(data->arg1); });
+	register_command("GRW", schedule_pin_group_write);
+}
+
+void add_pin_to_group(uint32_t group, uint32_t pin_idx)
+{
+	if (!_valid_group(group))
+	{
+		return;
+	}
+	if (pin_idx >= N_IOPORT_PINS)
+	{
+		printf("ERR: %lu is not an IOPORT index of a pin\n", pin_idx);
+		return;
+	}
+
+	PinGroup* g = &groups[group];
+	if (g->n_pins >= PIN_GROUP_MAX_PINS)
+	{
+		printf("ERR: pin group %lu already has %lu pins\n", group, PIN_GROUP_MAX_PINS);
+		return;
+	}
+	for (uint32_t i = 0; i < g->n_pins; i++)
+	{
+		if (g->pin_ids[i] == pin_idx)
+		{
+			printf("ERR: pin %lu is already in group %lu\n", pin_idx, group);
+			return;
+		}
+	}
+
+	pins[pin_idx].update();  // make it an output
+	g->pin_ids[g->n_pins++] = pin_idx;
+}
+
+void clear_pin_group(uint32_t group)
+{
+	if (_valid_group(group))
+	{
+		groups[group].n_pins = 0;
+	}
+}
+
+void schedule_pin_group_write(const DataPacket* data)
+{
+	if (!_valid_group(data->arg1))
+	{
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_GROUP_WRITE);
+	event.idx = data->arg1;
+	schedule_event(&event);
+}
+
+
+/************************************************************************/
+/*                 FUNCTIONS TO USE WITHIN EVENTS                       */
+/************************************************************************/
+
+void write_pin_group_func(uint32_t arg1_group, uint32_t arg2_value)
+{
+	const PinGroup* g = &groups[arg1_group % MAX_PIN_GROUPS];
+	uint32_t set_mask[N_PIO_PORTS] = {0};
+	uint32_t clr_mask[N_PIO_PORTS] = {0};
+
+	for (uint32_t i = 0; i < g->n_pins; i++)
+	{
+		uint32_t id = g->pin_ids[i];
+		bool level = pins[id].latch((arg2_value >> i) & 1);
+		(level ? set_mask : clr_mask)[id >> 5] |= pin_cache.mask[id];
+	}
+
+	for (uint32_t port = 0; port < N_PIO_PORTS; port++)
+	{
+		if (set_mask[port] | clr_mask[port])
+		{
+			pins_write_port(port, set_mask[port], clr_mask[port]);
+		}
+	}
+}
@@ -0,0 +1,60 @@
+/**
+ * @file pin_group.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Pin groups written as parallel digital buses.
+ *
+ * A pin group maps the bits of a value onto up to PIN_GROUP_MAX_PINS pins
+ * on any of the PIO ports: bit 0 goes to the first pin added to the group,
+ * bit 1 to the second, and so on. A single scheduled event writes the whole
+ * value, so instruments with parallel inputs (filter indices, frame tags)
+ * take one queue slot instead of one per bit.
+ *
+ * All pins of the group that belong to the same port change on the same MCK
+ * cycle, see pins_write_port(). The pins follow the same rules as with
+ * Pin::set_level(): disabled pins stay low, and so do the shutter pins while
+ * the interlock is open.
+ *
+ * Groups are defined with the GRP and GRC commands and written with GRW.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Register the GRP, GRC, and GRW commands.
+ */
+void init_pin_groups();
+
+/**
+ * @brief Append a pin to a group as its next bit.
+ * @param group Group index, from 0 to MAX_PIN_GROUPS - 1
+ * @param pin_idx IOPORT index of the pin
+ *
+ * The pin is configured as an output and keeps its current level.
+ */
+void add_pin_to_group(uint32_t group, uint32_t pin_idx);
+
+/**
+ * @brief Remove all pins from a group.
+ * @param group Group index, from 0 to MAX_PIN_GROUPS - 1
+ */
+void clear_pin_group(uint32_t group);
+
+/**
+ * @brief Schedule a write of a value to a pin group.
+ * @param data Pointer to DataPacket containing the write parameters
+ *
+ * data->arg1 is the group index, data->arg2 is the value. Timestamp, N, and
+ * interval have the usual meaning.
+ */
+void schedule_pin_group_write(const DataPacket* data);
+
+/**
+ * @brief Event function that writes a value to a pin group.
+ * @param arg1_group Group index
+ * @param arg2_value Value; bit i drives the i-th pin of the group
+ */
+void write_pin_group_func(uint32_t arg1_group, uint32_t arg2_value);
@@ -8,128 +8,182 @@
 #include "pins.h"
 #include "strings.h"
 #include "interlock.h"
+#include "events.h"
 
-Pin pins[107];
+PinCache pin_cache;
+const PinTable pins = {};
+
+// Pin writes accumulated in the batch mode, one set/clear mask per PIO port.
+// Only staged writes are deferred, and those come from the event dispatcher
+// with the event interrupt masked, or from the main loop.
+static volatile bool batch_active = false;
+static uint32_t batch_set_mask[N_PIO_PORTS];
+static uint32_t batch_clr_mask[N_PIO_PORTS];
+
+// Pins held low, per PIO port: disabled pins, and the shutters while the
+// interlock is open. Applied again when a batch is flushed, since the
+// interlock may have closed the shutters after their edges were queued.
+static uint32_t blocked_mask[N_PIO_PORTS];
+
+static inline bool _is_blocked(uint32_t flags)
+{
+	return (flags & PIN_DISABLED) || ((flags & PIN_SHUTTER) && !lasers_enabled);
+}
+
+// Update the write target of the high level and blocked_mask after the
+// flags of a pin or the interlock state changed
+static void _refresh_blocked(uint32_t pin_idx)
+{
+	uint32_t port = pin_idx >> 5;
+	uint32_t mask = pin_cache.mask[pin_idx];
+	bool blocked = _is_blocked(pin_cache.flags[pin_idx]);
+	Pio* pio = arch_ioport_pin_to_base(pin_idx);
+
+	irqflags_t flags = cpu_irq_save();
+		pin_cache.out_reg[pin_idx][1] = blocked ? &pio->PIO_CODR : &pio->PIO_SODR;
+		blocked_mask[port] = blocked ? (blocked_mask[port] | mask) : (blocked_mask[port] & ~mask);
+	cpu_irq_restore(flags);
+}
 
 /************************************************************************/
 /*                    PIN MAPPING                                       */
 /************************************************************************/
 
-// Arduino Due pin mapping table (digital and analog pins)
-const pin_map_t pin_map[] = {
-	{"D0", PIO_PA8_IDX},     // Digital pin D0 -> PA8
-	{"D1", PIO_PA9_IDX},
-	{"D2", PIO_PB25_IDX},
-	{"D3", PIO_PC28_IDX},
-	{"D4", PIO_PA29_IDX},
-	{"D5", PIO_PC25_IDX},
-	{"D6", PIO_PC24_IDX},
-	{"D7", PIO_PC23_IDX},
-	{"D8", PIO_PC22_IDX},
-	{"D9", PIO_PC21_IDX},
-	{"D10", PIO_PA28_IDX},
-	{"D11", PIO_PD7_IDX},
-	{"D12", PIO_PD8_IDX},
-	{"D13", PIO_PB27_IDX},
-	{"D14", PIO_PD4_IDX},
-	{"D15", PIO_PD5_IDX},
-	{"D16", PIO_PA13_IDX},
-	{"D17", PIO_PA12_IDX},
-	{"D18", PIO_PA11_IDX},
-	{"D19", PIO_PA10_IDX},
-	{"D20", PIO_PB12_IDX},
-	{"D21", PIO_PB13_IDX},
-	{"D22", PIO_PB26_IDX},
-	{"D23", PIO_PA14_IDX},
-	{"D24", PIO_PA15_IDX},
-	{"D25", PIO_PD0_IDX},
-	{"D26", PIO_PD1_IDX},
-	{"D27", PIO_PD2_IDX},
-	{"D28", PIO_PD3_IDX},
-	{"D29", PIO_PD6_IDX},
-	{"D30", PIO_PD9_IDX},
-	{"D31", PIO_PA7_IDX},
-	{"D32", PIO_PD10_IDX},
-	{"D33", PIO_PC1_IDX},
-	{"D34", PIO_PC2_IDX},
-	{"D35", PIO_PC3_IDX},
-	{"D36", PIO_PC4_IDX},
-	{"D37", PIO_PC5_IDX},
-	{"D38", PIO_PC6_IDX},
-	{"D39", PIO_PC7_IDX},
-	{"D40", PIO_PC8_IDX},
-	{"D41", PIO_PC9_IDX},
-	{"D42", PIO_PA19_IDX},
-	{"D43", PIO_PA20_IDX},
-	{"D44", PIO_PC19_IDX},
-	{"D45", PIO_PC18_IDX},
-	{"D46", PIO_PC17_IDX},
-	{"D47", PIO_PC16_IDX},
-	{"D48", PIO_PC15_IDX},
-	{"D49", PIO_PC14_IDX},
-	{"D50", PIO_PC13_IDX},
-	{"D51", PIO_PC12_IDX},
-	{"D52", PIO_PB21_IDX},
-	{"D53", PIO_PB14_IDX},
-	{"D54", PIO_PA16_IDX},
-	{"D55", PIO_PA24_IDX},
-	{"D56", PIO_PA23_IDX},
-	{"D57", PIO_PA22_IDX},
-	{"D58", PIO_PA6_IDX},
-	{"D59", PIO_PA4_IDX},
-	{"D60", PIO_PA3_IDX},
-	{"D61", PIO_PA2_IDX},
-	{"D62", PIO_PB17_IDX},
-	{"D63", PIO_PB18_IDX},
-	{"D64", PIO_PB19_IDX},
-	{"D65", PIO_PB20_IDX},
-	{"D66", PIO_PB15_IDX},
-	{"D67", PIO_PB16_IDX},
-	{"D68", PIO_PA1_IDX},
-	{"D69", PIO_PA0_IDX},
-
-	{"A0", PIO_PA16_IDX},
-	{"A1", PIO_PA24_IDX},
-	{"A2", PIO_PA23_IDX},
-	{"A3", PIO_PA22_IDX},
-	{"A4", PIO_PA6_IDX},
-	{"A5", PIO_PA4_IDX},
-	{"A6", PIO_PA3_IDX},
-	{"A7", PIO_PA2_IDX},
-	{"A8", PIO_PB17_IDX},
-	{"A9", PIO_PB18_IDX},
-	{"A10", PIO_PB19_IDX},
-	{"A11", PIO_PB20_IDX},
-	{"A12", PIO_PB15_IDX},
-	{"A13", PIO_PB16_IDX},
-	{"A14", PIO_PA1_IDX},
-	{"A15", PIO_PA0_IDX},
+// Arduino Due pin mapping table, indexed by the number of the digital pin.
+// Analog pins A0-A15 are the same as D54-D69.
+constexpr uint8_t digital_pin_ids[N_DIGITAL_PINS] = {
+	PIO_PA8_IDX,    // D0
+	PIO_PA9_IDX,    // D1
+	PIO_PB25_IDX,   // D2
+	PIO_PC28_IDX,   // D3
+	PIO_PA29_IDX,   // D4
+	PIO_PC25_IDX,   // D5
+	PIO_PC24_IDX,   // D6
+	PIO_PC23_IDX,   // D7
+	PIO_PC22_IDX,   // D8
+	PIO_PC21_IDX,   // D9
+	PIO_PA28_IDX,   // D10
+	PIO_PD7_IDX,    // D11
+	PIO_PD8_IDX,    // D12
+	PIO_PB27_IDX,   // D13
+	PIO_PD4_IDX,    // D14
+	PIO_PD5_IDX,    // D15
+	PIO_PA13_IDX,   // D16
+	PIO_PA12_IDX,   // D17
+	PIO_PA11_IDX,   // D18
+	PIO_PA10_IDX,   // D19
+	PIO_PB12_IDX,   // D20
+	PIO_PB13_IDX,   // D21
+	PIO_PB26_IDX,   // D22
+	PIO_PA14_IDX,   // D23
+	PIO_PA15_IDX,   // D24
+	PIO_PD0_IDX,    // D25
+	PIO_PD1_IDX,    // D26
+	PIO_PD2_IDX,    // D27
+	PIO_PD3_IDX,    // D28
+	PIO_PD6_IDX,    // D29
+	PIO_PD9_IDX,    // D30
+	PIO_PA7_IDX,    // D31
+	PIO_PD10_IDX,   // D32
+	PIO_PC1_IDX,    // D33
+	PIO_PC2_IDX,    // D34
+	PIO_PC3_IDX,    // D35
+	PIO_PC4_IDX,    // D36
+	PIO_PC5_IDX,    // D37
+	PIO_PC6_IDX,    // D38
+	PIO_PC7_IDX,    // D39
+	PIO_PC8_IDX,    // D40
+	PIO_PC9_IDX,    // D41
+	PIO_PA19_IDX,   // D42
+	PIO_PA20_IDX,   // D43
+	PIO_PC19_IDX,   // D44
+	PIO_PC18_IDX,   // D45
+	PIO_PC17_IDX,   // D46
+	PIO_PC16_IDX,   // D47
+	PIO_PC15_IDX,   // D48
+	PIO_PC14_IDX,   // D49
+	PIO_PC13_IDX,   // D50
+	PIO_PC12_IDX,   // D51
+	PIO_PB21_IDX,   // D52
+	PIO_PB14_IDX,   // D53
+	PIO_PA16_IDX,   // D54, A0
+	PIO_PA24_IDX,   // D55, A1
+	PIO_PA23_IDX,   // D56, A2
+	PIO_PA22_IDX,   // D57, A3
+	PIO_PA6_IDX,    // D58, A4
+	PIO_PA4_IDX,    // D59, A5
+	PIO_PA3_IDX,    // D60, A6
+	PIO_PA2_IDX,    // D61, A7
+	PIO_PB17_IDX,   // D62, A8
+	PIO_PB18_IDX,   // D63, A9
+	PIO_PB19_IDX,   // D64, A10
+	PIO_PB20_IDX,   // D65, A11
+	PIO_PB15_IDX,   // D66, A12
+	PIO_PB16_IDX,   // D67, A13
+	PIO_PA1_IDX,    // D68, A14
+	PIO_PA0_IDX,    // D69, A15
 };
 
+// Bitmap of the IOPORT indices that belong to a board pin, built at compile time
+typedef struct {
+	uint32_t bits[4];
+} PinIdSet;
+
+static constexpr PinIdSet _board_pin_ids()
+{
+	PinIdSet set = {{0, 0, 0, 0}};
+	for (uint32_t i = 0; i < N_DIGITAL_PINS; i++)
+	{
+		set.bits[digital_pin_ids[i] >> 5] |= 1UL << (digital_pin_ids[i] & 31);
+	}
+	return set;
+}
+
+static constexpr PinIdSet board_pin_ids = _board_pin_ids();
+static_assert(board_pin_ids.bits[0] & (1UL << PIO_PA0_IDX), "the pin table must be evaluated at compile time");
+
 
 // Convert pin name (e.g., "D13" or "A0") to SAM3X I/O port pin ID
-// This takes ~300us
 uint32_t pin_name_to_ioport_id(const char* pin_name) {
 	return pin_name_to_ioport_id(*((uint32_t*) pin_name));
 }
 
 
+// Takes constant time: the pin number is decoded from the digits and used as
+// an index into digital_pin_ids. Values tagged with PIN_ID_RESOLVED are
+// IOPORT indices resolved by the host.
 uint32_t pin_name_to_ioport_id(const uint32_t pin_name_uint32) {
-	size_t map_size = sizeof(pin_map) / sizeof(pin_map[0]);
-	
+	if (pin_name_uint32 & PIN_ID_RESOLVED)
+	{
+		uint32_t idx = pin_name_uint32 & ~PIN_ID_RESOLVED;
+		if (idx < 8 * sizeof(board_pin_ids.bits) && (board_pin_ids.bits[idx >> 5] & (1UL << (idx & 31))))
+		{
+			return idx;
+		}
+		printf("ERR: %lu is not an IOPORT index of a board pin\n", idx);
+		return PIN_ID_INVALID;
+	}
+
 	const char* pin_name = (const char*) &pin_name_uint32;
+	uint32_t prefix = pin_name[0] & ~0x20;  // upper case
+	uint32_t d1 = (uint8_t) (pin_name[1] - '0');
+	uint32_t d2 = (uint8_t) (pin_name[2] - '0');
+	uint32_t number = (pin_name[2] == 0) ? d1 : d1 * 10 + d2;
 
-	// Iterate through the pin map to find the matching pin name
-	for (size_t i = 0; i < map_size; i++) {
-		if (strncasecmp(pin_name, pin_map[i].pin_name, 3) == 0) {
-			// Return the PIO pin index
-			return pin_map[i].pin_idx;
+	if (d1 <= 9 && (pin_name[2] == 0 || d2 <= 9) && pin_name[3] == 0)
+	{
+		if (prefix == 'D' && number < N_DIGITAL_PINS)
+		{
+			return digital_pin_ids[number];
+		}
+		if (prefix == 'A' && number < N_ANALOG_PINS)
+		{
+			return digital_pin_ids[FIRST_ANALOG_PIN + number];
 		}
 	}
 
-	// Return 0 if pin name is not found
-	printf("ERR: Could not find pin %s\n", pin_name);
-	return 0;
+	printf("ERR: Could not find pin %.3s\n", pin_name);
+	return PIN_ID_INVALID;
 }
 
 // Initialize predefined pins for camera and laser shutters
@@ -142,8 +196,28 @@ void init_pins()
 	sysclk_enable_peripheral_clock(ID_PIOD);
 	
 	
-	// Assign indices to pins
-	for (uint32_t i = 0; i < sizeof(pins)/sizeof(Pin); i++)
+	// Cache the registers of every pin. Enable states are kept across calls,
+	// so the pins disabled by the host stay disabled after STP and CLR.
+	for (uint32_t i = 0; i < N_IOPORT_PINS; i++)
+	{
+		pin_cache.out_reg[i][0] = &arch_ioport_pin_to_base(i)->PIO_CODR;
+		pin_cache.mask[i] = arch_ioport_pin_to_mask(i);
+		pin_cache.flags[i] &= PIN_DISABLED;
+	}
+	for (uint32_t i = 0; i < sizeof(shutter_pins) / sizeof(shutter_pins[0]); i++)
+	{
+		pin_cache.flags[shutter_pins[i]] |= PIN_SHUTTER;
+		if (!sys_timer_armed)  // otherwise A2 or A3 may be the trigger input
+		{
+			ioport_enable_pin(shutter_pins[i]);
+		}
+	}
+	for (uint32_t i = 0; i < N_IOPORT_PINS; i++)
+	{
+		_refresh_blocked(i);
+	}
+
+	for (uint32_t i = 0; i < N_IOPORT_PINS; i++)
 	{
 		switch (i){
 			// exclude special pins
@@ -153,59 +227,166 @@ void init_pins()
 				ioport_set_pin_mode(INTLCK_IN, IOPORT_MODE_PULLUP);
 				ioport_set_pin_dir(INTLCK_IN, IOPORT_DIR_INPUT);
 			break;
+			case GATE_PIN:  // configured by init_gate()
+			break;
 			
 			// all other pins are initialized as output
 			default:
-				Pin * p = &pins[i];
-				p->pin_idx = i;
-				p->set_level(false);
+				pins[i].update();  // the level was reset to low above
 		}
 	}
 }
 
 
-void Pin::set_level(bool level)
+/************************************************************************/
+/*                    BATCHED PIN WRITES                                */
+/************************************************************************/
+
+// Record a pin write in the batch masks
+static inline void _stage_pin(uint32_t pin_idx, bool level)
 {
-	ioport_set_pin_dir(this->pin_idx, IOPORT_DIR_OUTPUT);
-	this->level = level;
-	switch (this->pin_idx)
+	uint32_t mask = pin_cache.mask[pin_idx];
+	uint32_t port = pin_idx >> 5;
+	if (level)  // the last write to a pin wins
 	{
-		case CY2_PIN:
-		case CY3_PIN:
-		case CY5_PIN:
-		case CY7_PIN:
-			ioport_set_pin_level(this->pin_idx, lasers_enabled * this->active * level);
-			break;
-		default:
-			ioport_set_pin_level(this->pin_idx, this->active * level);
+		batch_set_mask[port] |= mask;
+		batch_clr_mask[port] &= ~mask;
 	}
-	
+	else
+	{
+		batch_clr_mask[port] |= mask;
+		batch_set_mask[port] &= ~mask;
+	}
+}
+
+// Write set and clear masks to a port at once
+static inline void _write_port(Pio* pio, uint32_t set_mask, uint32_t clr_mask)
+{
+	if (!clr_mask)
+	{
+		pio->PIO_SODR = set_mask;
+		return;
+	}
+	if (!set_mask)
+	{
+		pio->PIO_CODR = clr_mask;
+		return;
+	}
+
+	uint32_t mask = set_mask | clr_mask;
+	irqflags_t flags = cpu_irq_save();
+		uint32_t owsr = pio->PIO_OWSR;
+		if (owsr & ~mask)
+		{
+			// Other pins follow ODSR writes (a playing waveform); leave them alone
+			pio->PIO_SODR = set_mask;
+			pio->PIO_CODR = clr_mask;
+		}
+		else
+		{
+			pio->PIO_OWER = mask;
+			pio->PIO_ODSR = set_mask;
+			pio->PIO_OWDR = mask & ~owsr;
+		}
+	cpu_irq_restore(flags);
+}
+
+void pins_write_port(uint32_t port, uint32_t set_mask, uint32_t clr_mask)
+{
+	if (!batch_active)
+	{
+		_write_port(arch_ioport_port_to_base(port), set_mask, clr_mask);
+		return;
+	}
+
+	batch_set_mask[port] = (batch_set_mask[port] & ~clr_mask) | set_mask;
+	batch_clr_mask[port] = (batch_clr_mask[port] & ~set_mask) | clr_mask;
+}
+
+void pins_begin_batch()
+{
+	batch_active = true;
+}
+
+void pins_flush_batch()
+{
+	for (uint32_t port = 0; port < N_PIO_PORTS; port++)
+	{
+		uint32_t set_mask = batch_set_mask[port];
+		uint32_t clr_mask = batch_clr_mask[port];
+		batch_set_mask[port] = 0;
+		batch_clr_mask[port] = 0;
+
+		if (set_mask | clr_mask)
+		{
+			// No interlock interrupt between the check and the write
+			irqflags_t flags = cpu_irq_save();
+				uint32_t blocked = set_mask & blocked_mask[port];
+				_write_port(arch_ioport_port_to_base(port), set_mask & ~blocked, clr_mask | blocked);
+			cpu_irq_restore(flags);
+		}
+	}
+}
+
+void pins_commit_batch()
+{
+	pins_flush_batch();
+	batch_active = false;
+}
+
+
+/************************************************************************/
+/*                    PIN CLASS                                         */
+/************************************************************************/
+
+void Pin::stage_level(bool level)
+{
+	if (!batch_active)
+	{
+		this->set_level(level);
+		return;
+	}
+
+	uint32_t pin_idx = this->pin_idx;
+	uint32_t flags = pin_cache.flags[pin_idx];
+	pin_cache.flags[pin_idx] = (flags & ~PIN_LEVEL) | (level ? PIN_LEVEL : 0);
+	_stage_pin(pin_idx, level);  // blocked pins are filtered by pins_flush_batch()
+}
+
+bool Pin::latch(bool level)
+{
+	uint32_t pin_idx = this->pin_idx;
+	uint32_t flags = (pin_cache.flags[pin_idx] & ~PIN_LEVEL) | (level ? PIN_LEVEL : 0);
+	pin_cache.flags[pin_idx] = flags;
+
+	return level && !_is_blocked(flags);
 }
 
 void Pin::update()
 {
-	this->set_level(this->level);
+	_refresh_blocked(this->pin_idx);
+	this->set_level(this->get_level());
+	arch_ioport_pin_to_base(this->pin_idx)->PIO_OER = pin_cache.mask[this->pin_idx];
 }
 
 void Pin::toggle()
 {
-	this->level = !this->level;	
-	this->set_level(this->level);
+	this->set_level(!this->get_level());
 }
 
 void Pin::enable()
 {
-	this->active = true;
-	this->set_level(this->level);
+	pin_cache.flags[this->pin_idx] &= ~PIN_DISABLED;
+	this->update();
 }
 
 void Pin::disable()
 {
-	this->active = false;
-	this->set_level(this->level);
+	pin_cache.flags[this->pin_idx] |= PIN_DISABLED;
+	this->update();
 }
 
 bool Pin::is_active()
 {
-	return this->active;
+	return !(pin_cache.flags[this->pin_idx] & PIN_DISABLED);
 }
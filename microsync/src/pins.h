@@ -18,74 +18,135 @@
 #include <string.h>
 #include "globals.h"
 
+#define PIN_ID_RESOLVED 0x80000000UL  /**< Tag of an IOPORT index resolved by the host, in place of a pin name */
+#define PIN_ID_INVALID  0xFFUL        /**< Returned for unknown pins; not the index of any pin */
+
 /**
  * @brief Convert pin name string to IOPORT ID.
  * @param pin_name Pointer to pin name string (e.g., "D13", "A0")
- * @return IOPORT ID for the specified pin, or 0 if not found
+ * @return IOPORT ID for the specified pin, or PIN_ID_INVALID if not found
  * 
  * Maps Arduino Due pin names to their corresponding IOPORT identifiers.
  */
 uint32_t pin_name_to_ioport_id(const char* pin_name);
 
 /**
- * @brief Convert pin name integer to IOPORT ID.
- * @param pin_name Pin name as integer (e.g., 13 for D13)
- * @return IOPORT ID for the specified pin, or 0 if not found
+ * @brief Convert pin name packed into an integer to IOPORT ID.
+ * @param pin_name Pin name characters in little-endian order (as sent by the host),
+ *                 or an IOPORT index tagged with PIN_ID_RESOLVED
+ * @return IOPORT ID for the specified pin, or PIN_ID_INVALID if not found
  * 
- * Maps Arduino Due pin numbers to their corresponding IOPORT identifiers.
+ * Decodes the "D"/"A" prefix and the pin number and looks the pin up in
+ * digital_pin_ids, so it takes constant time. Tagged values are IOPORT
+ * indices that the host has resolved already; they are only validated. The
+ * tag can't be confused with a name, whose fourth byte is always null.
+ * Unknown pins are reported with an error message.
  */
 uint32_t pin_name_to_ioport_id(const uint32_t pin_name);
 
+#define N_DIGITAL_PINS   70  /**< Number of digital pins, D0-D69 */
+#define N_ANALOG_PINS    16  /**< Number of analog pins, A0-A15 */
+#define FIRST_ANALOG_PIN 54  /**< Digital pin number of A0 */
+
 /**
- * @brief Pin mapping structure for Arduino Due.
+ * @brief IOPORT indices of the Arduino Due pins, indexed by the digital pin number.
  * 
- * Maps pin names to their corresponding IOPORT indices for lookup.
+ * Analog pins A0-A15 are digital pins D54-D69, at FIRST_ANALOG_PIN + n.
+ */
+extern const uint8_t digital_pin_ids[N_DIGITAL_PINS];
+
+#define N_IOPORT_PINS (PIO_PD10_IDX + 1)  /**< Number of IOPORT indices that are board pins or below */
+#define N_PIO_PORTS   4                  /**< PIOA to PIOD */
+
+/** @name Pin state flags
+ *  Bits of PinCache::flags.
+ *  @{ */
+#define PIN_LEVEL    (1U << 0)  /**< Logical level set by the last write */
+#define PIN_DISABLED (1U << 1)  /**< The output is held low, see Pin::disable() */
+#define PIN_SHUTTER  (1U << 2)  /**< Laser shutter pin; held low while the interlock is open */
+/** @} */
+
+/**
+ * @brief State of all pins, as a structure of arrays indexed by the IOPORT index.
+ *
+ * The output registers and the bit mask of every pin are computed by
+ * init_pins(), so a pin write is a single store of the mask into
+ * out_reg[pin][level], without going through the ioport layer. A pin that is
+ * held low (disabled, or a shutter while the interlock is open) has PIO_CODR
+ * for both levels; Pin::update() recomputes the targets.
  */
 typedef struct {
-	const char *pin_name; /**< Pin name string (e.g., "D13", "A0") */
-	uint32_t pin_idx;     /**< IOPORT index for the pin */
-} pin_map_t;
+	volatile uint32_t* out_reg[N_IOPORT_PINS][2];  /**< PIO_CODR and PIO_SODR, or PIO_CODR twice if the pin is held low */
+	uint32_t mask[N_IOPORT_PINS];   /**< Bit of the pin in the PIO registers */
+	uint8_t  flags[N_IOPORT_PINS];  /**< PIN_* state flags */
+} PinCache;
 
 /**
- * @brief Global pin mapping array for Arduino Due.
- * 
- * Contains mappings for all digital and analog pins on the Arduino Due.
+ * @brief Pin state cache.
  */
-extern const pin_map_t pin_map[];
+extern PinCache pin_cache;
 
 /**
  * @brief Pin control class for managing individual pin states.
  * 
  * Provides methods for setting pin levels, enabling/disabling pins,
- * and managing pin state with safety checks.
+ * and managing pin state with safety checks. A Pin is only a handle to the
+ * pin's entry in pin_cache, so it's cheap to copy.
  */
 class Pin {
-private:
-	bool level;  /**< Current logical level of the pin */
-	bool active; /**< Whether the pin is enabled/active */
-
 public:
-	uint32_t pin_idx; /**< IOPORT index for this pin */
+	const uint32_t pin_idx; /**< IOPORT index for this pin */
 	
 	/**
-	 * @brief Default constructor.
-	 * 
-	 * Initializes pin with level=false and active=true.
+	 * @brief Construct a handle of a pin.
+	 * @param pin_idx IOPORT index of the pin
 	 */
-	Pin() : level(false), active(true) {};
+	constexpr explicit Pin(uint32_t pin_idx) : pin_idx(pin_idx) {};
 	
 	/**
 	 * @brief Set the logical level of the pin.
 	 * @param level The logical level to set (true=high, false=low)
 	 * 
-	 * Updates the internal state but doesn't immediately apply to hardware.
+	 * The output follows the level if the pin is enabled, and for shutter
+	 * pins, if the lasers are enabled by the interlock. Always writes the
+	 * hardware immediately, see stage_level() for the batch mode.
+	 */
+	void set_level(bool level)
+	{
+		uint32_t flags = pin_cache.flags[pin_idx];
+		pin_cache.flags[pin_idx] = (flags & ~PIN_LEVEL) | (level ? PIN_LEVEL : 0);
+		*pin_cache.out_reg[pin_idx][level] = pin_cache.mask[pin_idx];
+	}
+	
+	/**
+	 * @brief Set the logical level of the pin as part of the current batch.
+	 * @param level The logical level to set (true=high, false=low)
+	 * 
+	 * Same as set_level(), except that between pins_begin_batch() and
+	 * pins_commit_batch() the write is recorded in the batch.
+	 */
+	void stage_level(bool level);
+	
+	/**
+	 * @brief Get the logical level set by the last write.
+	 * @return The logical level of the pin
+	 */
+	bool get_level() const { return pin_cache.flags[pin_idx] & PIN_LEVEL; }
+	
+	/**
+	 * @brief Store the logical level of the pin without writing the output.
+	 * @param level The logical level to set (true=high, false=low)
+	 * @return Output level that the pin should have, see set_level()
+	 * 
+	 * Used for writing several pins of a port at once with pins_write_port().
 	 */
-	void set_level(bool level);
+	bool latch(bool level);
 	
 	/**
 	 * @brief Apply the current pin state to hardware.
 	 * 
-	 * Updates the actual pin output based on current level and active state.
+	 * Updates the actual pin output based on current level and active state,
+	 * and makes the pin an output.
 	 */
 	void update();
 	
@@ -118,11 +179,62 @@ public:
 };
 
 /**
- * @brief Global array of pin objects.
+ * @brief Access to the pins by their IOPORT index.
+ */
+class PinTable {
+public:
+	/**
+	 * @brief Get the handle of a pin.
+	 * @param pin_idx IOPORT index of the pin, below N_IOPORT_PINS
+	 * @return Pin handle
+	 */
+	Pin operator[](uint32_t pin_idx) const { return Pin(pin_idx); }
+};
+
+/**
+ * @brief All pins on the Arduino Due, indexed by the IOPORT index.
+ */
+extern const PinTable pins;
+
+/**
+ * @brief Start accumulating pin writes.
+ * 
+ * Until pins_commit_batch() is called, Pin::stage_level() and
+ * pins_write_port() don't touch the hardware. Instead, they record the new
+ * levels in per-port set/clear masks. Used by the event dispatcher, with the
+ * event interrupt masked, to make edges scheduled on the same tick truly
+ * simultaneous. Pin::set_level() keeps writing immediately, so interrupts
+ * never touch the batch. Disabled pins and shutters closed by the interlock
+ * are checked again when the batch is applied, so a deferred edge never
+ * raises them.
+ */
+void pins_begin_batch();
+
+/**
+ * @brief Apply accumulated pin writes and leave the batch mode.
+ * 
+ * Every PIO port gets at most one PIO_SODR and one PIO_CODR write.
+ */
+void pins_commit_batch();
+
+/**
+ * @brief Apply accumulated pin writes and stay in the batch mode.
+ */
+void pins_flush_batch();
+
+/**
+ * @brief Drive several pins of a PIO port at once.
+ * @param port PIO port index (0 = PIOA, 1 = PIOB, 2 = PIOC, 3 = PIOD)
+ * @param set_mask Pins to drive high
+ * @param clr_mask Pins to drive low
  * 
- * Contains Pin objects for all 107 pins on the Arduino Due.
+ * If both masks are non-empty, the pins are written with a single masked
+ * PIO_ODSR write, so all edges happen on the same MCK cycle. Ports with a
+ * playing waveform get a PIO_SODR and a PIO_CODR write instead, so that
+ * the waveform pins aren't touched. In the batch mode, the write is merged
+ * into the batch like Pin::stage_level() writes.
  */
-extern Pin pins[107];
+void pins_write_port(uint32_t port, uint32_t set_mask, uint32_t clr_mask);
 
 /**
  * @brief Initialize all pins.
@@ -0,0 +1,117 @@
+/*
+ * profiler.cpp
+ *
+ * Cycle-accurate profiler built on the DWT cycle counter
+ */
+
+#include "profiler.h"
+
+static const char* section_names[PROF_N_SECTIONS] = {
+	"SYS_TC_ISR",
+	"PROCESS_EVENTS",
+	"UART_ISR",
+	"INTLCK_ISR",
+	"PARSE_COMMAND",
+};
+
+static ProfStats sections[PROF_N_SECTIONS];
+static ProfStats funcs[PROF_MAX_FUNCS];  // indexed by EventOp
+
+
+static inline void _update_stats(ProfStats* s, uint32_t cycles)
+{
+	s->min = (s->count == 0 || cycles < s->min) ? cycles : s->min;
+	s->max = (cycles > s->max) ? cycles : s->max;
+	s->total += cycles;
+	s->count++;
+}
+
+static void _print_stats(const ProfStats* s)
+{
+	printf("%lu %lu %lu %lu\n", s->count, s->min, s->max, (uint32_t) (s->total / s->count));
+}
+
+
+void init_profiler()
+{
+#ifdef PROFILING
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+void reset_profiler()
+{
+	irqflags_t flags = cpu_irq_save();
+		for (uint32_t i = 0; i < PROF_N_SECTIONS; i++)
+		{
+			sections[i] = ProfStats();
+		}
+		for (uint32_t i = 0; i < PROF_MAX_FUNCS; i++)
+		{
+			funcs[i] = ProfStats();
+		}
+	cpu_irq_restore(flags);
+}
+
+void send_profile()
+{
+#ifdef PROFILING
+	// Take a consistent snapshot; printing is slow
+	static ProfStats s[PROF_N_SECTIONS];
+	static ProfStats f[PROF_MAX_FUNCS];
+
+	irqflags_t flags = cpu_irq_save();
+		for (uint32_t i = 0; i < PROF_N_SECTIONS; i++)
+		{
+			s[i] = sections[i];
+		}
+		for (uint32_t i = 0; i < PROF_MAX_FUNCS; i++)
+		{
+			f[i] = funcs[i];
+		}
+	cpu_irq_restore(flags);
+
+	for (uint32_t i = 0; i < PROF_N_SECTIONS; i++)
+	{
+		if (s[i].count)
+		{
+			printf("%s ", section_names[i]);
+			_print_stats(&s[i]);
+		}
+	}
+	for (uint32_t i = 0; i < PROF_MAX_FUNCS; i++)
+	{
+		if (f[i].count)
+		{
+			printf("%lu ", i);
+			_print_stats(&f[i]);
+		}
+	}
+#else
+	printf("ERR: profiling is disabled in this firmware build\n");
+#endif
+}
+
+
+#ifdef PROFILING
+
+void prof_record(uint32_t section, uint32_t cycles)
+{
+	// process_events() may complete in the main loop right as the system
+	// timer interrupt runs it again
+	irqflags_t flags = cpu_irq_save();
+		_update_stats(&sections[section], cycles);
+	cpu_irq_restore(flags);
+}
+
+void prof_record_func(uint32_t op, uint32_t cycles)
+{
+	if (op < PROF_MAX_FUNCS)
+	{
+		_update_stats(&funcs[op], cycles);
+	}
+}
+
+#endif
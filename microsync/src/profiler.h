@@ -0,0 +1,117 @@
+/**
+ * @file profiler.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Cycle-accurate profiler built on the DWT cycle counter.
+ *
+ * This module measures the execution time of the interrupt handlers, the
+ * event dispatcher, the command parser, and every event function in MCK
+ * cycles (84 cycles per microsecond). For each section it keeps the number
+ * of calls together with the min/max/total cycle count, so the worst-case
+ * path that limits the event density can be found on a running device.
+ *
+ * Sections are timed from entry to exit, so the time of higher priority
+ * interrupts that preempt a section is included in it. process_events()
+ * includes the event functions it calls.
+ *
+ * The instrumentation is compiled in only if PROFILING is defined in
+ * globals.h. The statistics are reported and reset with the PRF command.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+
+/**
+ * @brief Profiled code sections, in addition to the event functions.
+ */
+enum ProfSection : uint32_t {
+	PROF_SYS_TC_ISR,        /**< SYS_TC_Handler() */
+	PROF_PROCESS_EVENTS,    /**< process_events() */
+	PROF_UART_ISR,          /**< UART_Handler() */
+	PROF_INTLCK_ISR,        /**< INTLCK_TC_Handler() */
+	PROF_PARSE_COMMAND,     /**< _parse_UART_command() */
+	PROF_N_SECTIONS
+};
+
+/**
+ * @brief Execution time statistics of a section, in MCK cycles.
+ */
+typedef struct {
+	uint32_t count;   /**< Number of calls */
+	uint32_t min;     /**< Shortest call */
+	uint32_t max;     /**< Longest call */
+	uint64_t total;   /**< Sum of all calls */
+} ProfStats;
+
+/**
+ * @brief Enable the DWT cycle counter.
+ */
+void init_profiler();
+
+/**
+ * @brief Clear the statistics of all sections and event functions.
+ */
+void reset_profiler();
+
+/**
+ * @brief Print the profiler statistics over UART.
+ *
+ * Prints one line "name count min max mean" per section that has been
+ * called, in MCK cycles. Event functions are named by their EventOp
+ * opcode, which the Python driver maps to names with its event_ops table.
+ */
+void send_profile();
+
+#ifdef PROFILING
+
+/**
+ * @brief Add a measurement to a section.
+ * @param section ProfSection of the measured code
+ * @param cycles Execution time, MCK cycles
+ */
+void prof_record(uint32_t section, uint32_t cycles);
+
+/**
+ * @brief Add a measurement to an event function.
+ * @param op EventOp of the event function
+ * @param cycles Execution time, MCK cycles
+ */
+void prof_record_func(uint32_t op, uint32_t cycles);
+
+/**
+ * @brief Current value of the DWT cycle counter.
+ */
+static inline uint32_t prof_cycles()
+{
+	return DWT->CYCCNT;
+}
+
+/**
+ * @brief Times the enclosing scope, including early returns.
+ */
+class ProfScope {
+private:
+	uint32_t section;
+	uint32_t t0;
+public:
+	explicit ProfScope(uint32_t section) : section(section), t0(prof_cycles()) {}
+	~ProfScope() { prof_record(section, prof_cycles() - t0); }
+};
+
+/** @brief Profile the rest of the enclosing scope as a section. */
+#define PROF_SCOPE(section) ProfScope _prof_scope(section)
+
+/** @brief Execute an event function call and profile it under its opcode. */
+#define PROF_CALL_EVENT_FUNC(op, call) do { \
+		uint32_t _prof_t0 = prof_cycles(); \
+		call; \
+		prof_record_func((op), prof_cycles() - _prof_t0); \
+	} while (0)
+
+#else
+
+#define PROF_SCOPE(section)
+#define PROF_CALL_EVENT_FUNC(op, call) call
+
+#endif
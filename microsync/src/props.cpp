@@ -14,6 +14,8 @@
 #include "events.h"
 #include "interlock.h"
 #include "ext_pTIRF.h"
+#include "hw_pulse.h"
+#include "gate.h"
 
 
 // Global map to store properties by their ID
@@ -47,7 +49,7 @@ void init_props() {
 	props[ro_SYS_TIMER_VALUE]        = new ExternalProperty((uint32_t*) &(SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_CV));
 	props[ro_SYS_TIMER_OVF_COUNT]    = new FunctionProperty(get_sys_tc_ovf, nullptr);
 	props[ro_SYS_TIME_ms]            = new FunctionProperty(get_time_ms, nullptr);
-	props[ro_SYS_TIMER_PRESCALER]    = new InternalProperty((uint32_t) SYS_TC_PRESCALER);
+	props[rw_SYS_TIMER_PRESCALER]    = new FunctionProperty(get_sys_timer_prescaler, set_sys_timer_prescaler, PropertyAccess::ReadWrite);
 	props[rw_DFLT_PULSE_DURATION_us] = new ExternalProperty((uint32_t*) &default_pulse_duration_us, PropertyAccess::ReadWrite);
 	props[ro_WATCHDOG_TIMEOUT_ms]    = new InternalProperty((uint32_t) WATCHDOG_TIMEOUT);
 	props[ro_N_EVENTS]               = new FunctionProperty(get_N_events, nullptr);
@@ -59,6 +61,13 @@ void init_props() {
 	props[wo_CLOSE_SHUTTERS]         = new FunctionProperty(nullptr, close_shutters, PropertyAccess::WriteOnly);
 	props[rw_SHUTTER_DELAY_us]       = new InternalProperty(1000UL, PropertyAccess::ReadWrite);
 	props[rw_CAM_READOUT_us]         = new InternalProperty(12000UL, PropertyAccess::ReadWrite);
+
+	props[rw_HW_PULSES]              = new ExternalProperty((uint32_t*) &hw_pulses_enabled, PropertyAccess::ReadWrite);
+	props[rw_GATE_MODE]              = new FunctionProperty(get_gate_mode, set_gate_mode, PropertyAccess::ReadWrite);
+	props[ro_TRIG_LATENCY_ns]        = new FunctionProperty(get_trig_latency_ns, nullptr);
+	props[ro_UART_RX_OVERFLOWS]      = new FunctionProperty(get_uart_rx_overflows, nullptr);
+	props[ro_UART_TX_HIGH_WATER]     = new FunctionProperty(get_uart_tx_high_water, nullptr);
+	props[ro_UART_TX_DROPPED]        = new FunctionProperty(get_uart_tx_dropped, nullptr);
 }
 
 
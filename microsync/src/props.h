@@ -27,7 +27,7 @@ enum SysProps {
 	ro_SYS_TIMER_VALUE,            /**< Current system timer value (read-only) */
 	ro_SYS_TIMER_OVF_COUNT,        /**< System timer overflow count (read-only) */
 	ro_SYS_TIME_ms,                /**< Current system time in milliseconds (read-only) */
-	ro_SYS_TIMER_PRESCALER,        /**< System timer prescaler value (read-only) */
+	rw_SYS_TIMER_PRESCALER,        /**< System timer prescaler value (read-write while the timer is stopped) */
 	rw_DFLT_PULSE_DURATION_us,     /**< Default pulse duration in microseconds (read-write) */
 	ro_WATCHDOG_TIMEOUT_ms,        /**< Watchdog timeout in milliseconds (read-only) */
 	ro_N_EVENTS,                   /**< Number of events in queue (read-only) */
@@ -38,7 +38,14 @@ enum SysProps {
 	wo_OPEN_SHUTTERS,              /**< Open all shutters (write-only) */
 	wo_CLOSE_SHUTTERS,             /**< Close all shutters (write-only) */
 	rw_SHUTTER_DELAY_us,           /**< Shutter delay in microseconds (read-write) */
-	rw_CAM_READOUT_us              /**< Camera readout time in microseconds (read-write) */
+	rw_CAM_READOUT_us,             /**< Camera readout time in microseconds (read-write) */
+
+	rw_HW_PULSES,                  /**< Route pulses on A4/A7 to timer compare outputs (read-write) */
+	rw_GATE_MODE,                  /**< External gate mode: 0 - off, 1 - pause while A13 is low, 2 - hardware clock gating (read-write) */
+	ro_TRIG_LATENCY_ns,            /**< Latency of the event processing after the external start trigger, ns (read-only) */
+	ro_UART_RX_OVERFLOWS,          /**< Received bytes lost because the UART receive ring was full (read-only) */
+	ro_UART_TX_HIGH_WATER,         /**< Largest number of bytes waiting in the UART transmit ring (read-only) */
+	ro_UART_TX_DROPPED             /**< Reply bytes lost because the UART transmit ring was full (read-only) */
 };
 
 /**
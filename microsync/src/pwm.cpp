@@ -0,0 +1,219 @@
+/*
+ * pwm.cpp
+ *
+ * Hardware PWM outputs with scheduled duty cycle and period changes
+ */
+
+#include "pwm.h"
+#include "events.h"
+#include "commands.h"
+
+/************************************************************************/
+/*                 PWM CHANNELS                                         */
+/************************************************************************/
+
+// All outputs are on PIOC, peripheral B
+static const uint32_t pwm_pin_masks[N_PWM_CHANNELS] = {
+	PIO_PC3B_PWMH0,   // D35
+	PIO_PC5B_PWMH1,   // D37
+	PIO_PC7B_PWMH2,   // D39
+	PIO_PC9B_PWMH3,   // D41
+	PIO_PC21B_PWML4,  // D9
+	PIO_PC22B_PWML5,  // D8
+	PIO_PC23B_PWML6,  // D7
+	PIO_PC24B_PWML7,  // D6
+};
+
+#define PWM_FIRST_LOW_SIDE 4  // channels from here on drive the PWML outputs
+
+typedef struct {
+	uint32_t presc_shift; // the channel clock is MCK >> presc_shift
+	uint32_t period;      // channel clock ticks, 0 if not configured
+	uint32_t duty;        // Q16 fraction of the period
+} PwmChannel;
+
+static PwmChannel channels[N_PWM_CHANNELS];
+
+
+static inline bool _valid_channel(uint32_t ch)
+{
+	if (ch >= N_PWM_CHANNELS)
+	{
+		printf("ERR: PWM channel must be from 0 to %u\n", N_PWM_CHANNELS - 1);
+		return false;
+	}
+	if (channels[ch].period == 0)
+	{
+		printf("ERR: PWM channel %lu is not configured\n", ch);
+		return false;
+	}
+	return true;
+}
+
+static inline uint32_t _duty_ticks(const PwmChannel* c)
+{
+	return (c->period * c->duty) >> 16;  // can't overflow: period is 16-bit
+}
+
+static inline uint64_t _ns_to_mck(uint32_t period_ns)
+{
+	return (uint64_t) period_ns * (BOARD_MCK / 1000000UL) / 1000UL;
+}
+
+
+/************************************************************************/
+/*                 CHANNEL CONFIGURATION                                */
+/************************************************************************/
+
+void init_pwm()
+{
+	register_command("PWC", [](const DataPacket* data) { configure_pwm(data->arg1, data->arg2); });
+	register_command("PWD", schedule_pwm_duty);
+	register_command("PWS", schedule_pwm_step);
+	register_command("PWP", schedule_pwm_period);
+}
+
+void configure_pwm(uint32_t ch, uint32_t period_ns)
+{
+	if (ch >= N_PWM_CHANNELS)
+	{
+		printf("ERR: PWM channel must be from 0 to %u\n", N_PWM_CHANNELS - 1);
+		return;
+	}
+
+	// Smallest prescaler (MCK/1 to MCK/1024) that fits the period
+	uint64_t cycles = _ns_to_mck(period_ns);
+	uint32_t shift = 0;
+	while (shift < 10 && (cycles >> shift) > PWM_MAX_PERIOD_TICKS)
+	{
+		shift++;
+	}
+	uint32_t period = (uint32_t) (cycles >> shift);
+	if (period < 2 || period > PWM_MAX_PERIOD_TICKS)
+	{
+		printf("ERR: PWM period %lu ns is out of range\n", period_ns);
+		return;
+	}
+
+	sysclk_enable_peripheral_clock(ID_PWM);
+	PWM->PWM_DIS = PWM_DIS_CHID0 << ch;
+
+	// PWMH follows the channel output, PWML is its complement. The channel
+	// output has the CPOL level during the duty cycle.
+	PwmCh_num* pwm = &PWM->PWM_CH_NUM[ch];
+	pwm->PWM_CMR = (shift << PWM_CMR_CPRE_Pos) | ((ch < PWM_FIRST_LOW_SIDE) ? PWM_CMR_CPOL : 0);
+	pwm->PWM_CPRD = period;
+	pwm->PWM_CDTY = 0;
+
+	channels[ch] = {shift, period, 0};
+
+	pio_set_peripheral(PIOC, PIO_PERIPH_B, pwm_pin_masks[ch]);
+	PWM->PWM_ENA = PWM_ENA_CHID0 << ch;
+}
+
+
+/************************************************************************/
+/*                 CHANGE SCHEDULING                                    */
+/************************************************************************/
+
+void schedule_pwm_duty(const DataPacket* data)
+{
+	if (!_valid_channel(data->arg1))
+	{
+		return;
+	}
+	if (data->arg2 > PWM_DUTY_ONE)
+	{
+		printf("ERR: PWM duty cycle must not exceed %lu\n", PWM_DUTY_ONE);
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_PWM_DUTY);
+	event.idx = data->arg1;
+	schedule_event(&event);
+}
+
+void schedule_pwm_step(const DataPacket* data)
+{
+	if (!_valid_channel(data->arg1))
+	{
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_PWM_STEP);
+	event.idx = data->arg1;
+	schedule_event(&event);
+}
+
+void schedule_pwm_period(const DataPacket* data)
+{
+	if (!_valid_channel(data->arg1))
+	{
+		return;
+	}
+
+	const PwmChannel* c = &channels[data->arg1];
+	uint64_t period = _ns_to_mck(data->arg2) >> c->presc_shift;
+	if (period < 2 || period > PWM_MAX_PERIOD_TICKS)
+	{
+		printf("ERR: PWM period %lu ns doesn't fit the prescaler of channel %lu\n", data->arg2, data->arg1);
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_PWM_PERIOD);
+	event.idx = data->arg1;
+	event.arg = (uint32_t) period;
+	schedule_event(&event);
+}
+
+
+/************************************************************************/
+/*                 FUNCTIONS TO USE WITHIN EVENTS                       */
+/************************************************************************/
+
+void set_pwm_duty_func(uint32_t arg1_ch, uint32_t arg2_duty)
+{
+	PwmChannel* c = &channels[arg1_ch % N_PWM_CHANNELS];
+	if (c->period == 0)
+	{
+		return;
+	}
+	c->duty = (arg2_duty < PWM_DUTY_ONE) ? arg2_duty : PWM_DUTY_ONE;
+	PWM->PWM_CH_NUM[arg1_ch % N_PWM_CHANNELS].PWM_CDTYUPD = _duty_ticks(c);
+}
+
+void step_pwm_duty_func(uint32_t arg1_ch, uint32_t arg2_delta)
+{
+	const PwmChannel* c = &channels[arg1_ch % N_PWM_CHANNELS];
+	int32_t duty = (int32_t) c->duty + (int32_t) arg2_delta;
+	set_pwm_duty_func(arg1_ch, (duty > 0) ? duty : 0);
+}
+
+void set_pwm_period_func(uint32_t arg1_ch, uint32_t arg2_period)
+{
+	PwmChannel* c = &channels[arg1_ch % N_PWM_CHANNELS];
+	if (c->period == 0)
+	{
+		return;
+	}
+	c->period = arg2_period;
+
+	// Both update registers are taken at the end of the current period
+	PwmCh_num* pwm = &PWM->PWM_CH_NUM[arg1_ch % N_PWM_CHANNELS];
+	pwm->PWM_CPRDUPD = c->period;
+	pwm->PWM_CDTYUPD = _duty_ticks(c);
+}
+
+void stop_pwm()
+{
+	for (uint32_t ch = 0; ch < N_PWM_CHANNELS; ch++)
+	{
+		if (channels[ch].period > 0)
+		{
+			PWM->PWM_DIS = PWM_DIS_CHID0 << ch;
+			// Give the pin back to PIO, driven low
+			pio_set_output(PIOC, pwm_pin_masks[ch], 0, 0, 0);
+			channels[ch].period = 0;
+		}
+	}
+}
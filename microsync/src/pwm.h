@@ -0,0 +1,96 @@
+/**
+ * @file pwm.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Hardware PWM outputs with scheduled duty cycle and period changes.
+ *
+ * The PWM controller generates the waveforms of up to N_PWM_CHANNELS channels
+ * without CPU involvement. Channels 0-3 drive the high-side outputs on D35,
+ * D37, D39, and D41, channels 4-7 the low-side outputs on D9, D8, D7, and D6.
+ * The polarity is chosen per output, so the duty cycle is always the
+ * fraction of the period the pin is high.
+ *
+ * A channel is configured with PWC, which selects the smallest prescaler
+ * that fits the period into the 16-bit channel counter. Scheduled events
+ * change the duty cycle (PWD), step it by a signed increment on every
+ * repetition (PWS), or change the period (PWP). The changes go through the
+ * update registers and take effect at the end of the current period, so
+ * the output never glitches. A duty cycle ramp takes a single queue slot.
+ *
+ * Duty cycles are Q16 fractions of the period: PWM_DUTY_ONE is 100%. The
+ * outputs keep running while the timeline is paused; only the scheduled
+ * changes wait.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Register the PWC, PWD, PWS, and PWP commands.
+ */
+void init_pwm();
+
+/**
+ * @brief Configure and enable a PWM channel.
+ * @param ch Channel index, from 0 to N_PWM_CHANNELS - 1
+ * @param period_ns PWM period in nanoseconds
+ *
+ * The channel starts with a duty cycle of 0, i.e. its pin is low.
+ */
+void configure_pwm(uint32_t ch, uint32_t period_ns);
+
+/**
+ * @brief Schedule a duty cycle change.
+ * @param data Pointer to DataPacket containing the change parameters
+ *
+ * data->arg1 is the channel, data->arg2 is the duty cycle in Q16 (from 0 to
+ * PWM_DUTY_ONE). Timestamp, N, and interval have the usual meaning.
+ */
+void schedule_pwm_duty(const DataPacket* data);
+
+/**
+ * @brief Schedule a duty cycle increment.
+ * @param data Pointer to DataPacket containing the change parameters
+ *
+ * data->arg1 is the channel, data->arg2 is a signed Q16 increment, added on
+ * every repetition. The duty cycle saturates at 0 and PWM_DUTY_ONE.
+ */
+void schedule_pwm_step(const DataPacket* data);
+
+/**
+ * @brief Schedule a period change.
+ * @param data Pointer to DataPacket containing the change parameters
+ *
+ * data->arg1 is the channel, data->arg2 is the new period in nanoseconds.
+ * The period must fit the prescaler selected by configure_pwm(). The duty
+ * cycle keeps its fraction of the period.
+ */
+void schedule_pwm_period(const DataPacket* data);
+
+/**
+ * @brief Event function that sets the duty cycle of a channel.
+ * @param arg1_ch Channel index
+ * @param arg2_duty Duty cycle in Q16
+ */
+void set_pwm_duty_func(uint32_t arg1_ch, uint32_t arg2_duty);
+
+/**
+ * @brief Event function that changes the duty cycle of a channel by an increment.
+ * @param arg1_ch Channel index
+ * @param arg2_delta Signed duty cycle increment in Q16
+ */
+void step_pwm_duty_func(uint32_t arg1_ch, uint32_t arg2_delta);
+
+/**
+ * @brief Event function that sets the period of a channel.
+ * @param arg1_ch Channel index
+ * @param arg2_period Period in ticks of the channel prescaler
+ */
+void set_pwm_period_func(uint32_t arg1_ch, uint32_t arg2_period);
+
+/**
+ * @brief Disable all PWM channels and return their pins to PIO control.
+ */
+void stop_pwm();
@@ -0,0 +1,408 @@
+/**
+ * @file timing_wheel.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Hierarchical timing wheel used as an alternative event queue.
+ *
+ * This module provides a drop-in replacement for StaticHeap with constant
+ * time insertion and dispatch of near-term elements. Elements are hashed by
+ * their 64-bit key into three levels of slots:
+ *
+ * - level 0: 256 slots, 2^6 ticks each (covers 2^14 ticks)
+ * - level 1: 64 slots, 2^14 ticks each (covers 2^20 ticks)
+ * - level 2: 64 slots, 2^20 ticks each (covers 2^26 ticks)
+ *
+ * Anything further away is kept in an overflow list. Level 0 slots are kept
+ * sorted, so elements are dispatched in exact key order. Higher levels are
+ * cascaded lazily into lower ones once the lower level runs empty. Storage is
+ * a static node pool, so the queue never touches the heap allocator.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Statically sized hierarchical timing wheel.
+ *
+ * The earliest element (the smallest key) is at the top, matching the order
+ * of StaticHeap for elements whose operator< compares keys in reverse.
+ * Elements with equal keys are dispatched first-in, first-out.
+ *
+ * @tparam T Element type; must be copyable
+ * @tparam Capacity Maximum number of elements
+ * @tparam Key Type with a static `uint64_t key(const T&)` method returning the element timestamp
+ */
+template <typename T, size_t Capacity, typename Key>
+class TimingWheel {
+private:
+	static_assert(Capacity < 0xFFFF, "node links are 16-bit");
+
+	static const uint32_t L0_SHIFT  = 6;                    /**< log2 of level 0 slot width, ticks */
+	static const uint32_t L1_SHIFT  = L0_SHIFT + 8;         /**< log2 of level 1 slot width, ticks */
+	static const uint32_t L2_SHIFT  = L1_SHIFT + 6;         /**< log2 of level 2 slot width, ticks */
+	static const uint32_t TOP_SHIFT = L2_SHIFT + 6;         /**< log2 of the wheel span, ticks */
+
+	// All slots share one array: level 0, level 1, level 2, then the overflow list
+	static const size_t L0_BASE  = 0;
+	static const size_t L1_BASE  = L0_BASE + (1UL << (L1_SHIFT - L0_SHIFT));
+	static const size_t L2_BASE  = L1_BASE + (1UL << (L2_SHIFT - L1_SHIFT));
+	static const size_t OVF_SLOT = L2_BASE + (1UL << (TOP_SHIFT - L2_SHIFT));
+	static const size_t N_SLOTS  = OVF_SLOT + 1;
+
+	/**
+	 * @brief Pool node; links are 1-based node indices, 0 terminates a list.
+	 */
+	struct Node {
+		T item;
+		uint16_t next = 0;
+	};
+
+	Node nodes[Capacity];                     /**< Node pool */
+	uint16_t heads[N_SLOTS];                  /**< First node of every slot list */
+	uint32_t busy[(N_SLOTS + 31) / 32];       /**< Bitmap of non-empty slots */
+	uint32_t used[(Capacity + 31) / 32];      /**< Bitmap of allocated nodes */
+	uint16_t free_head;                       /**< List of released nodes */
+	uint16_t n_fresh;                         /**< Number of nodes ever allocated from the pool */
+	size_t n;                                 /**< Number of elements in the wheel */
+	uint64_t cursor;                          /**< Start of the level 0 slot at the wheel position */
+
+	static uint64_t key_of(const T& item) { return Key::key(item); }
+
+	void set_busy(size_t s)   { busy[s >> 5] |= (1UL << (s & 31)); }
+	void clear_busy(size_t s) { busy[s >> 5] &= ~(1UL << (s & 31)); }
+
+	/**
+	 * @brief Find the first non-empty slot in the range [from, to).
+	 * @return Slot index, or `to` if all slots in the range are empty
+	 */
+	size_t find_busy(size_t from, size_t to) const
+	{
+		while (from < to)
+		{
+			uint32_t w = busy[from >> 5] & (0xFFFFFFFFUL << (from & 31));
+			if (w)
+			{
+				size_t s = (from & ~31UL) + __builtin_ctz(w);
+				return (s < to) ? s : to;
+			}
+			from = (from | 31UL) + 1;
+		}
+		return to;
+	}
+
+	/**
+	 * @brief Pick the slot for a key relative to the current wheel position.
+	 *
+	 * The level is given by the highest bit in which the key differs from the
+	 * cursor. Keys that are already in the past go to the current slot.
+	 */
+	size_t slot_for(uint64_t k) const
+	{
+		if (k < cursor)
+		{
+			k = cursor;
+		}
+		if ((k >> L1_SHIFT) == (cursor >> L1_SHIFT))
+		{
+			return L0_BASE + ((k >> L0_SHIFT) & (L1_BASE - L0_BASE - 1));
+		}
+		if ((k >> L2_SHIFT) == (cursor >> L2_SHIFT))
+		{
+			return L1_BASE + ((k >> L1_SHIFT) & (L2_BASE - L1_BASE - 1));
+		}
+		if ((k >> TOP_SHIFT) == (cursor >> TOP_SHIFT))
+		{
+			return L2_BASE + ((k >> L2_SHIFT) & (OVF_SLOT - L2_BASE - 1));
+		}
+		return OVF_SLOT;
+	}
+
+	/**
+	 * @brief Insert a node into its slot.
+	 * @param node 1-based node index
+	 *
+	 * Level 0 lists are sorted by key; the other lists are only containers
+	 * that get redistributed later, so nodes are simply prepended.
+	 */
+	void link(uint16_t node)
+	{
+		uint64_t k = key_of(nodes[node - 1].item);
+		size_t s = slot_for(k);
+		uint16_t* p = &heads[s];
+
+		if (s < L1_BASE)
+		{
+			while (*p && key_of(nodes[*p - 1].item) <= k)
+			{
+				p = &nodes[*p - 1].next;
+			}
+		}
+		nodes[node - 1].next = *p;
+		*p = node;
+		set_busy(s);
+	}
+
+	/**
+	 * @brief Move all nodes of a slot to their slots for the current cursor.
+	 * @param s Slot to redistribute
+	 */
+	void cascade(size_t s)
+	{
+		uint16_t node = heads[s];
+		heads[s] = 0;
+		clear_busy(s);
+		while (node)
+		{
+			uint16_t next = nodes[node - 1].next;
+			link(node);
+			node = next;
+		}
+	}
+
+	/**
+	 * @brief Find the level 0 slot holding the earliest element.
+	 *
+	 * Advances the wheel and cascades higher levels while level 0 is empty.
+	 * @return Slot index; only valid if the wheel is not empty
+	 */
+	size_t front_slot()
+	{
+		while (n > 0)
+		{
+			size_t s = find_busy(L0_BASE + ((cursor >> L0_SHIFT) & (L1_BASE - L0_BASE - 1)), L1_BASE);
+			if (s < L1_BASE)
+			{
+				return s;
+			}
+
+			s = find_busy(L1_BASE + ((cursor >> L1_SHIFT) & (L2_BASE - L1_BASE - 1)) + 1, L2_BASE);
+			if (s < L2_BASE)
+			{
+				cursor = ((cursor >> L2_SHIFT) << L2_SHIFT) | ((uint64_t)(s - L1_BASE) << L1_SHIFT);
+				cascade(s);
+				continue;
+			}
+
+			s = find_busy(L2_BASE + ((cursor >> L2_SHIFT) & (OVF_SLOT - L2_BASE - 1)) + 1, OVF_SLOT);
+			if (s < OVF_SLOT)
+			{
+				cursor = ((cursor >> TOP_SHIFT) << TOP_SHIFT) | ((uint64_t)(s - L2_BASE) << L2_SHIFT);
+				cascade(s);
+				continue;
+			}
+
+			// Only far-future elements are left; jump to the earliest one
+			uint64_t k_min = UINT64_MAX;
+			for (uint16_t node = heads[OVF_SLOT]; node; node = nodes[node - 1].next)
+			{
+				uint64_t k = key_of(nodes[node - 1].item);
+				k_min = (k < k_min) ? k : k_min;
+			}
+			cursor = (k_min >> L0_SHIFT) << L0_SHIFT;
+			cascade(OVF_SLOT);
+		}
+		return L0_BASE;
+	}
+
+public:
+	/**
+	 * @brief Construct an empty wheel.
+	 *
+	 * The constructor is constexpr so that global instances are
+	 * initialized at compile time and don't need a static constructor.
+	 */
+	constexpr TimingWheel() : nodes(), heads(), busy(), used(),
+		free_head(0), n_fresh(0), n(0), cursor(0) {}
+
+	/**
+	 * @brief Maximum number of elements the wheel can hold.
+	 * @return Wheel capacity
+	 */
+	static constexpr size_t capacity() { return Capacity; }
+
+	/**
+	 * @brief Number of elements in the wheel.
+	 * @return Current wheel size
+	 */
+	size_t size() const { return n; }
+
+	/**
+	 * @brief Check whether the wheel is empty.
+	 * @return true if there are no elements in the wheel
+	 */
+	bool empty() const { return n == 0; }
+
+	/**
+	 * @brief Check whether the wheel is full.
+	 * @return true if no more elements can be pushed
+	 */
+	bool full() const { return n >= Capacity; }
+
+	/**
+	 * @brief Access the element with the smallest key.
+	 * @return Reference to the top element; undefined if the wheel is empty
+	 */
+	const T& top()
+	{
+		return nodes[(n > 0) ? heads[front_slot()] - 1 : 0].item;
+	}
+
+	/**
+	 * @brief Insert a new element.
+	 * @param item Element to insert
+	 * @return false if the wheel is full and the element was dropped
+	 */
+	bool push(const T& item)
+	{
+		uint16_t node;
+
+		if (free_head)
+		{
+			node = free_head;
+			free_head = nodes[node - 1].next;
+		}
+		else if (n_fresh < Capacity)
+		{
+			node = ++n_fresh;
+		}
+		else
+		{
+			return false;
+		}
+
+		nodes[node - 1].item = item;
+		used[(node - 1) >> 5] |= (1UL << ((node - 1) & 31));
+		n++;
+		link(node);
+		return true;
+	}
+
+	/**
+	 * @brief Remove the top element.
+	 */
+	void pop()
+	{
+		if (n == 0)
+		{
+			return;
+		}
+		size_t s = front_slot();
+		uint16_t node = heads[s];
+
+		heads[s] = nodes[node - 1].next;
+		if (!heads[s])
+		{
+			clear_busy(s);
+		}
+		used[(node - 1) >> 5] &= ~(1UL << ((node - 1) & 31));
+		nodes[node - 1].next = free_head;
+		free_head = node;
+		n--;
+	}
+
+	/**
+	 * @brief Replace the top element.
+	 * @param item Element that takes the place of the current top
+	 *
+	 * Equivalent to pop() followed by push(item).
+	 */
+	void replace_top(const T& item)
+	{
+		pop();
+		push(item);
+	}
+
+	/**
+	 * @brief Remove all elements.
+	 */
+	void clear()
+	{
+		for (size_t i = 0; i < N_SLOTS; i++)
+		{
+			heads[i] = 0;
+		}
+		for (size_t i = 0; i < sizeof(busy) / sizeof(busy[0]); i++)
+		{
+			busy[i] = 0;
+		}
+		for (size_t i = 0; i < sizeof(used) / sizeof(used[0]); i++)
+		{
+			used[i] = 0;
+		}
+		free_head = 0;
+		n_fresh = 0;
+		n = 0;
+		cursor = 0;
+	}
+
+	/**
+	 * @brief Copy the element stored at a given storage index.
+	 * @param i Storage index, from 0 to capacity() - 1
+	 * @param item Output, receives a copy of the element
+	 * @return false if the storage slot is empty
+	 *
+	 * Elements are visited in pool order, not in priority order, and the
+	 * occupied slots are not necessarily contiguous.
+	 */
+	bool at(size_t i, T* item) const
+	{
+		if (i >= Capacity || !(used[i >> 5] & (1UL << (i & 31))))
+		{
+			return false;
+		}
+		*item = nodes[i].item;
+		return true;
+	}
+
+	/**
+	 * @brief Modify every element in place.
+	 * @param f Callable taking `T&`
+	 *
+	 * f must preserve the relative order of the elements, same as for
+	 * StaticHeap. The keys may change arbitrarily otherwise: all nodes are
+	 * redistributed around a new cursor at the earliest key afterwards. The
+	 * keys are read right after f, so anything else they depend on must be
+	 * updated before the call.
+	 */
+	template <typename F>
+	void for_each(F f)
+	{
+		if (n == 0)
+		{
+			return;
+		}
+
+		// Detach all lists, keeping level 0 lists in their sorted order
+		uint16_t chain = 0;
+		uint16_t* tail = &chain;
+		uint64_t k_min = UINT64_MAX;
+		for (size_t s = 0; s < N_SLOTS; s++)
+		{
+			for (uint16_t node = heads[s]; node; node = nodes[node - 1].next)
+			{
+				f(nodes[node - 1].item);
+				uint64_t k = key_of(nodes[node - 1].item);
+				k_min = (k < k_min) ? k : k_min;
+				*tail = node;
+				tail = &nodes[node - 1].next;
+			}
+			heads[s] = 0;
+		}
+		*tail = 0;
+		for (size_t i = 0; i < sizeof(busy) / sizeof(busy[0]); i++)
+		{
+			busy[i] = 0;
+		}
+
+		cursor = (k_min >> L0_SHIFT) << L0_SHIFT;
+		while (chain)
+		{
+			uint16_t next = nodes[chain - 1].next;
+			link(chain);
+			chain = next;
+		}
+	}
+};
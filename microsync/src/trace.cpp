@@ -0,0 +1,46 @@
+/*
+ * trace.cpp
+ *
+ * Execution trace of fired events
+ */
+
+#include "trace.h"
+#include "uart_comm.h"
+
+static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0, "TRACE_BUFFER_SIZE must be a power of 2");
+
+TraceRecord trace_buffer[TRACE_BUFFER_SIZE];
+volatile uint32_t trace_head = 0;  // written by the dispatcher
+volatile uint32_t trace_tail = 0;  // written by the command parser
+volatile uint32_t trace_overflows = 0;
+
+
+void send_trace()
+{
+	uint32_t tail = trace_tail;
+	uint32_t head = trace_head;  // records up to here are complete
+	uint32_t header[2] = {(head - tail) & (TRACE_BUFFER_SIZE - 1), trace_overflows};
+
+	uart_tx((char *) header, sizeof(header));
+
+	// Send contiguous chunks; uart_tx() copies the data, so the records
+	// can be released right away
+	while (tail != head)
+	{
+		uint32_t end = (head > tail) ? head : TRACE_BUFFER_SIZE;
+		uint32_t n = end - tail;
+		n = (n > TRACE_RECORDS_PER_TX) ? TRACE_RECORDS_PER_TX : n;
+
+		uart_tx((char *) &trace_buffer[tail], n * sizeof(TraceRecord));
+		tail = (tail + n) & (TRACE_BUFFER_SIZE - 1);
+		trace_tail = tail;
+	}
+}
+
+void clear_trace()
+{
+	irqflags_t flags = cpu_irq_save();
+		trace_tail = trace_head;
+		trace_overflows = 0;
+	cpu_irq_restore(flags);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file trace.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief Execution trace of fired events.
+ *
+ * process_events() appends a record to a fixed-size RAM ring buffer for
+ * every executed event: the event opcode, its arguments, the scheduled
+ * timestamp, and the lateness of the dispatch. The host streams the trace
+ * out with the TRC command while the acquisition continues, so camera frames
+ * can be aligned to the actual excitation timeline afterwards.
+ *
+ * The ring has a single producer (the dispatcher) and a single consumer (the
+ * command parser), so neither side needs to block the other. When the ring
+ * is full, new records are dropped and counted as overflows.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+
+/**
+ * @brief Trace record of a fired event (24 bytes).
+ */
+typedef struct {
+	uint32_t op;        /**< EventOp of the event function */
+	uint32_t arg1;      /**< First argument of the event function */
+	uint32_t arg2;      /**< Second argument of the event function */
+	int32_t  late_cts;  /**< Counter value at dispatch minus the scheduled timestamp */
+	uint64_t ts_cts;    /**< Scheduled timestamp */
+} TraceRecord;
+
+/** @cond INTERNAL */
+extern TraceRecord trace_buffer[TRACE_BUFFER_SIZE];
+extern volatile uint32_t trace_head;
+extern volatile uint32_t trace_tail;
+extern volatile uint32_t trace_overflows;
+/** @endcond */
+
+/**
+ * @brief Append a record to the trace.
+ * @param op EventOp of the event function
+ * @param arg1 First argument of the event function
+ * @param arg2 Second argument of the event function
+ * @param ts_cts Scheduled timestamp
+ * @param late_cts Counter value at dispatch minus the scheduled timestamp
+ *
+ * Called by the dispatcher only.
+ */
+inline void trace_event(uint32_t op, uint32_t arg1, uint32_t arg2, uint64_t ts_cts, int32_t late_cts)
+{
+	uint32_t head = trace_head;
+	uint32_t next = (head + 1) & (TRACE_BUFFER_SIZE - 1);
+
+	if (next == trace_tail)
+	{
+		trace_overflows++;
+		return;
+	}
+
+	TraceRecord* r = &trace_buffer[head];
+	r->op = op;
+	r->arg1 = arg1;
+	r->arg2 = arg2;
+	r->late_cts = late_cts;
+	r->ts_cts = ts_cts;
+	trace_head = next;  // publish the record
+}
+
+/**
+ * @brief Stream the records collected since the previous call.
+ *
+ * Sends an 8-byte header {uint32 number of records, uint32 overflow count}
+ * followed by the TraceRecord structures. The overflow count is the total
+ * number of dropped records since the trace was cleared.
+ */
+void send_trace();
+
+/**
+ * @brief Discard all records and reset the overflow count.
+ */
+void clear_trace();
@@ -2,6 +2,16 @@
 #include "events.h"
 #include "props.h"
 #include "ext_pTIRF.h"
+#include "waveform.h"
+#include "hw_pulse.h"
+#include "burst.h"
+#include "pwm.h"
+#include "latency.h"
+#include "profiler.h"
+#include "trace.h"
+#include "commands.h"
+#include "usb_cdc.h"
+#include "framing.h"
 
 #define RSTC_KEY  0xA5000000  // password for reset controller
 
@@ -9,52 +19,77 @@
 /*                  UART RECEIVE/TRANSMIT BUFFERS                       */
 /************************************************************************/
 
-// Outgoing UART message class
-class UartTxMessage {
-private:
-	char *p_buf;
-	pdc_packet_t uart_tx_packet;
-	
-public:
-	bool is_transmitted;
+/** @brief Bytes waiting for transmission, read by the PDC */
+static uint8_t tx_ring[UART_TX_RING_SIZE];
 
-	UartTxMessage (const char* data, uint32_t len)
-	{
-		this->p_buf = new char[len];
-		this->uart_tx_packet.ul_addr = (uint32_t) this->p_buf;
-		this->uart_tx_packet.ul_size = len;
-		memcpy(p_buf, data, len);
-		this->is_transmitted = false;
-	}
-	
-	~UartTxMessage()
-	{
-		delete[] this->p_buf;
-	}
-	
-	void transmit()
-	{
-		pdc_tx_init(uart_get_pdc_base(UART), &uart_tx_packet, nullptr);
-		this->is_transmitted = true;
-	}
-};
+/** @brief Free-running index up to which tx_ring is claimed by writers */
+static volatile uint32_t tx_reserved = 0;
 
-/** @brief Queue for outgoing UART transmission messages */
-std::queue<UartTxMessage*> tx_queue;
+/** @brief Free-running index up to which tx_ring holds complete data */
+static volatile uint32_t tx_head = 0;
+
+/** @brief Free-running index of the first byte not transmitted yet */
+static volatile uint32_t tx_tail = 0;
+
+/** @brief Bytes in the PDC transfer in progress, 0 if idle */
+static volatile uint32_t tx_in_flight = 0;
+
+/** @brief Writers copying to tx_ring; uart_tx() can be interrupted by another one */
+static volatile uint32_t tx_writers = 0;
+
+/** @brief Largest number of bytes waiting in tx_ring */
+static volatile uint32_t tx_high_water = 0;
+
+/** @brief Bytes lost because interrupt handlers found tx_ring full */
+static volatile uint32_t tx_dropped = 0;
+
+/** @brief Link of the last command, see set_host_transport() */
+static volatile uint8_t host_transport = HOST_UART;
 
 //////////////////////////////////////////////////////////////////////////
 
-/** @brief First receive buffer for double-buffered DMA reception */
-static volatile uint8_t rx_buffer_A[UART_BUFFER_SIZE];
+#define RX_SEGMENT_SIZE (UART_RX_RING_SIZE / UART_RX_SEGMENTS)
+
+/** @brief Received bytes waiting for the stream decoder, written by the PDC */
+static volatile uint8_t rx_ring[UART_RX_RING_SIZE];
+
+/** @brief Segments of rx_ring given to the PDC so far (free-running) */
+static volatile uint32_t rx_segs_queued = 0;
 
-/** @brief Second receive buffer for double-buffered DMA reception */
-static volatile uint8_t rx_buffer_B[UART_BUFFER_SIZE];
+/** @brief Segments of rx_ring the PDC has filled and moved on from (free-running) */
+static volatile uint32_t rx_segs_done = 0;
 
-/** @brief Flag indicating that receive buffer is ready for processing */
-volatile bool rx_buffer_ready = false;
+/** @brief Free-running read index of rx_ring, advanced by poll_uart() */
+static volatile uint32_t rx_tail = 0;
 
-/** @brief Pointer to the buffer containing received data ready for processing */
-volatile uint8_t *rx_filled_buffer_p = NULL;
+/** @brief Bytes lost because the receive ring was full */
+static volatile uint32_t rx_overflows = 0;
+
+/** @brief Write index of rx_ring at the previous timeout interrupt */
+static uint32_t rx_idle_head = 0;
+
+/** @brief Write index of rx_ring at the last communication timeout */
+static volatile uint32_t rx_break = 0;
+
+/** @brief A communication timeout happened since the last poll_uart() */
+static volatile bool rx_break_pending = false;
+
+/** @brief Decoder of the byte stream received through the UART */
+static StreamDecoder uart_decoder;
+
+//////////////////////////////////////////////////////////////////////////
+
+/** @brief Active UART baud rate */
+static uint32_t uart_baudrate = UART_BAUDRATE;
+
+/** @brief Rate to return to if the host doesn't confirm the active one, 0 if confirmed */
+static volatile uint32_t fallback_baudrate = 0;
+
+/** @brief Communication timeouts left until the fallback */
+static volatile uint32_t verify_timeouts_left = 0;
+
+/** @brief The host hasn't confirmed the active rate in time, poll_uart() falls back */
+static volatile bool fallback_due = false;
 
 
 /************************************************************************/
@@ -67,21 +102,45 @@ volatile uint8_t *rx_filled_buffer_p = NULL;
 void _DMA_tx_wait(Pdc* p_uart_pdc);
 
 /**
- * @brief Parse and execute UART command from received data packet
- * @param data Pointer to received DataPacket
+ * @brief Initialize UART timer/counter for timeout detection
  */
-void _parse_UART_command(const DataPacket *data);
+void _init_UART_TC(void);
 
 /**
- * @brief Initialize UART timer/counter for timeout detection
+ * @brief Switch the UART to a new baud rate
+ * @param baudrate New baud rate, must be accepted by _baudrate_divisor()
+ *
+ * Waits for the transmit ring to drain, so it must not be called from an
+ * interrupt: a uart_tx() it interrupted would never publish its data.
  */
-void _init_UART_TC(void);
+void _set_baudrate(uint32_t baudrate);
 
 /**
- * @brief Initialize UART DMA receiver with specified buffer size
- * @param size Size of the receive buffer
+ * @brief Handle the BAU command: switch the rate or confirm the active one
+ * @param data Pointer to DataPacket with the baud rate in arg1
  */
-inline void _init_UART_DMA_rx(size_t size);
+void _negotiate_baudrate(const DataPacket *data);
+
+/**
+ * @brief Add the core commands to the command registry
+ */
+void _register_core_commands();
+
+/**
+ * @brief Decode the received bytes up to a position of the receive ring
+ * @param end Free-running index to stop at
+ */
+void _decode_UART_rx(uint32_t end);
+
+/**
+ * @brief Give the next free segment of the receive ring to the PDC
+ */
+void _chain_UART_rx();
+
+/**
+ * @brief Start a PDC transfer of the transmit ring, if idle and there is data
+ */
+void _start_UART_tx();
 
 /**
  * @brief Send event queue status to host
@@ -115,16 +174,25 @@ void init_uart_comm(void)
 	uart_enable_tx(UART);
 	uart_enable_rx(UART);
 	
-	// Enable DMA for UART transmissions
-	_init_UART_DMA_rx(sizeof(DataPacket));
+	// Enable DMA for UART transmissions; reception fills the first two ring
+	// segments, UART_Handler chains the following ones
+	pdc_packet_t rx_current = {(uint32_t) &rx_ring[0], RX_SEGMENT_SIZE};
+	pdc_packet_t rx_next = {(uint32_t) &rx_ring[RX_SEGMENT_SIZE], RX_SEGMENT_SIZE};
+	Pdc *pdc_uart_p = uart_get_pdc_base(UART);
+	pdc_rx_init(pdc_uart_p, &rx_current, &rx_next);
+	rx_segs_queued = 2;
+	pdc_enable_transfer(pdc_uart_p, PERIPH_PTCR_RXTEN | PERIPH_PTCR_TXTEN);
+	init_decoder(&uart_decoder, HOST_UART);
 	
 	// Enable interrupts
-	uart_enable_interrupt(UART, UART_IER_RXRDY | UART_IER_ENDRX);
+	uart_enable_interrupt(UART, UART_IER_ENDRX);
 	NVIC_EnableIRQ(UART_IRQn);
 	NVIC_SetPriority(UART_IRQn, 2);  // the highest priority is 0
 	
 	// Initialize TC for timeout detection
 	_init_UART_TC();
+	
+	_register_core_commands();
 }
 
 
@@ -135,54 +203,345 @@ void uart_tx(const char *cstring)
 	uart_tx(cstring, strlen(cstring));
 }
 
+void set_host_transport(HostTransport transport)
+{
+	host_transport = transport;
+}
+
 void uart_tx(const char *data, uint32_t len)
 {
-	UartTxMessage * p_uart_msg = new UartTxMessage(data, len);
-	
-	tx_queue.push(p_uart_msg);
-	uart_get_status(UART); // clear pending interrupt flags
+	if (host_transport == HOST_USB && usb_cdc_connected())
+	{
+		uint32_t lost = usb_cdc_tx(data, len);
+		if (lost > 0)
+		{
+			irqflags_t flags = cpu_irq_save();
+				tx_dropped += lost;
+			cpu_irq_restore(flags);
+		}
+		return;
+	}
+
+	// Only the main loop can wait for the ISR to drain the ring
+	bool can_wait = cpu_irq_is_enabled() && __get_IPSR() == 0;
+
+	while (len > 0)
+	{
+		uint32_t n = (len < UART_TX_RING_SIZE) ? len : UART_TX_RING_SIZE;
+		uint32_t start;
+
+		irqflags_t flags = cpu_irq_save();
+			while (UART_TX_RING_SIZE - (tx_reserved - tx_tail) < n)
+			{
+				if (!can_wait)
+				{
+					tx_dropped += len;  // ring full, the rest of the data is lost
+					cpu_irq_restore(flags);
+					return;
+				}
+				cpu_irq_restore(flags);
+				wdt_restart(WDT);  // a long reply takes several watchdog periods to drain
+				flags = cpu_irq_save();
+			}
+			start = tx_reserved;
+			tx_reserved += n;
+			tx_writers++;
+			if (tx_reserved - tx_tail > tx_high_water)
+			{
+				tx_high_water = tx_reserved - tx_tail;
+			}
+		cpu_irq_restore(flags);
+
+		// Copy with interrupts enabled; writers that interrupt this one claim
+		// the space after it and finish first
+		uint32_t ofs = start % UART_TX_RING_SIZE;
+		uint32_t first = (n < UART_TX_RING_SIZE - ofs) ? n : UART_TX_RING_SIZE - ofs;
+		memcpy(&tx_ring[ofs], data, first);
+		memcpy(&tx_ring[0], data + first, n - first);
+
+		flags = cpu_irq_save();
+			// The outermost writer publishes the data of all of them
+			if (--tx_writers == 0)
+			{
+				tx_head = tx_reserved;
+				_start_UART_tx();
+			}
+		cpu_irq_restore(flags);
+
+		data += n;
+		len -= n;
+	}
+}
+
+uint32_t get_uart_tx_high_water()
+{
+	return tx_high_water;
+}
+
+uint32_t get_uart_tx_dropped()
+{
+	return tx_dropped;
+}
+
+/**
+ * @brief Start a PDC transfer of the transmit ring, if idle and there is data
+ * 
+ * A transfer stops at the end of the ring; the part after the wrap goes in
+ * the next transfer. Must be called with interrupts disabled.
+ */
+void _start_UART_tx()
+{
+	if (tx_in_flight > 0)
+	{
+		return;
+	}
+
+	uint32_t ofs = tx_tail % UART_TX_RING_SIZE;
+	uint32_t n = tx_head - tx_tail;
+	if (n > UART_TX_RING_SIZE - ofs)
+	{
+		n = UART_TX_RING_SIZE - ofs;
+	}
+
+	if (n == 0)
+	{
+		uart_disable_interrupt(UART, UART_IDR_ENDTX);
+		return;
+	}
+
+	pdc_packet_t packet = {(uint32_t) &tx_ring[ofs], n};
+	pdc_tx_init(uart_get_pdc_base(UART), &packet, nullptr);
+	tx_in_flight = n;
 	uart_enable_interrupt(UART, UART_IER_ENDTX);
 }
 
 
+/**
+ * @brief Write index of the receive ring (free-running)
+ * 
+ * Must be called with interrupts disabled.
+ */
+static inline uint32_t _rx_head()
+{
+	uint32_t done = rx_segs_done;
+
+	// The PDC may have moved to the next segment before UART_Handler counted it
+	if ((UART->UART_IMR & UART_IMR_ENDRX) && (UART->UART_SR & UART_SR_ENDRX))
+	{
+		done++;
+	}
+	return done * RX_SEGMENT_SIZE + RX_SEGMENT_SIZE - uart_get_pdc_base(UART)->PERIPH_RCR;
+}
+
 void poll_uart()
 {
-	if (rx_buffer_ready)
+	// Switched here rather than in the timeout ISR, which can't wait for the
+	// transmit ring to drain
+	if (fallback_due)
 	{
-		// Parse the content of rx_filled_buffer_p, which contains a DataPacket
-		_parse_UART_command((DataPacket *) rx_filled_buffer_p);
-		rx_buffer_ready = false;
+		_set_baudrate(fallback_baudrate);
+		fallback_baudrate = 0;
+		fallback_due = false;
 	}
+
+	irqflags_t flags = cpu_irq_save();
+		uint32_t head = _rx_head();
+		bool timed_out = rx_break_pending;
+		uint32_t end = rx_break;
+		rx_break_pending = false;
+	cpu_irq_restore(flags);
+
+	if (timed_out)
+	{
+		// Bytes received before the timeout can't complete a packet any more.
+		// The previous poll could have gone past the timeout already.
+		_decode_UART_rx(end);
+		if (rx_tail == end)
+		{
+			reset_decoder(&uart_decoder);
+		}
+	}
+
+	_decode_UART_rx(head);
+
+	// Decoding has freed segments for the PDC
+	flags = cpu_irq_save();
+		_chain_UART_rx();
+	cpu_irq_restore(flags);
+}
+
+uint32_t get_uart_rx_overflows()
+{
+	return rx_overflows;
 }
 
+void _decode_UART_rx(uint32_t end)
+{
+	while ((int32_t) (end - rx_tail) > 0)
+	{
+		// Contiguous part of the ring; the tail advances after decoding, so
+		// the ISR doesn't overwrite the bytes in use
+		uint32_t start = rx_tail % UART_RX_RING_SIZE;
+		uint32_t n = end - rx_tail;
+		if (n > UART_RX_RING_SIZE - start)
+		{
+			n = UART_RX_RING_SIZE - start;
+		}
+		decode_rx_bytes(&uart_decoder, (const uint8_t *) &rx_ring[start], n);
+		rx_tail += n;
+	}
+}
 
 /**
- * @brief Initialize UART DMA receiver with specified buffer size
- * @param size Size of the receive buffer
+ * @brief Give the next free segment of the receive ring to the PDC
  * 
- * Configures PDC for double-buffered reception using two alternating buffers.
- * Swaps between rx_buffer_A and rx_buffer_B for continuous reception.
+ * A segment is free once the decoder has consumed its previous contents.
+ * While there is none, the PDC stops at the end of the current segment, and
+ * UART_Handler counts the lost bytes. Must be called with interrupts disabled.
  */
-inline void _init_UART_DMA_rx(size_t size)
+void _chain_UART_rx()
 {
-	// Configure PDC for double-buffered reception
-	pdc_packet_t pdc_buf;
-	pdc_buf.ul_size = size;
-
-	// Swap buffers
-	if (rx_filled_buffer_p == rx_buffer_A){
-		rx_filled_buffer_p = rx_buffer_B;
-		pdc_buf.ul_addr = (uint32_t) rx_buffer_A;
-	}else{
-		rx_filled_buffer_p = rx_buffer_A;
-		pdc_buf.ul_addr = (uint32_t) rx_buffer_B;
+	Pdc *pdc_uart_p = uart_get_pdc_base(UART);
+
+	while (rx_segs_queued == rx_segs_done + 1)  // nothing chained after the current segment
+	{
+		uint32_t seg = rx_segs_queued;
+		if ((int32_t) (rx_tail - (seg + 1 - UART_RX_SEGMENTS) * RX_SEGMENT_SIZE) < 0)
+		{
+			// Ring full; count the bytes lost once the PDC stops
+			uart_disable_interrupt(UART, UART_IDR_ENDRX);
+			if (!(UART->UART_IMR & UART_IMR_RXRDY))
+			{
+				uart_enable_interrupt(UART, UART_IER_RXBUFF);
+			}
+			return;
+		}
+
+		uint32_t addr = (uint32_t) &rx_ring[(seg % UART_RX_SEGMENTS) * RX_SEGMENT_SIZE];
+		rx_segs_queued++;
+		if (pdc_uart_p->PERIPH_RCR == 0)
+		{
+			// The PDC has stopped at the end of the current segment; restart it
+			rx_segs_done++;
+			pdc_uart_p->PERIPH_RPR = addr;
+			pdc_uart_p->PERIPH_RCR = RX_SEGMENT_SIZE;
+			uart_disable_interrupt(UART, UART_IDR_RXBUFF | UART_IDR_RXRDY);
+		}
+		else
+		{
+			pdc_uart_p->PERIPH_RNPR = addr;
+			pdc_uart_p->PERIPH_RNCR = RX_SEGMENT_SIZE;
+			uart_disable_interrupt(UART, UART_IDR_RXBUFF);
+			uart_enable_interrupt(UART, UART_IER_ENDRX);
+		}
 	}
+}
 
-	Pdc *pdc_uart_p = uart_get_pdc_base(UART);
-	pdc_rx_init(pdc_uart_p, &pdc_buf, NULL);
-	pdc_enable_transfer(pdc_uart_p, PERIPH_PTCR_RXTEN | PERIPH_PTCR_TXTEN);
+
+/**
+ * @brief Communication timeout for a baud rate, in ms
+ * 
+ * The timeout shrinks in proportion to the packet transmission time, but
+ * not below UART_MIN_TIMEOUT, which covers the latency of USB-serial bridges.
+ */
+static inline uint32_t _timeout_ms(uint32_t baudrate)
+{
+	uint32_t timeout_ms = (uint32_t) ((uint64_t) UART_TIMEOUT * UART_BAUDRATE / baudrate);
+	return (timeout_ms > UART_MIN_TIMEOUT) ? timeout_ms : UART_MIN_TIMEOUT;
 }
 
+/**
+ * @brief Communication timeout for a baud rate, in UART TC ticks (MCK/8)
+ */
+static inline uint32_t _timeout_ticks(uint32_t baudrate)
+{
+	return (sysclk_get_peripheral_hz() / 8 / 1000) * _timeout_ms(baudrate);
+}
+
+/**
+ * @brief Clock divisor of the UART baud rate generator
+ * @param baudrate Requested baud rate
+ * @return Divisor (CD) for UART_BRGR, or 0 if the rate can't be generated
+ *         within UART_MAX_BAUD_ERROR
+ */
+static uint32_t _baudrate_divisor(uint32_t baudrate)
+{
+	if (baudrate == 0)
+	{
+		return 0;
+	}
+
+	const uint32_t clk = sysclk_get_peripheral_hz() / 16;  // 16x oversampling
+	uint32_t cd = (clk + baudrate / 2) / baudrate;
+	if (cd == 0 || cd > 0xFFFF)
+	{
+		return 0;
+	}
+
+	uint32_t actual = clk / cd;
+	uint32_t error = (actual > baudrate) ? actual - baudrate : baudrate - actual;
+	if ((uint64_t) error * 100 > (uint64_t) baudrate * UART_MAX_BAUD_ERROR)
+	{
+		return 0;
+	}
+	return cd;
+}
+
+void _set_baudrate(uint32_t baudrate)
+{
+	// Let the pending replies leave at the old rate
+	while (tx_tail != tx_reserved || !(uart_get_status(UART) & UART_SR_TXEMPTY))
+	{
+		wdt_restart(WDT);
+	}
+
+	irqflags_t flags = cpu_irq_save();
+		UART->UART_BRGR = _baudrate_divisor(baudrate);
+		UART->UART_CR = UART_CR_RSTSTA;  // drop framing errors caught while switching
+		tc_write_rc(UART_TC, UART_TC_CH, _timeout_ticks(baudrate));
+		tc_start(UART_TC, UART_TC_CH);
+		uart_baudrate = baudrate;
+	cpu_irq_restore(flags);
+}
+
+/**
+ * @brief Handle the BAU command
+ * 
+ * The rate switch is a two-step handshake. The device replies with the
+ * generated rate at the old rate and switches. The host then switches too and
+ * repeats BAU with the same rate, which the device confirms at the new rate.
+ * Without the confirmation within BAUD_VERIFY_TIMEOUT, the device returns to
+ * the previous rate, so a link that doesn't work at the new rate recovers on
+ * its own.
+ */
+void _negotiate_baudrate(const DataPacket *data)
+{
+	uint32_t baudrate = data->arg1;
+
+	// A BAU received at the new rate proves the link
+	bool confirmation = (fallback_baudrate != 0);
+	fallback_baudrate = 0;
+	fallback_due = false;
+	if (confirmation && baudrate == uart_baudrate)
+	{
+		printf("%lu\n", sysclk_get_peripheral_hz() / 16 / _baudrate_divisor(baudrate));
+		return;
+	}
+
+	uint32_t cd = _baudrate_divisor(baudrate);
+	if (cd == 0)
+	{
+		printf("ERR: baud rate %lu can't be generated within %u%%\n", baudrate, UART_MAX_BAUD_ERROR);
+		return;
+	}
+	printf("%lu\n", sysclk_get_peripheral_hz() / 16 / cd);
+
+	uint32_t previous = uart_baudrate;
+	_set_baudrate(baudrate);
+
+	verify_timeouts_left = BAUD_VERIFY_TIMEOUT / _timeout_ms(baudrate);
+	fallback_baudrate = previous;
+}
 
 /**
  * @brief Initialize UART timer/counter for timeout detection
@@ -199,8 +558,7 @@ void _init_UART_TC(void)
 			TC_CMR_WAVSEL_UP_RC            // Count up to TC_RC
 	);
 	
-	uint32_t rc_value = (sysclk_get_peripheral_hz() / 8 / 1000) * UART_TIMEOUT;
-	tc_write_rc(UART_TC, UART_TC_CH, rc_value);
+	tc_write_rc(UART_TC, UART_TC_CH, _timeout_ticks(UART_BAUDRATE));
 
 	// Enable the interrupt on RC compare
 	tc_enable_interrupt(UART_TC, UART_TC_CH, TC_IER_CPCS);
@@ -221,67 +579,74 @@ void _init_UART_TC(void)
  * @brief Parse and execute UART command from received data packet
  * @param data Pointer to received DataPacket containing the command
  * 
- * Parses the command string in the data packet and executes the corresponding action.
- * Supported commands include PIN, TGL, PPL, NPL, BST, ENP, DSP, GO!, STP, CLR, etc.
- * This function takes approximately 280-360 microseconds to execute.
+ * Looks up the handler of the command in the command registry and executes it.
+ * See the PRF command for the actual cycle counts.
  */
 void _parse_UART_command(const DataPacket *data)
 {
-	if (strncasecmp(data->cmd, "PIN", 3) == 0)
-	{
-		schedule_pin(data);
-	}
-	else if (strncasecmp(data->cmd, "TGL", 3) == 0)
-	{
-		schedule_toggle(data);
-	}
-	else if (strncasecmp(data->cmd, "PPL", 3) == 0)
-	{
-		schedule_pulse(data, true);
-	}
-	else if (strncasecmp(data->cmd, "NPL", 3) == 0)
-	{
-		schedule_pulse(data, false);
-	}
-	else if (strncasecmp(data->cmd, "BST", 3) == 0)
-	{
-		schedule_burst(data);
-	}
-	else if (strncasecmp(data->cmd, "ENP", 3) == 0)
-	{
-		schedule_enable_pin(data);
-	}
-	else if (strncasecmp(data->cmd, "DSP", 3) == 0)
-	{
-		schedule_disable_pin(data);
-	}
-	else if (strncasecmp(data->cmd, "GO!", 3) == 0)
+	PROF_SCOPE(PROF_PARSE_COMMAND);
+
+	if (!dispatch_command(data))
 	{
-		start_sys_timer();
+		printf("ERR: unknown command '%.3s'\n", data->cmd);
 	}
-	else if (strncasecmp(data->cmd, "STP", 3) == 0)
-	{
+}
+
+/**
+ * @brief Register the core commands
+ * 
+ * Supported commands include PIN, TGL, PPL, NPL, BST, ENP, DSP, WFC, WFD, WFG, GO!, ARM, PAU, RSM, STP, CLR, BAU, etc.
+ * Other modules register their own commands, see init_pTIRF(), init_pin_groups(),
+ * init_bursts(), and init_pwm().
+ */
+void _register_core_commands()
+{
+	register_command("PIN", schedule_pin);
+	register_command("TGL", schedule_toggle);
+	register_command("PPL", [](const DataPacket* data) { schedule_pulse(data, true); });
+	register_command("NPL", [](const DataPacket* data) { schedule_pulse(data, false); });
+	register_command("BST", schedule_burst);
+	register_command("ENP", schedule_enable_pin);
+	register_command("DSP", schedule_disable_pin);
+	register_command("WFC", [](const DataPacket* data) { configure_waveform(data->arg1, data->arg2); });
+	register_command("WFD", [](const DataPacket* data) { set_waveform_sample(data->arg1, data->arg2); });
+	register_command("WFG", schedule_waveform);
+	register_command("GO!", [](const DataPacket*) { start_sys_timer(); });
+	register_command("ARM", [](const DataPacket* data) {
+		uint32_t pin_idx = pin_name_to_ioport_id(data->arg1);
+		if (pin_idx != PIN_ID_INVALID)
+		{
+			arm_sys_timer(pin_idx, data->arg2);
+		}
+	});
+	register_command("PAU", [](const DataPacket*) { pause_sys_timer(); });
+	register_command("RSM", [](const DataPacket*) { resume_sys_timer(); });
+	register_command("STP", [](const DataPacket*) {
 		// delete event queue, set all pins low, and stop system timer
-		stop_burst_func(0, 0);
+		stop_bursts();
+		stop_pwm();
+		stop_waveform_func(0, 0);
+		stop_hw_pulses();
 		stop_sys_timer();
-		std::priority_queue<Event>().swap(event_queue);
-			
+		event_queue.clear();
+		
 		init_pins();
-	}
-	else if (strncasecmp(data->cmd, "CLR", 3) == 0)  // delete event queue, set all pins low
-	{
-		stop_burst_func(0, 0);
-		std::priority_queue<Event>().swap(event_queue);
+	});
+	register_command("CLR", [](const DataPacket*) {
+		// delete event queue, set all pins low
+		stop_bursts();
+		stop_pwm();
+		stop_waveform_func(0, 0);
+		stop_hw_pulses();
+		event_queue.clear();
 		
 		init_pins();
-	}
-	else if (strncasecmp(data->cmd, "RST", 3) == 0)
-	{
+	});
+	register_command("RST", [](const DataPacket*) {
 		init_pins();
 		RSTC->RSTC_CR = RSTC_KEY | RSTC_CR_PROCRST;  // processor reset
-	}
-	else if (strncasecmp(data->cmd, "GET", 3) == 0)
-	{
+	});
+	register_command("GET", [](const DataPacket* data) {
 		if (data->arg1 == SysProps::ro_VERSION)
 		{
 			printf("%s\n", VERSION);
@@ -290,69 +655,77 @@ void _parse_UART_command(const DataPacket *data)
 		{
 			printf("%lu\n", get_property((SysProps) data->arg1));
 		}
-	}
-	else if (strncasecmp(data->cmd, "SET", 3) == 0)
-	{
-		set_property((SysProps) data->arg1, data->arg2);
-	}
-	else if (strncasecmp(data->cmd, "STA", 3) == 0)
-	{
+	});
+	register_command("SET", [](const DataPacket* data) { set_property((SysProps) data->arg1, data->arg2); });
+	register_command("STA", [](const DataPacket*) {
 		printf("SYNC DEVICE v%s\n", VERSION);
 		printf("-- SYSTEM STATUS --\n");
 		printf("Event queue size: %lu\n", (uint32_t) event_queue.size());
-		printf("System counter is %s\n", sys_timer_running ? "RUNNING" : "STOPPED");
+		printf("System counter is %s\n", sys_timer_paused ? "PAUSED" :
+		       (sys_timer_running ? "RUNNING" : (sys_timer_armed ? "ARMED" : "STOPPED")));
+		if (sys_timer_gated())
+		{
+			printf("System counter is gated by A13\n");
+		}
 		printf("System time: %f s\n", current_time_s());
-	}
-	else if (strncasecmp(data->cmd, "FUN", 3) == 0)
-	{
-		printf("%lu TGL_PIN\n", (uint32_t) &tgl_pin_event_func);
-		printf("%lu SET_PIN\n", (uint32_t) &set_pin_event_func);
-		printf("%lu BST__ON\n", (uint32_t) &start_burst_func);
-		printf("%lu BST_OFF\n", (uint32_t) &stop_burst_func);
-		printf("%lu EN__PIN\n", (uint32_t) &enable_pin_func);
-		printf("%lu DIS_PIN\n", (uint32_t) &disable_pin_func);
-		printf("%lu OPE_SHU\n", (uint32_t) &open_shutters_func);
-		printf("%lu CLS_SHU\n", (uint32_t) &close_shutters_func);
-	}
-	else if (strncasecmp(data->cmd, "QUE", 3) == 0)
-	{
-		_send_event_queue();
-	}
-	else if (strncasecmp(data->cmd, "CON", 3) == 0)
-	{
-		start_continuous_acq(data);
-	}
-	else if (strncasecmp(data->cmd, "STR", 3) == 0)
-	{
-		start_stroboscopic_acq(data);
-	}
-	else if (strncasecmp(data->cmd, "ALX", 3) == 0)
-	{
-		start_ALEX_acq(data);
-	}
-	else
-	{
-		printf("ERR: unknown command '%.3s'\n", data->cmd);
-	}
+	});
+	register_command("LAT", [](const DataPacket* data) {
+		// dispatch lateness statistics; arg1 = 1 resets them
+		send_latency_stats();
+		if (data->arg1 == 1)
+		{
+			reset_latency_stats();
+		}
+	});
+	register_command("PRF", [](const DataPacket* data) {
+		// cycle counts of ISRs and event functions; arg1 = 1 resets them
+		send_profile();
+		if (data->arg1 == 1)
+		{
+			reset_profiler();
+		}
+	});
+	register_command("TRC", [](const DataPacket* data) {
+		// stream the execution trace; arg1 = 1 clears it instead
+		if (data->arg1 == 1)
+		{
+			clear_trace();
+		}
+		else
+		{
+			send_trace();
+		}
+	});
+	register_command("QUE", [](const DataPacket*) { _send_event_queue(); });
+	register_command("BAU", _negotiate_baudrate);
 }
 
 /**
  * @brief Send event queue status to host
  * 
  * Sends the current event queue contents to the host via UART.
- * Each event in the queue is transmitted as a binary Event structure.
+ * The 64-bit timestamp base goes first, followed by every event in the
+ * queue as a binary Event structure. Events are sent in the queue storage
+ * order, not sorted by timestamp.
  */
 void _send_event_queue()
 {
 	Event event;
-	std::priority_queue<Event> event_queue_copy = event_queue;
 
-	while (!event_queue_copy.empty())
+	// The base only moves in rebase_event_queue(), called from the main loop as we are
+	uart_tx((char *) &event_ts_base, sizeof(event_ts_base));
+
+	for (size_t i = 0; i < event_queue.capacity(); i++)
 	{
-		event = event_queue_copy.top();
+		// Block the event interrupt only while copying a single event
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IDR = TC_IDR_CPAS;
+		bool valid = event_queue.at(i, &event);
+		SYS_TC->TC_CHANNEL[SYS_TC_CH].TC_IER = TC_IER_CPAS;
 
-		event_queue_copy.pop();
-		uart_tx((char *) &event, sizeof(Event));
+		if (valid)
+		{
+			uart_tx((char *) &event, sizeof(Event));
+		}
 	}
 }
 
@@ -363,16 +736,35 @@ void _send_event_queue()
 /**
  * @brief UART timeout interrupt handler
  * 
- * Handles UART communication timeout by resetting the receiver buffer.
- * This prevents the system from hanging if communication is interrupted.
+ * Runs periodically. If nothing has been received since the previous run,
+ * marks the position of the timeout in the receive ring, so poll_uart() drops
+ * the partial packet. This prevents the system from hanging if communication
+ * is interrupted.
+ * Also tells poll_uart() to return to the previous baud rate if the host
+ * hasn't confirmed the new one in time.
  */
 void UART_TIMEOUT_Handler(void)
 {
 	uint32_t status = tc_get_status(UART_TC, UART_TC_CH);
 	
-	if (status & TC_SR_CPCS) // Communication timeout
+	if (status & TC_SR_CPCS)
 	{
-		_init_UART_DMA_rx(sizeof(DataPacket)); // Reset the receiver buffer
+		irqflags_t flags = cpu_irq_save();
+			uint32_t head = _rx_head();
+		cpu_irq_restore(flags);
+
+		// Communication timeout: nothing received for a whole period
+		if (head == rx_idle_head)
+		{
+			rx_break = head;
+			rx_break_pending = true;
+		}
+		rx_idle_head = head;
+
+		if (fallback_baudrate && !fallback_due && --verify_timeouts_left == 0)
+		{
+			fallback_due = true;
+		}
 	}
 }
 
@@ -381,43 +773,46 @@ void UART_TIMEOUT_Handler(void)
  * @brief UART interrupt handler
  * 
  * Handles UART interrupts for both reception and transmission.
- * Resets the timeout timer on character arrival and processes completed DMA transfers.
+ * Chains the receive ring segments for the PDC, counts the bytes lost while
+ * the ring is full, and processes completed DMA transfers.
  */
 void UART_Handler(void)
 {
+	PROF_SCOPE(PROF_UART_ISR);
+
 	uint32_t status = uart_get_status(UART);
-	// A character arrived - reset the timer for communication timeout
-	tc_start(UART_TC, UART_TC_CH);
+	uint32_t pending = status & UART->UART_IMR;  // PDC flags stay set while masked
 	
-	// Check if the PDC reception is complete - happens ~120us after end of transmission
-	if (status & UART_SR_ENDRX)
+	// The PDC has moved on to the next segment of the receive ring
+	if (pending & UART_SR_ENDRX)
 	{
-		// tell the main event loop to process rx_filled_buffer_p
-		rx_buffer_ready = true;
-		
-		// Swap DMA buffers and get ready for the next reception
-		_init_UART_DMA_rx(sizeof(DataPacket));
+		rx_segs_done++;
+		_chain_UART_rx();
 	}
 	
-	// Check if the PDC transmission is complete
-	if (status & UART_SR_ENDTX)
+	// The PDC has stopped with the receive ring full
+	if (pending & UART_SR_RXBUFF)
 	{
-		if (!tx_queue.empty()) // there is pending data transfer
-		{
-			UartTxMessage* p_uart_msg = tx_queue.front();
-			if (p_uart_msg->is_transmitted)
-			{
-				delete p_uart_msg; // free memory
-				tx_queue.pop();    // remove message from the queue
-			}
-			else
-			{
-				p_uart_msg->transmit();
-			}
-		}
-		else
+		uart_disable_interrupt(UART, UART_IDR_RXBUFF);
+		uart_enable_interrupt(UART, UART_IER_RXRDY);
+	}
+	
+	if (pending & UART_SR_RXRDY)
+	{
+		(void) UART->UART_RHR;
+		rx_overflows++;
+		if (status & UART_SR_OVRE)  // at least one more byte was lost
 		{
-			uart_disable_interrupt(UART, UART_IDR_ENDTX);
+			rx_overflows++;
+			UART->UART_CR = UART_CR_RSTSTA;
 		}
 	}
+	
+	// Check if the PDC transmission is complete
+	if (pending & UART_SR_ENDTX)
+	{
+		tx_tail += tx_in_flight;
+		tx_in_flight = 0;
+		_start_UART_tx();  // the rest of the ring, if any
+	}
 }
\ No newline at end of file
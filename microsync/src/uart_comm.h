@@ -20,8 +20,6 @@
 #undef max
 #endif
 
-#include <queue>          // priority queue, FIFO queue
-
 #ifndef UNIT_TEST
 #include <asf.h>
 #include <string.h>
@@ -46,6 +44,15 @@ typedef struct DataPacket
 	uint32_t interv_us; /**< Interval between command executions in microseconds */
 } DataPacket;
 
+/**
+ * @brief Links the host can send commands through.
+ */
+typedef enum HostTransport
+{
+	HOST_UART = 0,  /**< UART through the programming port */
+	HOST_USB,       /**< Native USB port (CDC) */
+} HostTransport;
+
 /**
  * @brief Initialize UART communication interface.
  * 
@@ -67,14 +74,58 @@ void uart_tx(const char *cstring);
  * @param data Pointer to the data buffer to send
  * @param len Length of the data buffer in bytes
  * 
- * Sends the specified number of bytes using DMA for efficient transmission.
+ * Copies the data to the transmit ring, which the PDC drains in the
+ * background; nothing is allocated. Waits for space if the ring is full,
+ * except in interrupt handlers and with interrupts disabled, where the data
+ * that doesn't fit is dropped. Data of one call is sent contiguously unless
+ * it's larger than UART_TX_RING_SIZE.
  */
 void uart_tx(const char *data, uint32_t len);
 
+/**
+ * @brief Select the link that replies and messages are sent through.
+ * @param transport Link the command being executed came from
+ *
+ * Called by the stream decoder before every command, so replies go back the
+ * way the command came, and messages of interrupt handlers follow the last
+ * command. Replies to USB fall back to the UART when the USB port is closed.
+ */
+void set_host_transport(HostTransport transport);
+
 /**
  * @brief Poll for received UART data and process commands.
  * 
- * Checks for received data packets and processes any pending commands.
+ * Decodes all bytes the PDC has written to the receive ring since the last
+ * call and executes the complete commands, however many there are.
  * This function should be called regularly to handle incoming communication.
  */
 void poll_uart();
+
+/**
+ * @brief Get the number of received bytes lost because the receive ring was full.
+ * @return Number of lost bytes since reset
+ */
+uint32_t get_uart_rx_overflows();
+
+/**
+ * @brief Get the largest number of bytes waiting in the transmit ring.
+ * @return High-water mark of the transmit ring since reset, in bytes
+ */
+uint32_t get_uart_tx_high_water();
+
+/**
+ * @brief Get the number of reply bytes lost because the transmit ring was full.
+ * @return Number of lost bytes since reset
+ *
+ * Only output from interrupt handlers is dropped; the main loop waits for
+ * space. Replies lost on the native USB port are counted too.
+ */
+uint32_t get_uart_tx_dropped();
+
+/**
+ * @brief Parse and execute a command from a received data packet.
+ * @param data Pointer to received DataPacket
+ *
+ * Shared by the UART and the native USB transport.
+ */
+void _parse_UART_command(const DataPacket *data);
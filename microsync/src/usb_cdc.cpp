@@ -0,0 +1,705 @@
+/*
+ * usb_cdc.cpp
+ *
+ * CDC-ACM serial transport on the native USB port
+ */
+
+#include "usb_cdc.h"
+#include "framing.h"
+
+/************************************************************************/
+/*                 USB DEFINITIONS                                      */
+/************************************************************************/
+
+#define EP_CTRL      0
+#define EP_DATA_IN   1  // bulk, device to host
+#define EP_DATA_OUT  2  // bulk, host to device
+#define EP_NOTIFY    3  // interrupt; serial state notifications are never sent
+
+// Every endpoint has its own 32 KB window into the DPRAM FIFO
+#define EP_FIFO(ep)  ((volatile uint8_t*) (UOTGHS_RAM_ADDR + 0x8000UL * (ep)))
+
+#define REQ_TYPE_MASK         0x60
+#define REQ_TYPE_STANDARD     0x00
+#define REQ_TYPE_CLASS        0x20
+#define REQ_RECIPIENT_EP      0x02
+
+#define REQ_GET_STATUS        0x00
+#define REQ_CLEAR_FEATURE     0x01
+#define REQ_SET_FEATURE       0x03
+#define REQ_SET_ADDRESS       0x05
+#define REQ_GET_DESCRIPTOR    0x06
+#define REQ_GET_CONFIGURATION 0x08
+#define REQ_SET_CONFIGURATION 0x09
+#define REQ_GET_INTERFACE     0x0A
+#define REQ_SET_INTERFACE     0x0B
+
+#define CDC_SET_LINE_CODING        0x20
+#define CDC_GET_LINE_CODING        0x21
+#define CDC_SET_CONTROL_LINE_STATE 0x22
+#define CDC_DTR                    0x01
+
+#define DESC_DEVICE           1
+#define DESC_CONFIGURATION    2
+#define DESC_STRING           3
+#define DESC_QUALIFIER        6
+#define DESC_OTHER_SPEED      7
+
+typedef struct __attribute__((packed)) {
+	uint8_t  bmRequestType;
+	uint8_t  bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+} UsbSetup;
+
+
+/************************************************************************/
+/*                 DESCRIPTORS                                          */
+/************************************************************************/
+
+static const uint8_t device_desc[] = {
+	18, DESC_DEVICE, 0x00, 0x02,  // USB 2.0
+	0x02, 0x00, 0x00,             // CDC device class
+	USB_EP0_SIZE,
+	USB_VID & 0xFF, USB_VID >> 8,
+	USB_PID & 0xFF, USB_PID >> 8,
+	0x00, 0x01,                   // device release 1.00
+	1, 2, 0,                      // manufacturer and product strings, no serial number
+	1,                            // one configuration
+};
+
+static const uint8_t qualifier_desc[] = {
+	10, DESC_QUALIFIER, 0x00, 0x02,
+	0x02, 0x00, 0x00,
+	USB_EP0_SIZE,
+	1, 0,
+};
+
+// Bulk packet sizes and the notification interval depend on the bus speed
+#define CFG_NOTIFY_INTERVAL  43
+#define CFG_IN_SIZE          57
+#define CFG_OUT_SIZE         64
+
+static const uint8_t config_desc[] = {
+	9, DESC_CONFIGURATION, 67, 0,
+	2, 1, 0,                      // two interfaces, configuration 1
+	0x80, 250,                    // bus powered, 500 mA
+	// Communication interface
+	9, 4, 0, 0, 1, 0x02, 0x02, 0x00, 0,
+	5, 0x24, 0x00, 0x10, 0x01,    // header, CDC 1.10
+	5, 0x24, 0x01, 0x00, 1,       // call management, data interface 1
+	4, 0x24, 0x02, 0x02,          // ACM, line coding and control line state
+	5, 0x24, 0x06, 0, 1,          // union of interfaces 0 and 1
+	7, 5, 0x80 | EP_NOTIFY, 0x03, 16, 0, 0,
+	// Data interface
+	9, 4, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+	7, 5, 0x80 | EP_DATA_IN, 0x02, 0, 0, 0,
+	7, 5, EP_DATA_OUT, 0x02, 0, 0, 0,
+};
+
+static const char* const strings[] = {
+	nullptr,  // language IDs
+	"St. Jude Children's Research Hospital",
+	"Sync Device",
+};
+
+
+/************************************************************************/
+/*                 DEVICE STATE                                         */
+/************************************************************************/
+
+static volatile uint8_t configuration = 0;
+static volatile bool dtr = false;
+static volatile bool suspended = false;
+static volatile bool greeting_pending = false;  // the host has just opened the port
+static uint32_t bulk_size = 64;
+
+// 115200 8N1; only stored for the host, the USB transfer rate doesn't depend on it
+static uint8_t line_coding[7] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8};
+
+static StreamDecoder usb_decoder;
+static uint32_t rx_frame = 0;  // frame number of the last received data
+
+// Bytes waiting for the bulk IN endpoint, claimed and published like the
+// UART transmit ring (see uart_tx()) and drained by the USB interrupt
+static uint8_t tx_ring[USB_TX_RING_SIZE];
+static volatile uint32_t tx_reserved = 0;  // free-running index up to which writers claimed space
+static volatile uint32_t tx_head = 0;      // free-running index up to which the data is complete
+static volatile uint32_t tx_tail = 0;      // free-running index of the first byte not sent yet
+static volatile uint32_t tx_writers = 0;   // writers copying to tx_ring
+
+enum Ep0Stage : uint8_t {
+	EP0_SETUP,       // waiting for a SETUP packet
+	EP0_DATA_IN,     // sending the data stage
+	EP0_DATA_OUT,    // waiting for the data stage
+	EP0_STATUS_IN,   // sending the ZLP of the status stage
+	EP0_STATUS_OUT,  // waiting for the ZLP of the status stage
+	EP0_ADDRESS,     // waiting for the status stage of SET_ADDRESS to complete
+};
+
+static uint8_t  ep0_stage = EP0_SETUP;
+static uint8_t  ep0_buf[96];        // data stage IN; the longest descriptor is the manufacturer string
+static uint32_t ep0_pos = 0;        // bytes of ep0_buf sent
+static uint32_t ep0_len = 0;        // bytes of ep0_buf to send
+static bool     ep0_zlp = false;    // a full last packet is followed by a ZLP
+static uint8_t* ep0_rx = nullptr;   // destination of the data stage OUT
+static uint32_t ep0_rx_size = 0;
+static bool     ep0_set_address = false;
+
+
+static inline uint32_t _frame()
+{
+	return (UOTGHS->UOTGHS_DEVFNUM & UOTGHS_DEVFNUM_FNUM_Msk) >> UOTGHS_DEVFNUM_FNUM_Pos;
+}
+
+// Milliseconds (frames) elapsed since a frame number; the counter is 11-bit
+static inline uint32_t _frames_since(uint32_t frame)
+{
+	return (_frame() - frame) & (UOTGHS_DEVFNUM_FNUM_Msk >> UOTGHS_DEVFNUM_FNUM_Pos);
+}
+
+
+/************************************************************************/
+/*                 CONTROL ENDPOINT                                     */
+/************************************************************************/
+
+// Control transfers are driven by the endpoint interrupts one packet at a
+// time, so the USB interrupt never waits for the host. A new SETUP packet or
+// a bus reset aborts the transfer in progress.
+
+static void _ep0_stall()
+{
+	UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_STALLRQS;
+}
+
+// Status stage IN of a request without a data stage or with a data stage OUT
+static void _ep0_send_zlp()
+{
+	ep0_stage = EP0_STATUS_IN;
+	UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_TXINES;
+}
+
+// Data stage IN, followed by the status stage OUT
+static void _ep0_send(const UsbSetup* req, const uint8_t* data, uint32_t len)
+{
+	if (len > sizeof(ep0_buf))
+	{
+		len = sizeof(ep0_buf);
+	}
+	// A shorter reply than requested ends with a short packet, a ZLP if needed
+	ep0_zlp = (len < req->wLength) && (len % USB_EP0_SIZE == 0);
+	if (len > req->wLength)
+	{
+		len = req->wLength;
+	}
+
+	memcpy(ep0_buf, data, len);
+	ep0_pos = 0;
+	ep0_len = len;
+	ep0_stage = EP0_DATA_IN;
+	UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_TXINES;
+}
+
+// Data stage OUT, followed by the status stage IN
+static void _ep0_receive(uint8_t* data, uint32_t len)
+{
+	ep0_rx = data;
+	ep0_rx_size = len;
+	ep0_stage = EP0_DATA_OUT;
+	UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_RXOUTES;
+}
+
+// The IN bank of the control endpoint is free
+static void _ep0_in()
+{
+	if (ep0_stage == EP0_DATA_IN)
+	{
+		uint32_t n = ep0_len - ep0_pos;
+		if (n > USB_EP0_SIZE)
+		{
+			n = USB_EP0_SIZE;
+		}
+		volatile uint8_t* fifo = EP_FIFO(EP_CTRL);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			fifo[i] = ep0_buf[ep0_pos + i];
+		}
+		ep0_pos += n;
+		UOTGHS->UOTGHS_DEVEPTICR[EP_CTRL] = UOTGHS_DEVEPTICR_TXINIC;
+
+		if (ep0_pos == ep0_len && (n < USB_EP0_SIZE || !ep0_zlp))
+		{
+			ep0_stage = EP0_STATUS_OUT;
+			UOTGHS->UOTGHS_DEVEPTIDR[EP_CTRL] = UOTGHS_DEVEPTIDR_TXINEC;
+			UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_RXOUTES;
+		}
+		return;
+	}
+
+	if (ep0_stage == EP0_STATUS_IN)
+	{
+		UOTGHS->UOTGHS_DEVEPTICR[EP_CTRL] = UOTGHS_DEVEPTICR_TXINIC;  // send the ZLP
+		if (ep0_set_address)
+		{
+			ep0_stage = EP0_ADDRESS;  // the bank is free again once the ZLP is acknowledged
+			return;
+		}
+	}
+	else if (ep0_stage == EP0_ADDRESS)
+	{
+		// The new address is enabled only after the status stage is complete
+		UOTGHS->UOTGHS_DEVCTRL |= UOTGHS_DEVCTRL_ADDEN;
+		ep0_set_address = false;
+	}
+	ep0_stage = EP0_SETUP;
+	UOTGHS->UOTGHS_DEVEPTIDR[EP_CTRL] = UOTGHS_DEVEPTIDR_TXINEC;
+}
+
+// An OUT packet has arrived on the control endpoint
+static void _ep0_out()
+{
+	UOTGHS->UOTGHS_DEVEPTIDR[EP_CTRL] = UOTGHS_DEVEPTIDR_RXOUTEC;
+
+	if (ep0_stage == EP0_DATA_OUT)
+	{
+		uint32_t n = (UOTGHS->UOTGHS_DEVEPTISR[EP_CTRL] & UOTGHS_DEVEPTISR_BYCT_Msk) >> UOTGHS_DEVEPTISR_BYCT_Pos;
+		volatile uint8_t* fifo = EP_FIFO(EP_CTRL);
+		for (uint32_t i = 0; i < n && i < ep0_rx_size; i++)
+		{
+			ep0_rx[i] = fifo[i];
+		}
+		UOTGHS->UOTGHS_DEVEPTICR[EP_CTRL] = UOTGHS_DEVEPTICR_RXOUTIC;
+		_ep0_send_zlp();
+		return;
+	}
+
+	// Status stage OUT
+	UOTGHS->UOTGHS_DEVEPTICR[EP_CTRL] = UOTGHS_DEVEPTICR_RXOUTIC;
+	UOTGHS->UOTGHS_DEVEPTIDR[EP_CTRL] = UOTGHS_DEVEPTIDR_TXINEC;
+	ep0_stage = EP0_SETUP;
+}
+
+static void _send_config_desc(const UsbSetup* req, bool high_speed, uint8_t type)
+{
+	uint8_t desc[sizeof(config_desc)];
+	memcpy(desc, config_desc, sizeof(desc));
+
+	uint32_t size = high_speed ? 512 : 64;
+	desc[1] = type;
+	desc[CFG_NOTIFY_INTERVAL] = high_speed ? 8 : 16;  // 16 ms: 2^(8-1) microframes or 16 frames
+	desc[CFG_IN_SIZE] = desc[CFG_OUT_SIZE] = size & 0xFF;
+	desc[CFG_IN_SIZE + 1] = desc[CFG_OUT_SIZE + 1] = size >> 8;
+	_ep0_send(req, desc, sizeof(desc));
+}
+
+static void _send_string_desc(const UsbSetup* req, uint32_t idx)
+{
+	uint8_t desc[2 + 2 * 40];
+	uint32_t len = 2;
+
+	if (idx == 0)
+	{
+		desc[len++] = 0x09;  // English (US)
+		desc[len++] = 0x04;
+	}
+	else
+	{
+		for (const char* c = strings[idx]; *c && len < sizeof(desc); c++)
+		{
+			desc[len++] = *c;  // UTF-16LE
+			desc[len++] = 0;
+		}
+	}
+	desc[0] = len;
+	desc[1] = DESC_STRING;
+	_ep0_send(req, desc, len);
+}
+
+static void _get_descriptor(const UsbSetup* req)
+{
+	bool high_speed = (UOTGHS->UOTGHS_SR & UOTGHS_SR_SPEED_Msk) == UOTGHS_SR_SPEED_HIGH_SPEED;
+	uint32_t idx = req->wValue & 0xFF;
+
+	switch (req->wValue >> 8)
+	{
+		case DESC_DEVICE:
+			_ep0_send(req, device_desc, sizeof(device_desc));
+			break;
+		case DESC_CONFIGURATION:
+			_send_config_desc(req, high_speed, DESC_CONFIGURATION);
+			break;
+		case DESC_OTHER_SPEED:
+			_send_config_desc(req, !high_speed, DESC_OTHER_SPEED);
+			break;
+		case DESC_QUALIFIER:
+			_ep0_send(req, qualifier_desc, sizeof(qualifier_desc));
+			break;
+		case DESC_STRING:
+			if (idx < sizeof(strings) / sizeof(strings[0]))
+			{
+				_send_string_desc(req, idx);
+				break;
+			}
+			// fall through
+		default:
+			_ep0_stall();
+	}
+}
+
+// Release the data endpoints; DPRAM is freed in the reverse order of allocation
+static void _release_data_endpoints()
+{
+	UOTGHS->UOTGHS_DEVIDR = UOTGHS_DEVIDR_PEP_0 << EP_DATA_IN;
+	tx_tail = tx_head;  // nobody reads the rest
+
+	for (uint32_t ep = EP_NOTIFY; ep >= EP_DATA_IN; ep--)
+	{
+		UOTGHS->UOTGHS_DEVEPT &= ~(UOTGHS_DEVEPT_EPEN0 << ep);
+		UOTGHS->UOTGHS_DEVEPTCFG[ep] &= ~UOTGHS_DEVEPTCFG_ALLOC;
+	}
+}
+
+static void _configure_data_endpoints()
+{
+	bool high_speed = (UOTGHS->UOTGHS_SR & UOTGHS_SR_SPEED_Msk) == UOTGHS_SR_SPEED_HIGH_SPEED;
+	uint32_t size = high_speed ? UOTGHS_DEVEPTCFG_EPSIZE_512_BYTE : UOTGHS_DEVEPTCFG_EPSIZE_64_BYTE;
+	bulk_size = high_speed ? 512 : 64;
+
+	_release_data_endpoints();
+	UOTGHS->UOTGHS_DEVEPTCFG[EP_DATA_IN] = size | UOTGHS_DEVEPTCFG_EPDIR |
+		UOTGHS_DEVEPTCFG_EPTYPE_BLK | UOTGHS_DEVEPTCFG_EPBK_2_BANK | UOTGHS_DEVEPTCFG_ALLOC;
+	UOTGHS->UOTGHS_DEVEPTCFG[EP_DATA_OUT] = size |
+		UOTGHS_DEVEPTCFG_EPTYPE_BLK | UOTGHS_DEVEPTCFG_EPBK_2_BANK | UOTGHS_DEVEPTCFG_ALLOC;
+	UOTGHS->UOTGHS_DEVEPTCFG[EP_NOTIFY] = UOTGHS_DEVEPTCFG_EPSIZE_16_BYTE | UOTGHS_DEVEPTCFG_EPDIR |
+		UOTGHS_DEVEPTCFG_EPTYPE_INTRPT | UOTGHS_DEVEPTCFG_EPBK_1_BANK | UOTGHS_DEVEPTCFG_ALLOC;
+	UOTGHS->UOTGHS_DEVEPT |= (UOTGHS_DEVEPT_EPEN0 << EP_DATA_IN) |
+		(UOTGHS_DEVEPT_EPEN0 << EP_DATA_OUT) | (UOTGHS_DEVEPT_EPEN0 << EP_NOTIFY);
+	UOTGHS->UOTGHS_DEVIER = UOTGHS_DEVIER_PEP_0 << EP_DATA_IN;  // TXINE is set while tx_ring has data
+}
+
+static void _configure_ep0()
+{
+	UOTGHS->UOTGHS_DEVEPTCFG[EP_CTRL] = UOTGHS_DEVEPTCFG_EPSIZE_64_BYTE |
+		UOTGHS_DEVEPTCFG_EPTYPE_CTRL | UOTGHS_DEVEPTCFG_EPBK_1_BANK | UOTGHS_DEVEPTCFG_ALLOC;
+	UOTGHS->UOTGHS_DEVEPT |= UOTGHS_DEVEPT_EPEN0;
+	UOTGHS->UOTGHS_DEVEPTIER[EP_CTRL] = UOTGHS_DEVEPTIER_RXSTPES;
+	UOTGHS->UOTGHS_DEVIER = UOTGHS_DEVIER_PEP_0;
+	ep0_stage = EP0_SETUP;
+	ep0_set_address = false;
+}
+
+static void _handle_setup()
+{
+	UsbSetup req;
+	volatile uint8_t* fifo = EP_FIFO(EP_CTRL);
+	for (uint32_t i = 0; i < sizeof(req); i++)
+	{
+		((uint8_t*) &req)[i] = fifo[i];
+	}
+	UOTGHS->UOTGHS_DEVEPTICR[EP_CTRL] = UOTGHS_DEVEPTICR_RXSTPIC;
+
+	// Abort the previous transfer
+	UOTGHS->UOTGHS_DEVEPTIDR[EP_CTRL] = UOTGHS_DEVEPTIDR_TXINEC | UOTGHS_DEVEPTIDR_RXOUTEC;
+	ep0_stage = EP0_SETUP;
+	ep0_set_address = false;
+
+	if ((req.bmRequestType & REQ_TYPE_MASK) == REQ_TYPE_CLASS)
+	{
+		switch (req.bRequest)
+		{
+			case CDC_SET_LINE_CODING:
+				_ep0_receive(line_coding, sizeof(line_coding));
+				break;
+			case CDC_GET_LINE_CODING:
+				_ep0_send(&req, line_coding, sizeof(line_coding));
+				break;
+			case CDC_SET_CONTROL_LINE_STATE:
+				if ((req.wValue & CDC_DTR) && !dtr)
+				{
+					tx_tail = tx_head;  // left over from the previous session
+					greeting_pending = true;
+				}
+				dtr = req.wValue & CDC_DTR;
+				_ep0_send_zlp();
+				break;
+			default:
+				_ep0_stall();
+		}
+		return;
+	}
+
+	if ((req.bmRequestType & REQ_TYPE_MASK) != REQ_TYPE_STANDARD)
+	{
+		_ep0_stall();
+		return;
+	}
+
+	static const uint8_t zero[2] = {0, 0};
+	switch (req.bRequest)
+	{
+		case REQ_GET_STATUS:
+			_ep0_send(&req, zero, 2);
+			break;
+		case REQ_CLEAR_FEATURE:
+			if ((req.bmRequestType & 0x1F) == REQ_RECIPIENT_EP)
+			{
+				uint32_t ep = req.wIndex & 0x0F;
+				UOTGHS->UOTGHS_DEVEPTIDR[ep] = UOTGHS_DEVEPTIDR_STALLRQC;
+				UOTGHS->UOTGHS_DEVEPTIER[ep] = UOTGHS_DEVEPTIER_RSTDTS;  // halt cleared, DATA0 next
+			}
+			_ep0_send_zlp();
+			break;
+		case REQ_SET_FEATURE:
+			_ep0_send_zlp();
+			break;
+		case REQ_SET_ADDRESS:
+			UOTGHS->UOTGHS_DEVCTRL = (UOTGHS->UOTGHS_DEVCTRL & ~UOTGHS_DEVCTRL_UADD_Msk) |
+			                         UOTGHS_DEVCTRL_UADD(req.wValue & 0x7F);
+			ep0_set_address = true;  // enabled by _ep0_in()
+			_ep0_send_zlp();
+			break;
+		case REQ_GET_DESCRIPTOR:
+			_get_descriptor(&req);
+			break;
+		case REQ_GET_CONFIGURATION:
+			_ep0_send(&req, (const uint8_t*) &configuration, 1);
+			break;
+		case REQ_SET_CONFIGURATION:
+			if ((req.wValue & 0xFF) > 1)
+			{
+				_ep0_stall();
+				break;
+			}
+			configuration = req.wValue & 0xFF;
+			if (configuration)
+			{
+				_configure_data_endpoints();
+			}
+			else
+			{
+				_release_data_endpoints();
+				dtr = false;
+			}
+			_ep0_send_zlp();
+			break;
+		case REQ_GET_INTERFACE:
+			_ep0_send(&req, zero, 1);
+			break;
+		case REQ_SET_INTERFACE:
+			_ep0_send_zlp();
+			break;
+		default:
+			_ep0_stall();
+	}
+}
+
+
+/************************************************************************/
+/*                 TRANSPORT                                            */
+/************************************************************************/
+
+void init_usb_cdc()
+{
+	init_decoder(&usb_decoder, HOST_USB);
+	sysclk_enable_usb();  // 480 MHz UPLL for the UTMI transceiver
+	sysclk_enable_peripheral_clock(ID_UOTGHS);
+
+	// Device mode regardless of the ID pin, pad and clock enabled
+	UOTGHS->UOTGHS_CTRL = UOTGHS_CTRL_UIMOD | UOTGHS_CTRL_OTGPADE | UOTGHS_CTRL_USBE;
+	while (!(UOTGHS->UOTGHS_SR & UOTGHS_SR_CLKUSABLE));
+
+	UOTGHS->UOTGHS_DEVCTRL = UOTGHS_DEVCTRL_SPDCONF_NORMAL | UOTGHS_DEVCTRL_DETACH;
+	UOTGHS->UOTGHS_DEVIER = UOTGHS_DEVIER_EORSTES | UOTGHS_DEVIER_SUSPES | UOTGHS_DEVIER_WAKEUPES;
+
+	NVIC_EnableIRQ(UOTGHS_IRQn);
+	NVIC_SetPriority(UOTGHS_IRQn, 14);  // enumeration only, below every timing-related interrupt
+
+	UOTGHS->UOTGHS_DEVCTRL &= ~UOTGHS_DEVCTRL_DETACH;
+}
+
+bool usb_cdc_connected()
+{
+	return configuration && dtr && !suspended;
+}
+
+uint32_t usb_cdc_tx(const char* data, uint32_t len)
+{
+	// Only the main loop can wait for the USB interrupt to drain the ring
+	bool can_wait = cpu_irq_is_enabled() && __get_IPSR() == 0;
+	uint32_t start_frame = _frame();
+
+	while (len > 0)
+	{
+		uint32_t n = (len < USB_TX_RING_SIZE) ? len : USB_TX_RING_SIZE;
+		uint32_t start;
+
+		irqflags_t flags = cpu_irq_save();
+			while (USB_TX_RING_SIZE - (tx_reserved - tx_tail) < n)
+			{
+				cpu_irq_restore(flags);
+				if (!can_wait || !usb_cdc_connected() || _frames_since(start_frame) > USB_TX_TIMEOUT)
+				{
+					return len;  // the rest of the data is lost
+				}
+				flags = cpu_irq_save();
+			}
+			start = tx_reserved;
+			tx_reserved += n;
+			tx_writers++;
+		cpu_irq_restore(flags);
+
+		// Copy with interrupts enabled; writers that interrupt this one claim
+		// the space after it and finish first
+		uint32_t ofs = start % USB_TX_RING_SIZE;
+		uint32_t first = (n < USB_TX_RING_SIZE - ofs) ? n : USB_TX_RING_SIZE - ofs;
+		memcpy(&tx_ring[ofs], data, first);
+		memcpy(&tx_ring[0], data + first, n - first);
+
+		flags = cpu_irq_save();
+			// The outermost writer publishes the data of all of them
+			if (--tx_writers == 0)
+			{
+				tx_head = tx_reserved;
+				UOTGHS->UOTGHS_DEVEPTIER[EP_DATA_IN] = UOTGHS_DEVEPTIER_TXINES;
+			}
+		cpu_irq_restore(flags);
+
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Move the published data of the transmit ring to the free IN banks
+ *
+ * Called from the USB interrupt when a bank is free. The interrupt is
+ * disabled while the ring is empty.
+ */
+static void _drain_usb_tx()
+{
+	while (UOTGHS->UOTGHS_DEVEPTISR[EP_DATA_IN] & UOTGHS_DEVEPTISR_TXINI)
+	{
+		uint32_t n = tx_head - tx_tail;
+		if (n == 0)
+		{
+			UOTGHS->UOTGHS_DEVEPTIDR[EP_DATA_IN] = UOTGHS_DEVEPTIDR_TXINEC;
+			return;
+		}
+		if (n > bulk_size)
+		{
+			n = bulk_size;
+		}
+
+		volatile uint8_t* fifo = EP_FIFO(EP_DATA_IN);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			fifo[i] = tx_ring[(tx_tail + i) % USB_TX_RING_SIZE];
+		}
+		tx_tail += n;
+		UOTGHS->UOTGHS_DEVEPTICR[EP_DATA_IN] = UOTGHS_DEVEPTICR_TXINIC;
+		UOTGHS->UOTGHS_DEVEPTIDR[EP_DATA_IN] = UOTGHS_DEVEPTIDR_FIFOCONC;  // send the bank
+	}
+}
+
+void poll_usb()
+{
+	if (!configuration)
+	{
+		return;
+	}
+
+	if (greeting_pending)
+	{
+		greeting_pending = false;
+		set_host_transport(HOST_USB);  // the host that opened the port waits for it
+		printf("Sync device is ready. Firmware version: %s\n", VERSION);
+	}
+
+	uint32_t status = UOTGHS->UOTGHS_DEVEPTISR[EP_DATA_OUT];
+	if (!(status & UOTGHS_DEVEPTISR_RXOUTI))
+	{
+		if (_frames_since(rx_frame) > UART_TIMEOUT)
+		{
+			reset_decoder(&usb_decoder);  // communication timeout, drop the partial packet
+			rx_frame = _frame();
+		}
+		return;
+	}
+
+	uint32_t n = (status & UOTGHS_DEVEPTISR_BYCT_Msk) >> UOTGHS_DEVEPTISR_BYCT_Pos;
+	UOTGHS->UOTGHS_DEVEPTICR[EP_DATA_OUT] = UOTGHS_DEVEPTICR_RXOUTIC;
+
+	// The bank stays busy until all of its commands are executed, so the
+	// host gets NAKs instead of overrunning the parser
+	volatile uint8_t* fifo = EP_FIFO(EP_DATA_OUT);
+	uint8_t chunk[64];
+	for (uint32_t i = 0; i < n; i += sizeof(chunk))
+	{
+		uint32_t len = (n - i < sizeof(chunk)) ? n - i : sizeof(chunk);
+		for (uint32_t k = 0; k < len; k++)
+		{
+			chunk[k] = fifo[i + k];
+		}
+		decode_rx_bytes(&usb_decoder, chunk, len);
+	}
+	UOTGHS->UOTGHS_DEVEPTIDR[EP_DATA_OUT] = UOTGHS_DEVEPTIDR_FIFOCONC;  // release the bank
+	rx_frame = _frame();
+}
+
+
+/************************************************************************/
+/*                   USB INTERRUPT                                      */
+/************************************************************************/
+/**
+ * @brief USB interrupt handler
+ *
+ * Handles bus reset, suspend, and resume, the requests on the control
+ * endpoint, and the transmission of the bulk IN data. Received data is
+ * served by poll_usb(). Runs at the lowest priority and never waits for the
+ * host.
+ */
+void UOTGHS_Handler(void)
+{
+	uint32_t status = UOTGHS->UOTGHS_DEVISR;
+
+	if (status & UOTGHS_DEVISR_EORST)
+	{
+		UOTGHS->UOTGHS_DEVICR = UOTGHS_DEVICR_EORSTC;
+		configuration = 0;
+		dtr = false;
+		suspended = false;
+		_release_data_endpoints();
+		_configure_ep0();
+	}
+	if (status & UOTGHS_DEVISR_SUSP)
+	{
+		UOTGHS->UOTGHS_DEVICR = UOTGHS_DEVICR_SUSPC;
+		suspended = true;
+	}
+	if (status & UOTGHS_DEVISR_WAKEUP)
+	{
+		UOTGHS->UOTGHS_DEVICR = UOTGHS_DEVICR_WAKEUPC;
+		suspended = false;
+	}
+
+	uint32_t ep0 = UOTGHS->UOTGHS_DEVEPTISR[EP_CTRL] & UOTGHS->UOTGHS_DEVEPTIMR[EP_CTRL];
+	if (ep0 & UOTGHS_DEVEPTISR_RXSTPI)
+	{
+		_handle_setup();
+	}
+	else if (ep0 & UOTGHS_DEVEPTISR_TXINI)
+	{
+		_ep0_in();
+	}
+	else if (ep0 & UOTGHS_DEVEPTISR_RXOUTI)
+	{
+		_ep0_out();
+	}
+
+	if (UOTGHS->UOTGHS_DEVEPTIMR[EP_DATA_IN] & UOTGHS_DEVEPTIMR_TXINE)
+	{
+		_drain_usb_tx();
+	}
+}
@@ -0,0 +1,54 @@
+/**
+ * @file usb_cdc.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief CDC-ACM serial transport on the native USB port.
+ *
+ * The UOTGHS controller enumerates as a USB 2.0 high-speed virtual serial
+ * port, which carries the same protocol as the programming-port UART without
+ * its baud rate limit. The USB interrupt handles the enumeration on the
+ * control endpoint and drains a transmit ring to the bulk IN endpoint. The
+ * bulk OUT endpoint is polled from the main loop: received bytes go to a
+ * stream decoder (see framing.h) like the UART ones, and a bank that is not
+ * read yet is NAKed, which throttles the host.
+ *
+ * uart_tx() sends its data to USB while the host keeps the port open (DTR
+ * set). The native port doesn't reset the device when it's opened, so the
+ * ready message is repeated on every open instead.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Start the USB clock and attach the device to the bus.
+ */
+void init_usb_cdc();
+
+/**
+ * @brief Check whether the host has the USB serial port open.
+ * @return true if the device is configured, not suspended, and DTR is set
+ */
+bool usb_cdc_connected();
+
+/**
+ * @brief Send data to the host through the bulk IN endpoint.
+ * @param data Pointer to the data buffer to send
+ * @param len Length of the data buffer in bytes
+ * @return Number of bytes dropped
+ *
+ * Copies the data to the transmit ring, which the USB interrupt drains. If
+ * the ring is full, the main loop waits for space for up to USB_TX_TIMEOUT ms;
+ * interrupt handlers don't wait. The data that doesn't fit is dropped.
+ */
+uint32_t usb_cdc_tx(const char* data, uint32_t len);
+
+/**
+ * @brief Process the data received through the bulk OUT endpoint.
+ *
+ * Must be called from the main loop. A partial packet is dropped after
+ * UART_TIMEOUT ms without data, like with the UART.
+ */
+void poll_usb();
@@ -0,0 +1,245 @@
+/*
+ * waveform.cpp
+ *
+ * DMA-driven digital waveform playback
+ */
+
+#include "waveform.h"
+#include "events.h"
+
+/************************************************************************/
+/*                 WAVEFORM BUFFERS                                     */
+/************************************************************************/
+
+// DMAC linked list item, see datasheet section 22.4.5
+typedef struct {
+	uint32_t saddr;
+	uint32_t daddr;
+	uint32_t ctrla;
+	uint32_t ctrlb;
+	uint32_t dscr;
+} dmac_lli_t;
+
+// Every sample needs two descriptors: the sample itself goes to PIO_ODSR,
+// and a dummy word goes to SPI0_TDR to wait for the next sample period.
+// Two leading dummy writes fill the SPI0 shift and holding registers.
+// The chain covers all samples and is built by configure_waveform(); a
+// playback only moves the end of the chain to its last sample.
+#define N_LEAD_DESCRIPTORS 2
+#define N_DESCRIPTORS      (N_LEAD_DESCRIPTORS + 2 * WAVEFORM_MAX_SAMPLES)
+static dmac_lli_t wf_lli[N_DESCRIPTORS];
+static dmac_lli_t* wf_lli_end = &wf_lli[N_DESCRIPTORS - 1];  // descriptor with dscr = 0
+
+static uint32_t wf_samples[WAVEFORM_MAX_SAMPLES];
+static_assert(WAVEFORM_MAX_SAMPLES <= 256, "the last sample index must fit into Event::idx");
+static const uint32_t wf_dummy = 0;
+
+static Pio* wf_pio = nullptr;
+static uint32_t wf_mask = 0;
+
+#define WF_DMAC_CTRLA (DMAC_CTRLA_BTSIZE(1) | \
+                       DMAC_CTRLA_SCSIZE_CHK_1 | DMAC_CTRLA_DCSIZE_CHK_1 | \
+                       DMAC_CTRLA_SRC_WIDTH_WORD | DMAC_CTRLA_DST_WIDTH_WORD)
+
+#define WF_DMAC_CTRLB (DMAC_CTRLB_SRC_DSCR_FETCH_FROM_MEM | DMAC_CTRLB_DST_DSCR_FETCH_FROM_MEM | \
+                       DMAC_CTRLB_FC_MEM2PER_DMA_FC | \
+                       DMAC_CTRLB_SRC_INCR_FIXED | DMAC_CTRLB_DST_INCR_FIXED)
+
+
+/************************************************************************/
+/*                 HELPER FUNCTIONS                                     */
+/************************************************************************/
+
+static inline void _set_lli(dmac_lli_t* lli, const volatile void* src, volatile void* dst, dmac_lli_t* next)
+{
+	lli->saddr = (uint32_t) src;
+	lli->daddr = (uint32_t) dst;
+	lli->ctrla = WF_DMAC_CTRLA;
+	lli->ctrlb = WF_DMAC_CTRLB;
+	lli->dscr  = (uint32_t) next;
+}
+
+// Convert sample period to SPI0 chip select register value.
+// One SPI frame lasts BITS * SCBR MCK cycles, plus 32 * DLYBCT cycles
+// between consecutive frames. Returns 0 if the period is out of range.
+static uint32_t _period_to_spi_csr(uint32_t period_ns)
+{
+	uint32_t cycles = (uint32_t) ((uint64_t) period_ns * (BOARD_MCK / 1000000UL) / 1000UL);
+
+	if (period_ns < WAVEFORM_MIN_PERIOD_NS || cycles > 16 * 255 + 32 * 255)
+	{
+		return 0;
+	}
+
+	if (cycles <= 8 * 255)  // 8-bit frames give finer resolution
+	{
+		return SPI_CSR_BITS_8_BIT | SPI_CSR_SCBR((cycles + 4) / 8);
+	}
+
+	uint32_t dlybct = (cycles > 16 * 255) ? (cycles - 16 * 255 + 31) / 32 : 0;
+	uint32_t scbr = (cycles - 32 * dlybct + 8) / 16;
+	if (scbr > 255)
+	{
+		scbr = 255;
+	}
+	return SPI_CSR_BITS_16_BIT | SPI_CSR_SCBR(scbr) | SPI_CSR_DLYBCT(dlybct);
+}
+
+// Link the descriptors of all samples for the selected port
+static void _build_chain()
+{
+	dmac_lli_t* lli = wf_lli;
+	for (uint32_t i = 0; i < N_LEAD_DESCRIPTORS; i++, lli++)
+	{
+		_set_lli(lli, &wf_dummy, &SPI0->SPI_TDR, lli + 1);
+	}
+	for (uint32_t i = 0; i < WAVEFORM_MAX_SAMPLES; i++, lli += 2)
+	{
+		_set_lli(lli, &wf_samples[i], &wf_pio->PIO_ODSR, lli + 1);
+		_set_lli(lli + 1, &wf_dummy, &SPI0->SPI_TDR, lli + 2);
+	}
+	wf_lli_end = lli - 1;
+	wf_lli_end->dscr = 0;  // end of the chain
+}
+
+static void _init_waveform_peripherals()
+{
+	static bool initialized = false;
+	if (initialized)
+	{
+		return;
+	}
+
+	// SPI0 runs as a master without any pins attached; it's only a pacer
+	sysclk_enable_peripheral_clock(ID_SPI0);
+	SPI0->SPI_CR = SPI_CR_SWRST;
+	SPI0->SPI_MR = SPI_MR_MSTR | SPI_MR_MODFDIS | SPI_MR_PCS(0b1110);  // fixed NPCS0
+
+	sysclk_enable_peripheral_clock(ID_DMAC);
+	DMAC->DMAC_EN = DMAC_EN_ENABLE;
+
+	initialized = true;
+}
+
+
+/************************************************************************/
+/*                 WAVEFORM CONFIGURATION                               */
+/************************************************************************/
+
+void configure_waveform(uint32_t port, uint32_t mask)
+{
+	if (port > 3)
+	{
+		printf("ERR: invalid waveform port %lu\n", port);
+		return;
+	}
+
+	stop_waveform_func(0, 0);
+	_init_waveform_peripherals();
+
+	wf_pio = arch_ioport_port_to_base(port);
+	wf_mask = mask;
+	_build_chain();
+
+	// Masked pins become outputs that follow ODSR writes
+	wf_pio->PIO_PER = mask;
+	wf_pio->PIO_OER = mask;
+}
+
+void set_waveform_sample(uint32_t idx, uint32_t value)
+{
+	if (idx >= WAVEFORM_MAX_SAMPLES)
+	{
+		printf("ERR: waveform sample index %lu exceeds %lu\n", idx, WAVEFORM_MAX_SAMPLES - 1);
+		return;
+	}
+	wf_samples[idx] = value;
+}
+
+void schedule_waveform(const DataPacket* data)
+{
+	if (!wf_pio)
+	{
+		printf("ERR: waveform port is not configured\n");
+		return;
+	}
+	if (data->arg2 == 0 || data->arg2 > WAVEFORM_MAX_SAMPLES)
+	{
+		printf("ERR: waveform length must be from 1 to %lu samples\n", WAVEFORM_MAX_SAMPLES);
+		return;
+	}
+
+	uint32_t spi_csr = _period_to_spi_csr(data->arg1);
+	if (spi_csr == 0)
+	{
+		printf("ERR: waveform sample period %lu ns is out of range\n", data->arg1);
+		return;
+	}
+
+	Event event = event_from_datapacket(data, OP_WAVEFORM_ON);
+	event.idx = data->arg2 - 1;
+	event.arg = spi_csr;
+	schedule_event(&event);
+}
+
+
+/************************************************************************/
+/*                 FUNCTIONS TO USE WITHIN EVENTS                       */
+/************************************************************************/
+
+void start_waveform_func(uint32_t arg1_last_sample, uint32_t arg2_spi_csr)
+{
+	if (!wf_pio)
+	{
+		return;
+	}
+
+	// Halt a previous playback and clear its status
+	DMAC->DMAC_CHDR = DMAC_CHDR_DIS0 << WAVEFORM_DMAC_CH;
+	SPI0->SPI_CR = SPI_CR_SPIDIS;
+	DMAC->DMAC_EBCISR;
+
+	SPI0->SPI_CSR[0] = arg2_spi_csr;
+
+	// End the chain after the dummy write of the last sample
+	wf_lli_end->dscr = (uint32_t) (wf_lli_end + 1);
+	wf_lli_end = &wf_lli[N_LEAD_DESCRIPTORS + 2 * arg1_last_sample + 1];
+	wf_lli_end->dscr = 0;
+
+	// Pins under waveform control follow ODSR writes from now on
+	wf_pio->PIO_OWER = wf_mask;
+
+	DmacCh_num* ch = &DMAC->DMAC_CH_NUM[WAVEFORM_DMAC_CH];
+	ch->DMAC_SADDR = 0;
+	ch->DMAC_DADDR = 0;
+	ch->DMAC_DSCR = (uint32_t) wf_lli;
+	ch->DMAC_CTRLA = 0;
+	ch->DMAC_CTRLB = WF_DMAC_CTRLB;
+	ch->DMAC_CFG = DMAC_CFG_DST_PER(WAVEFORM_DMAC_PER) | DMAC_CFG_DST_H2SEL |
+	               DMAC_CFG_SOD | DMAC_CFG_FIFOCFG_ASAP_CFG;
+
+	SPI0->SPI_CR = SPI_CR_SPIEN;
+	DMAC->DMAC_CHER = DMAC_CHER_ENA0 << WAVEFORM_DMAC_CH;
+}
+
+void stop_waveform_func(uint32_t arg1_unused, uint32_t arg2_unused)
+{
+	if (!wf_pio)
+	{
+		return;
+	}
+	DMAC->DMAC_CHDR = DMAC_CHDR_DIS0 << WAVEFORM_DMAC_CH;
+	SPI0->SPI_CR = SPI_CR_SPIDIS;
+	wf_pio->PIO_OWDR = wf_mask;
+}
+
+void pause_waveform()
+{
+	// Suspend the DMA channel; the output holds the current sample
+	DMAC->DMAC_CHER = DMAC_CHER_SUSP0 << WAVEFORM_DMAC_CH;
+}
+
+void resume_waveform()
+{
+	DMAC->DMAC_CHDR = DMAC_CHDR_RES0 << WAVEFORM_DMAC_CH;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file waveform.h
+ * @author Roman Kiselev (roman.kiselev@stjude.org)
+ * @brief DMA-driven digital waveform playback.
+ *
+ * This module streams a host-uploaded table of port states to a PIO port
+ * without CPU involvement. Every sample is written to PIO_ODSR by the DMA
+ * controller, so only the pins enabled in the port mask change. Samples are
+ * paced by the SPI0 transmitter through the DMAC hardware handshake, which
+ * allows sample periods from WAVEFORM_MIN_PERIOD_NS to ~145 us.
+ *
+ * Playback is started by a regular scheduled event, so it stays aligned
+ * with the system timeline. The first sample appears one sample period
+ * after the start event.
+ *
+ * @version \projectnumber
+ */
+
+#pragma once
+#include "globals.h"
+#include "uart_comm.h"
+
+/**
+ * @brief Select the PIO port and pins driven by the waveform.
+ * @param port PIO port index (0 = PIOA, 1 = PIOB, 2 = PIOC, 3 = PIOD)
+ * @param mask Bitmask of port pins controlled by the waveform samples
+ *
+ * The masked pins are configured as outputs with direct ODSR write access.
+ */
+void configure_waveform(uint32_t port, uint32_t mask);
+
+/**
+ * @brief Store a single waveform sample.
+ * @param idx Sample index, from 0 to WAVEFORM_MAX_SAMPLES - 1
+ * @param value Port state; only bits in the port mask are applied
+ */
+void set_waveform_sample(uint32_t idx, uint32_t value);
+
+/**
+ * @brief Schedule waveform playback.
+ * @param data Pointer to DataPacket containing the playback parameters
+ *
+ * data->arg1 is the sample period in nanoseconds, data->arg2 is the number
+ * of samples to play. Timestamp, N, and interval have the usual meaning
+ * and define when the playback starts.
+ */
+void schedule_waveform(const DataPacket* data);
+
+/**
+ * @brief Event function for starting the waveform playback.
+ * @param arg1_last_sample Index of the last sample to play
+ * @param arg2_spi_csr SPI0 chip select register value that defines the sample period
+ *
+ * Restarts the playback if the waveform is already playing.
+ */
+void start_waveform_func(uint32_t arg1_last_sample, uint32_t arg2_spi_csr);
+
+/**
+ * @brief Event function for stopping the waveform playback.
+ * @param arg1 Unused parameter (for event function compatibility)
+ * @param arg2 Unused parameter (for event function compatibility)
+ *
+ * Stops the DMA transfer and releases the port pins from ODSR control.
+ * The pins keep their current levels.
+ */
+void stop_waveform_func(uint32_t arg1, uint32_t arg2);
+
+/**
+ * @brief Suspend the waveform playback.
+ *
+ * Used by pause_sys_timer(). The DMA transfer is suspended, so the port holds
+ * the current sample; the sample that is already being paced by SPI0 may
+ * still be written out.
+ */
+void pause_waveform();
+
+/**
+ * @brief Continue the playback suspended by pause_waveform().
+ */
+void resume_waveform();
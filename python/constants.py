@@ -12,6 +12,7 @@ Constants:
     MHz: Frequency unit for megahertz (1000 kHz)
     UNIFORM_TIME_DELAY: Default uniform time delay in microseconds
     BAUDRATE: UART communication baud rate
+    MCK: Master clock frequency of the microcontroller
 """
 
 # Time units for convenient conversion
@@ -34,3 +35,6 @@ UNIFORM_TIME_DELAY = 500  # us
 
 BAUDRATE = 115200
 """UART communication baud rate for device communication."""
+
+MCK = 84*MHz
+"""Master clock frequency of the microcontroller (Hz); profiler cycle counts are in MCK cycles."""
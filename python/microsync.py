@@ -1,16 +1,19 @@
 from __version__ import __version__
-from constants import ms, MHz, UNIFORM_TIME_DELAY
+from constants import ms, MHz, MCK, UNIFORM_TIME_DELAY
 from ctypes import c_int32
 from ctypes import c_uint16
 from ctypes import c_uint32
 from ctypes import c_uint8
 from enum import Enum
-from rev_pin_map import rev_pin_map
+from rev_pin_map import rev_pin_map, pin_map
 from serial import Serial, SerialException
+from serial.tools import list_ports
+import binascii
 import ctypes
 import datetime
 import gc
 import re
+import struct
 import time
 
 ####################################################################
@@ -56,12 +59,96 @@ def _compare_versions(v1, v2):
         for k, a, b in zip(["major", "minor", "patch"], v1.split("."), v2.split("."))
     }
 
+PIN_ID_RESOLVED = 0x80000000  # tag of a resolved pin ID sent in place of the name, see pins.h
+
+def pin_id(pin):
+    """
+    Resolve an Arduino Due pin name (e.g. "D13") to the internal pin ID, tagged
+    with PIN_ID_RESOLVED. The device uses IDs directly, so commands with
+    resolved pins skip the name lookup. Integers are taken as already resolved IDs.
+    """
+    if isinstance(pin, int):
+        return pin | PIN_ID_RESOLVED
+    try:
+        return pin_map[pin.upper()] | PIN_ID_RESOLVED
+    except KeyError:
+        raise ValueError(f"unknown pin {pin!r}") from None
+
+burst_pins = ["D5", "D3", "D11"]  # outputs of the TC2 burst channels
+
+def burst_channel(channel):
+    """
+    Resolve a burst channel given by its index or its pin name (e.g. "D3").
+    """
+    if isinstance(channel, str):
+        try:
+            return burst_pins.index(channel.upper())
+        except ValueError:
+            raise ValueError(f"pin {channel!r} has no burst channel") from None
+    if not 0 <= channel < len(burst_pins):
+        raise ValueError(f"burst channel must be from 0 to {len(burst_pins) - 1}")
+    return channel
+
+def burst_channel_mask(channels):
+    """
+    Bitmask of burst channels given by a channel or a list of channels.
+    """
+    if isinstance(channels, (int, str)):
+        channels = [channels]
+    return sum(1 << ch for ch in set(map(burst_channel, channels)))
+
+pwm_pins = ["D35", "D37", "D39", "D41", "D9", "D8", "D7", "D6"]  # outputs of the PWM channels
+PWM_DUTY_ONE = 1 << 16  # 100% duty cycle, Q16
+
+def pwm_channel(channel):
+    """
+    Resolve a PWM channel given by its index or its pin name (e.g. "D9").
+    """
+    if isinstance(channel, str):
+        try:
+            return pwm_pins.index(channel.upper())
+        except ValueError:
+            raise ValueError(f"pin {channel!r} has no PWM channel") from None
+    if not 0 <= channel < len(pwm_pins):
+        raise ValueError(f"PWM channel must be from 0 to {len(pwm_pins) - 1}")
+    return channel
+
 def pad(data: bytearray, length=24):
     """
     Pad a bytearray to a given length with zeros. Used to create data packets of fixed length.
     """
     return bytearray(data + bytearray([0] * (length - len(data))))
 
+FRAME_SYNC = 0xA5         # first byte of a frame, see framing.h
+FRAME_MAX_PAYLOAD = 512   # bytes of commands in a single frame
+
+def encode_command(cmd: str, args):
+    """
+    Encode a command for a frame: 3-character name, number of arguments, and
+    the arguments. Trailing zero arguments are omitted; the device fills them in.
+    """
+    args = [bytes(a) for a in args]
+    while args and not any(args[-1]):
+        args.pop()
+    return cmd.encode()[:3].ljust(3, b"\0") + bytes([len(args)]) + b"".join(args)
+
+def encode_frames(commands):
+    """
+    Pack encoded commands into as few frames as possible.
+    Every frame is [sync] [length] [header check] [payload] [CRC-16/CCITT].
+    """
+    frames = bytearray()
+    payload = bytearray()
+    for command in list(commands) + [None]:
+        if payload and (command is None or len(payload) + len(command) > FRAME_MAX_PAYLOAD):
+            n = len(payload)
+            frames += bytes([FRAME_SYNC, n & 0xFF, n >> 8, FRAME_SYNC ^ (n & 0xFF) ^ (n >> 8)])
+            frames += payload + struct.pack("<H", binascii.crc_hqx(bytes(payload), 0xFFFF))
+            payload = bytearray()
+        if command is not None:
+            payload += command
+    return bytes(frames)
+
 def us2cts(us, prescaler=0):
     """
     Convert microseconds to clock ticks.
@@ -96,6 +183,31 @@ def close_lost_serial_port(port_name):
     return False
 
 
+NATIVE_USB_VID = 0x2341  # see USB_VID and USB_PID in globals.h
+NATIVE_USB_PID = 0x003E
+
+UART_BAUDRATE = 115200   # rate after reset, see globals.h
+BAUD_VERIFY_TIMEOUT = 1000 * ms  # the device falls back to the previous rate after this
+# Rates tried by SyncDevice.negotiate_baudrate(), fastest first. The ATmega16U2
+# USB-serial bridge of the Due divides each of them exactly (2 MHz / n), and
+# the UART generates them within 1.6% (MCK / 16 / divisor). 500000 and 1000000
+# are off by 5% on the UART side and are rejected by the device.
+BAUDRATE_CANDIDATES = (666666, 400000, 250000)
+
+# Rate negotiated on every port, so reconnecting doesn't repeat failed tries
+_negotiated_baudrates = {}
+
+def find_native_usb_port():
+    """
+    Find the native USB serial port of the sync device.
+    Returns the port name, or None if the device is not connected to the native USB port.
+    """
+    for p in list_ports.comports():
+        if p.vid == NATIVE_USB_VID and p.pid == NATIVE_USB_PID:
+            return p.device
+    return None
+
+
 
 ####################################################################
 #        SYNC DEVICE PROPERTIES (see props.h)
@@ -111,7 +223,7 @@ class props(Enum):
     ro_SYS_TIMER_VALUE = 2        #: Current system timer value (read-only)
     ro_SYS_TIMER_OVF_COUNT = 3    #: System timer overflow count (read-only)
     ro_SYS_TIME_s = 4             #: Current system time in seconds (read-only)
-    ro_SYS_TIMER_PRESCALER = 5    #: System timer prescaler value (read-only)
+    rw_SYS_TIMER_PRESCALER = 5    #: System timer prescaler value (read-write while stopped)
     rw_DFLT_PULSE_DURATION_us = 6 #: Default pulse duration in microseconds (read-write)
     ro_WATCHDOG_TIMEOUT_ms = 7    #: Watchdog timeout in milliseconds (read-only)
     ro_N_EVENTS = 8               #: Number of events in queue (read-only)
@@ -122,6 +234,37 @@ class props(Enum):
     wo_CLOSE_SHUTTERS = 12        #: Close all shutters (write-only)
     rw_SHUTTER_DELAY_us = 13      #: Shutter delay in microseconds (read-write)
     rw_CAM_READOUT_us = 14        #: Camera readout time in microseconds (read-write)
+    rw_HW_PULSES = 15             #: Route pulses on A4/A7 to timer compare outputs (read-write)
+    rw_GATE_MODE = 16             #: External gate mode: 0 - off, 1 - pause while A13 is low, 2 - hardware clock gating (read-write)
+    ro_TRIG_LATENCY_ns = 17       #: Latency of the event processing after the external start trigger, ns (read-only)
+    ro_UART_RX_OVERFLOWS = 18     #: Received bytes lost because the UART receive ring was full (read-only)
+    ro_UART_TX_HIGH_WATER = 19    #: Largest number of bytes waiting in the UART transmit ring (read-only)
+    ro_UART_TX_DROPPED = 20       #: Reply bytes lost because the UART transmit ring was full (read-only)
+
+####################################################################
+#        SYNC DEVICE EVENT OPCODES (see EventOp in events.h)
+####################################################################
+
+event_ops = {
+    0: "NOT_SET",
+    1: "TGL_PIN",
+    2: "SET_PIN",
+    3: "BST__ON",
+    4: "BST_OFF",
+    5: "EN__PIN",
+    6: "DIS_PIN",
+    7: "OPE_SHU",
+    8: "CLS_SHU",
+    9: "WFM__ON",
+    10: "WFM_OFF",
+    11: "HWP_ARM",
+    12: "GRP_WRT",
+    13: "BCH__ON",
+    14: "BCH_OFF",
+    15: "PWM_DTY",
+    16: "PWM_STP",
+    17: "PWM_PER",
+}
 
 ####################################################################
 #        LOGGING SERIAL PORT CLASS
@@ -249,7 +392,7 @@ class Event:
     
     Attributes:
         func (str): Function name to execute
-        arg1: First argument (usually pin number)
+        arg1: First argument (usually pin number), 8 bit
         arg2: Second argument (usually level or duration)
         ts (int): Timestamp when to execute the event (in specified units)
         N (int): Number of remaining event repetitions
@@ -257,19 +400,17 @@ class Event:
         unit (str): Time unit ("cts", "us", or "ms")
     """
     
-    def __init__(self, c_struct_data):
+    def __init__(self, c_struct_data, ts_base=0):
         """
         Create an Event from raw C structure data.
         
         Args:
-            c_struct_data (bytes): 28-byte C structure data from device
-        """
-        self.func = uint32_to_py(c_struct_data[0:4])
-        self.arg1 = uint32_to_py(c_struct_data[4:8])
-        self.arg2 = uint32_to_py(c_struct_data[8:12])
-        self.ts = uint64_to_py(c_struct_data[12:20])
-        self.N = uint32_to_py(c_struct_data[20:24])
-        self.intvl = uint32_to_py(c_struct_data[24:28])
+            c_struct_data (bytes): 16-byte C structure data from device
+            ts_base (int): Timestamp base of the event queue, in counts
+        """
+        ts_ofs, self.intvl, self.arg2, self.func, self.arg1, self.N = \
+            struct.unpack("<IIIBBH", c_struct_data)
+        self.ts = ts_base + ts_ofs
         self.unit = "cts"
 
     def __repr__(self):
@@ -286,11 +427,11 @@ class Event:
 
     def map_func(self, func_map):
         """
-        Map the function address to the corresponding function name.
-        This is used to convert the function address returned by the device
+        Map the event opcode to the corresponding function name.
+        This is used to convert the opcode returned by the device
         to the corresponding function name for pretty printing of the event table.
         """
-        self.func = func_map[str(self.func)]
+        self.func = func_map.get(self.func, self.func)
 
 
 
@@ -311,12 +452,14 @@ class SyncDevice(object):
     
     Attributes:
         com: Serial communication interface
-        func_map: Mapping of function addresses from device
-        _pending_tx_: Buffer for context manager commands
+        _pending_tx_: Commands collected by the context manager
+        framing: Send commands in CRC-checked frames instead of 24-byte packets
         _in_context: Context manager state flag
+        _pin_groups: Device group index of every pin group name
 
     Note:
-        Opening the port and connecting to the sync device resets the device.
+        Opening the programming port and connecting to the sync device resets
+        the device. The native USB port doesn't reset it.
 
     Example:
         >>> sd = SyncDevice("COM4")
@@ -324,16 +467,21 @@ class SyncDevice(object):
         >>> sd.go()
     """
     
-    def __init__(self, port, log_file=None):
+    def __init__(self, port=None, log_file=None, fast_uart=True, framing=True):
         """
         Initialize connection to the sync device and reset it.
         
         Args:
-            port (str): Serial port name (e.g., "COM4", "/dev/ttyUSB0")
+            port (str, optional): Serial port name (e.g., "COM4", "/dev/ttyUSB0").
+                If None, the native USB port of the device is detected by its VID and PID.
             log_file (str, optional): Logging configuration:
                 - None: No logging
                 - "print": Print to terminal
                 - filename: Save to file
+            fast_uart (bool): Negotiate the fastest UART rate after connecting,
+                see negotiate_baudrate(). Not used with the native USB port.
+            framing (bool): Send commands in CRC-checked frames; a batch of
+                commands takes fewer bytes than with the legacy 24-byte packets.
         
         Raises:
             ConnectionError: If device connection fails
@@ -342,18 +490,28 @@ class SyncDevice(object):
         Example:
             >>> sd = SyncDevice("COM4", log_file="sync.log")
             >>> sd = SyncDevice("/dev/ttyUSB0", log_file="print")
+            >>> sd = SyncDevice()  # native USB port
         """
-        self._pending_tx_ = bytearray()
+        native_usb = (port is None) or (port == find_native_usb_port())
+        if port is None:
+            port = find_native_usb_port()
+            if port is None:
+                raise ConnectionError("Sync device is not connected to the native USB port; specify the port name")
+
+        self._pending_tx_ = []
         self._in_context = False
+        self.framing = False  # the handshake below is understood by any firmware
+        self._pin_groups = {}
 
         try:
-            self.com = Port(port, baudrate=115200, log_file=log_file)
+            self.com = Port(port, baudrate=UART_BAUDRATE, log_file=log_file)
         except SerialException as e:
             close_lost_serial_port(port)
             print(f"{port} is in use. Closing and re-opening...")
-            self.com = Port(port, baudrate=115200, log_file=log_file)
+            self.com = Port(port, baudrate=UART_BAUDRATE, log_file=log_file)
 
-        # Opening of the serial port resets MCU, so we are going to wait for it to start up
+        # Opening of the programming port resets MCU, so we are going to wait for it to start up.
+        # The native USB port sends the ready message as soon as DTR is set.
         self.com.timeout = 1000 * ms
         msg = self.com.readline().strip().decode()
         self.com.timeout = 20 * ms
@@ -376,7 +534,61 @@ class SyncDevice(object):
                 f"Version mismatch: driver {__version__} != firmware {v}"
             )
 
-        self.func_map = self.get_function_addr()
+        self.framing = framing
+        if fast_uart and not native_usb:
+            self.negotiate_baudrate()
+
+    def negotiate_baudrate(self, candidates=BAUDRATE_CANDIDATES):
+        """
+        Switch the UART link to the fastest rate that works.
+
+        For every candidate, fastest first, the device acknowledges the rate and
+        switches; the driver switches too and repeats the request, which the
+        device has to confirm at the new rate. If the confirmation fails, the
+        device returns to the previous rate after BAUD_VERIFY_TIMEOUT, and the
+        next candidate is tried. The result is remembered for the port, so
+        later connections only try the rate that worked.
+
+        Args:
+            candidates (iterable): Baud rates to try
+
+        Returns:
+            int: Active baud rate
+
+        Example:
+            >>> sd.negotiate_baudrate()
+            666666
+        """
+        key = (self.com.port, tuple(sorted(candidates, reverse=True)))
+        if key in _negotiated_baudrates:
+            candidates = [_negotiated_baudrates[key]]
+
+        for baudrate in sorted(candidates, reverse=True):
+            if baudrate <= self.com.baudrate:
+                break
+
+            previous = self.com.baudrate
+            try:
+                self.query("BAU", baudrate)
+            except SyncDeviceError:
+                continue  # the device can't generate this rate
+
+            self.com.baudrate = baudrate
+            try:
+                actual = int(self.query("BAU", baudrate))
+                if abs(actual - baudrate) <= baudrate // 50:
+                    _negotiated_baudrates[key] = baudrate
+                    return baudrate
+            except (SyncDeviceError, UnicodeDecodeError, ValueError):
+                pass
+
+            # Link check failed; wait for the device to fall back
+            self.com.baudrate = previous
+            time.sleep(BAUD_VERIFY_TIMEOUT + 100 * ms)
+            self.com.reset_input_buffer()
+
+        _negotiated_baudrates[key] = self.com.baudrate
+        return self.com.baudrate
 
 
     def __enter__(self):
@@ -400,11 +612,15 @@ class SyncDevice(object):
         
         All commands collected within the context manager are sent as a single
         data packet to ensure precise timing and eliminate host OS jitter.
+        With framing, the commands are packed into as few frames as possible.
         """
         self._in_context = False
         if(self._pending_tx_):
-            self.com.write(self._pending_tx_)
-        self._pending_tx_ = bytearray()
+            if self.framing:
+                self.com.write(encode_frames(self._pending_tx_))
+            else:
+                self.com.write(b"".join(self._pending_tx_))
+        self._pending_tx_ = []
 
     def __del__(self):
         """
@@ -437,24 +653,22 @@ class SyncDevice(object):
             use the high-level methods like pos_pulse(), tgl_pin(), etc.
         """
         self.com.reset_input_buffer()
-        _command = pad(cmd.encode(), 4)
         if type(arg1) is str:
             arg1 = pad(arg1.encode(), 4)
         else:
             arg1 = bytearray(cu32(arg1))
+        args = [arg1, cu32(arg2), cu32(ts), cu32(N), cu32(interval)]
 
-        data = (pad(cmd.encode(), 4)
-            + arg1
-            + bytearray(cu32(arg2))
-            + bytearray(cu32(ts))
-            + bytearray(cu32(N))
-            + bytearray(cu32(interval)))
+        if self.framing:
+            data = encode_command(cmd, args)
+        else:
+            data = pad(cmd.encode(), 4) + b"".join(bytes(a) for a in args)
 
         if self._in_context:
-            self._pending_tx_ += data
+            self._pending_tx_.append(data)
             return
 
-        self.com.write(data)
+        self.com.write(encode_frames([data]) if self.framing else data)
 
     def query(self, cmd: str, arg1=0, arg2=0, ts=0, N=0, interval=0):
         """
@@ -485,7 +699,7 @@ class SyncDevice(object):
         Example:
             >>> sd.set_pin("A0", 1, ts=1000)  # Set A0 high after 1ms
         """
-        self.write("PIN", pin, level, ts, N, interval)
+        self.write("PIN", pin_id(pin), level, ts, N, interval)
 
     def tgl_pin(self, pin, ts=0, N=0, interval=0):
         """
@@ -501,7 +715,7 @@ class SyncDevice(object):
         Example:
             >>> sd.tgl_pin("D13", N=1000, interval=1000)  # Toggle D13 every 1ms
         """
-        self.write("TGL", pin, 0, ts, N, interval)
+        self.write("TGL", pin_id(pin), 0, ts, N, interval)
 
     def pos_pulse(self, pin, duration=0, ts=0, N=0, interval=0):
         """
@@ -518,7 +732,7 @@ class SyncDevice(object):
         Example:
             >>> sd.pos_pulse("A0", 1000, ts=5000, N=10, interval=50000)
         """
-        self.write("PPL", pin, duration, ts, N, interval)
+        self.write("PPL", pin_id(pin), duration, ts, N, interval)
 
     def neg_pulse(self, pin, duration=0, ts=0, N=0, interval=0):
         """
@@ -535,7 +749,7 @@ class SyncDevice(object):
         Example:
             >>> sd.neg_pulse("A0", 1000, ts=5000, N=10, interval=50000)
         """
-        self.write("NPL", pin, duration, ts, N, interval)
+        self.write("NPL", pin_id(pin), duration, ts, N, interval)
 
     def pulse_train(self, period, duration=0, ts=0, N=0, interval=0):
         """
@@ -553,6 +767,127 @@ class SyncDevice(object):
         """
         self.write("BST", period, duration, ts, N, interval)
 
+    def configure_burst(self, channel, period, duty=0.125, count=0, phase=0):
+        """
+        Configure a hardware pulse train on a TC2 channel.
+
+        Pulses start at the beginning of every period and are produced by the
+        timer itself with 23.8 ns resolution. With a pulse count, the train
+        stops by itself after the last pulse, without a stop event. Only one
+        channel can count pulses at a time, and it borrows the next channel
+        (D5 -> D3 -> D11 -> D5) as its counter.
+
+        Args:
+            channel (int or str): Channel 0-2 or its pin ("D5", "D3", "D11")
+            period (float): Period between pulses (in microseconds)
+            duty (float): Fraction of the period the output is high
+            count (int): Number of pulses in the train (0 = until stopped)
+            phase (int): Delay of the first pulse after start_bursts() (in microseconds)
+
+        Example:
+            >>> sd.configure_burst("D5", 10, duty=0.5, count=100)   # 100 pulses, 100 kHz
+            >>> sd.configure_burst("D11", 10, duty=0.2, phase=3)
+            >>> sd.start_bursts(["D5", "D11"], ts=1000)
+        """
+        channel = burst_channel(channel)
+        period_ticks = round(period * 42)  # TC2 runs at 42 MHz
+        self.write("BCF", channel, period_ticks)
+        self.write("BCW", channel, max(1, round(period_ticks * duty)))
+        self.write("BCN", channel, count)
+        self.write("BCP", channel, phase)
+
+    def start_bursts(self, channels, ts=0, N=1, interval=0):
+        """
+        Start the pulse trains configured with configure_burst().
+        A running train is restarted from its first pulse.
+
+        Args:
+            channels (int, str, or list): Channel or list of channels (0-2 or "D5", "D3", "D11")
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of event repetitions (0=infinite)
+            interval (int): Interval between event repetitions (in microseconds)
+        """
+        self.write("BON", burst_channel_mask(channels), 0, ts, N, interval)
+
+    def stop_bursts(self, channels, ts=0, N=1, interval=0):
+        """
+        Stop pulse trains and drive their pins low.
+
+        Args:
+            channels (int, str, or list): Channel or list of channels (0-2 or "D5", "D3", "D11")
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of event repetitions (0=infinite)
+            interval (int): Interval between event repetitions (in microseconds)
+        """
+        self.write("BOF", burst_channel_mask(channels), 0, ts, N, interval)
+
+    def configure_pwm(self, channel, period_ns):
+        """
+        Enable a hardware PWM channel. The pin stays low until the duty cycle is set.
+
+        Args:
+            channel (int or str): Channel 0-7 or its pin ("D35", "D37", "D39", "D41", "D9", "D8", "D7", "D6")
+            period_ns (int): PWM period (in nanoseconds, from 24 ns to ~0.8 s)
+
+        Example:
+            >>> sd.configure_pwm("D9", 10000)          # 100 kHz
+            >>> sd.set_pwm_duty("D9", 0.25, ts=1000)
+        """
+        self.write("PWC", pwm_channel(channel), period_ns)
+
+    def set_pwm_duty(self, channel, duty, ts=0, N=1, interval=0):
+        """
+        Change the duty cycle of a PWM channel at the end of its current period.
+
+        Args:
+            channel (int or str): Channel 0-7 or its pin
+            duty (float): Fraction of the period the pin is high, from 0 to 1
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of event repetitions (0=infinite)
+            interval (int): Interval between event repetitions (in microseconds)
+        """
+        if not 0 <= duty <= 1:
+            raise ValueError("PWM duty cycle must be from 0 to 1")
+        self.write("PWD", pwm_channel(channel), round(duty * PWM_DUTY_ONE), ts, N, interval)
+
+    def ramp_pwm_duty(self, channel, start, stop, duration, steps, ts=0):
+        """
+        Ramp the duty cycle of a PWM channel linearly, e.g. to ramp the laser intensity.
+        The ramp takes two events in the queue regardless of the number of steps.
+
+        Args:
+            channel (int or str): Channel 0-7 or its pin
+            start (float): Duty cycle at the timestamp, from 0 to 1
+            stop (float): Duty cycle at the end of the ramp, from 0 to 1
+            duration (int): Duration of the ramp (in microseconds)
+            steps (int): Number of steps after the start, up to 65535
+            ts (int): Timestamp (in microseconds, relative to current time)
+
+        Example:
+            >>> sd.ramp_pwm_duty(0, 0, 1, duration=100000, steps=100)  # 0 to 100% in 100 ms
+        """
+        channel = pwm_channel(channel)
+        delta = round((stop - start) * PWM_DUTY_ONE / steps)
+        interval = duration // steps
+        self.set_pwm_duty(channel, start, ts)
+        self.write("PWS", channel, delta & 0xFFFFFFFF, ts + interval, steps, interval)
+
+    def set_pwm_period(self, channel, period_ns, ts=0, N=1, interval=0):
+        """
+        Change the period of a PWM channel at the end of its current period.
+        The duty cycle keeps its fraction of the period. The new period must fit
+        the prescaler selected by configure_pwm(); periods longer than about twice
+        the configured one need a new configure_pwm() call.
+
+        Args:
+            channel (int or str): Channel 0-7 or its pin
+            period_ns (int): New PWM period (in nanoseconds)
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of event repetitions (0=infinite)
+            interval (int): Interval between event repetitions (in microseconds)
+        """
+        self.write("PWP", pwm_channel(channel), period_ns, ts, N, interval)
+
     def enable_pin(self, pin, ts=0, N=0, interval=0):
         """
         Enable a pin, setting it as active. The logical level of the pin is preserved.
@@ -568,7 +903,7 @@ class SyncDevice(object):
             >>> sd.set_pin("A0", 1)   # Set A0 high. It will still stay low as the pin is disabled
             >>> sd.enable_pin("A0", ts=1000)  # Enable A0 after 1ms. It will restore logical high level set by the previous call to set_pin()
         """
-        self.write("ENP", pin, 0, ts, N, interval)
+        self.write("ENP", pin_id(pin), 0, ts, N, interval)
 
     def disable_pin(self, pin, ts=0, N=0, interval=0):
         """
@@ -583,7 +918,86 @@ class SyncDevice(object):
         Example:
             >>> sd.disable_pin("A0", ts=1000)  # Disable A0 after 1ms
         """
-        self.write("DSP", pin, 0, ts, N, interval)
+        self.write("DSP", pin_id(pin), 0, ts, N, interval)
+
+    def play_waveform(self, port, mask, samples, period_ns, ts=0, N=0, interval=0):
+        """
+        Play a digital waveform on a PIO port using DMA.
+
+        The samples are uploaded to the device, and playback starts at the given
+        timestamp. Each sample is a 32-bit port state; only the pins selected by
+        the mask are driven. Samples are output without CPU involvement, so the
+        sample period can be much shorter than the event interval limit.
+
+        Args:
+            port (str or int): PIO port ("A", "B", "C", "D" or 0-3)
+            mask (int): Bitmask of port pins driven by the waveform
+            samples (list): Port states, up to 256 samples
+            period_ns (int): Sample period (in nanoseconds, from 500 ns to ~145 us)
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of playback repetitions (0=infinite)
+            interval (int): Interval between playback repetitions (in microseconds)
+
+        Note:
+            The first sample appears one sample period after the timestamp.
+            The pins keep the state of the last sample after playback.
+
+        Example:
+            >>> # 1 MHz square wave on D5 (PC25) for 100 us
+            >>> sd.play_waveform("C", 1 << 25, [1 << 25, 0] * 50, 500, ts=1000)
+        """
+        if type(port) is str:
+            port = "ABCD".index(port.upper())
+        if not 0 < len(samples) <= 256:
+            raise ValueError("Waveform must have from 1 to 256 samples")
+
+        self.write("WFC", port, mask)
+        for i, value in enumerate(samples):
+            self.write("WFD", i, value)
+        self.write("WFG", period_ns, len(samples), ts, N, interval)
+
+    def define_pin_group(self, name, pins):
+        """
+        Define a group of pins that is written as a parallel bus.
+
+        Bit 0 of the values written with write_pin_group() drives the first pin
+        of the list, bit 1 the second one, and so on. Redefining a group replaces
+        its pins.
+
+        Args:
+            name (str): Group name, used with write_pin_group()
+            pins (list): Up to 32 Arduino Due pin names (e.g., ["D22", "D23", "D24"]), LSB first
+
+        Example:
+            >>> sd.define_pin_group("filter", ["D22", "D23", "D24"])
+        """
+        if not 0 < len(pins) <= 32:
+            raise ValueError("Pin group must have from 1 to 32 pins")
+        group = self._pin_groups.get(name, len(self._pin_groups))
+        if group >= 8:
+            raise ValueError("The device supports up to 8 pin groups")
+
+        self.write("GRC", group)
+        for pin in pins:
+            self.write("GRP", group, pin_id(pin))
+        self._pin_groups[name] = group
+
+    def write_pin_group(self, name, value, ts=0, N=0, interval=0):
+        """
+        Write a value to a pin group with a single event.
+        All pins of the group on the same PIO port change at the same time.
+
+        Args:
+            name (str): Group name given to define_pin_group()
+            value (int): Value; bit i drives the i-th pin of the group
+            ts (int): Timestamp (in microseconds, relative to current time)
+            N (int): Number of event repetitions (0=infinite)
+            interval (int): Interval between event repetitions (in microseconds)
+
+        Example:
+            >>> sd.write_pin_group("filter", 5, ts=1000)  # D22 and D24 high, D23 low
+        """
+        self.write("GRW", self._pin_groups[name], value, ts, N, interval)
 
     def go(self):
         """
@@ -600,6 +1014,51 @@ class SyncDevice(object):
         """
         self.write("GO!")
 
+    def arm(self, pin="A13", edge="rising"):
+        """
+        Arm the system timer to start on an external edge instead of go().
+
+        The edge resets and starts the hardware timer directly, so the start of
+        the timeline (t=0) is aligned to the edge with the resolution of the
+        system timer, independent of the host and serial port latency.
+        The timer must be stopped before arming; go() and stop() disarm it.
+
+        Args:
+            pin (str): Trigger input, one of "A2", "A3", or "A13"
+            edge (str): "rising", "falling", or "both"
+
+        Example:
+            >>> sd.stop()
+            >>> sd.pos_pulse("A0", 1000, ts=1000)  # 1 ms after the trigger edge
+            >>> sd.arm("A13", "rising")
+            >>> # ... the device waits for a rising edge on A13
+            >>> sd.trig_latency_ns  # how long it took the firmware to take over
+        """
+        edges = {"rising": 0, "falling": 1, "both": 2}
+        if edge not in edges:
+            raise ValueError(f"edge must be one of {list(edges)}")
+        self.write("ARM", pin_id(pin), edges[edge])
+
+    def pause(self):
+        """
+        Freeze the system timer without clearing the event queue.
+
+        All timer-driven outputs (bursts, hardware pulses, waveforms) are frozen
+        too. After resume(), the pending events fire as if their timestamps
+        were shifted by the paused duration.
+
+        Example:
+            >>> sd.pause()   # Hold the timeline
+            >>> sd.resume()  # Continue where it stopped
+        """
+        self.write("PAU")
+
+    def resume(self):
+        """
+        Continue the system timer after pause().
+        """
+        self.write("RSM")
+
     def stop(self):
         """
         Stop the sync device system timer and halt event processing.
@@ -757,12 +1216,30 @@ class SyncDevice(object):
             int: Timer prescaler (2, 8, 32, or 128)
 
         Note:
-            The prescaler is hardcoded in the firmware, and cannot be changed at runtime.
-
             See globals.h for the prescaler values and their corresponding
             system time resolution and maximum timestamp value.
         """
-        return int(self.get_property(props.ro_SYS_TIMER_PRESCALER))
+        return int(self.get_property(props.rw_SYS_TIMER_PRESCALER))
+
+    @prescaler.setter
+    def prescaler(self, value):
+        """
+        Set the sync device timer prescaler.
+
+        The prescaler can only be changed while the system timer is stopped and
+        the event queue is empty. Start the timer with go() afterwards.
+
+        Args:
+            value (int): Timer prescaler (2, 8, 32, or 128)
+
+        Example:
+            >>> sd.stop()
+            >>> sd.prescaler = 2  # 24 ns resolution, overflow after 102 s
+            >>> sd.go()
+        """
+        if value not in (2, 8, 32, 128):
+            raise ValueError("Prescaler must be 2, 8, 32, or 128")
+        self.set_property(props.rw_SYS_TIMER_PRESCALER, value)
 
     @property
     def pulse_duration_us(self):
@@ -834,19 +1311,234 @@ class SyncDevice(object):
         """
         self.set_property(props.rw_INTLCK_ENABLED, value)
 
-    def get_function_addr(self):
+    @property
+    def hw_pulses_enabled(self):
         """
-        Get the function address mapping from the device.
-        
+        Check if pulses on pins A4 and A7 are generated by timer compare outputs.
+
+        In this mode pos_pulse() and neg_pulse() on A4/A7 produce both edges in
+        hardware with ~24 ns resolution, free of interrupt latency jitter.
+        The interval between repeated pulses must exceed the pulse duration plus 50 us.
+
         Returns:
-            dict: Mapping of function names to their addresses
-        
-        Note:
-            This is used internally to map function addresses to readable names.
+            bool: True if hardware pulses are enabled, False otherwise
+        """
+        return self.get_property(props.rw_HW_PULSES) != '0'
+
+    @hw_pulses_enabled.setter
+    def hw_pulses_enabled(self, value):
+        """
+        Enable or disable hardware pulses on pins A4 and A7.
+
+        Args:
+            value (bool): True to route pulses to timer compare outputs
+        """
+        self.set_property(props.rw_HW_PULSES, value)
+
+    @property
+    def trig_latency_ns(self):
+        """
+        Get the latency of event processing after the last external start trigger.
+
+        The timeline starts exactly at the trigger edge; events scheduled earlier
+        than this latency are executed late, right after the trigger interrupt.
+
+        Returns:
+            int: Time between the trigger edge and the start of event processing, ns
         """
-        response = self.write("FUN")
-        return {k: v for k, v in [l.split() for l in
-            self.com.readall().decode().splitlines()]}
+        return int(self.get_property(props.ro_TRIG_LATENCY_ns))
+
+    @property
+    def rx_overflows(self):
+        """
+        Get the number of received bytes lost because the UART receive ring was full.
+
+        Batches can be sent at full line rate; this stays 0 unless command
+        execution falls behind the line for longer than the 1 KB ring lasts.
+
+        Returns:
+            int: Number of lost bytes since reset
+        """
+        return int(self.get_property(props.ro_UART_RX_OVERFLOWS))
+
+    @property
+    def tx_high_water(self):
+        """
+        Get the largest number of bytes that have waited in the UART transmit ring.
+
+        Replies are copied to a 4 KB ring drained by DMA. A value close to the
+        ring size means large dumps (e.g. the event queue) had to wait for it.
+
+        Returns:
+            int: High-water mark of the transmit ring since reset, in bytes
+        """
+        return int(self.get_property(props.ro_UART_TX_HIGH_WATER))
+
+    @property
+    def tx_dropped(self):
+        """
+        Get the number of reply bytes lost because the UART transmit ring was full.
+
+        Only messages printed from interrupt handlers are dropped; the main loop
+        waits for the ring to drain instead, except on the native USB port when
+        the host stops reading.
+
+        Returns:
+            int: Number of lost bytes since reset
+        """
+        return int(self.get_property(props.ro_UART_TX_DROPPED))
+
+    @property
+    def gate_mode(self):
+        """
+        Get the external gate mode.
+
+        In mode 1, the timeline is paused while the gate input on pin A13 is
+        low and resumed on its rising edge. Bursts, hardware pulses, and
+        waveforms are frozen together with the timeline.
+
+        In mode 2, the gate input drives the clock of the system timer
+        directly. The timeline stalls and continues within one timer tick
+        of the gate edge, but bursts, hardware pulses, and waveforms that
+        are already running are not gated.
+
+        The input has a pull-up, so an unconnected gate never holds the timeline.
+
+        Returns:
+            int: 0 - gate is off, 1 - pause while the gate is low, 2 - hardware gating
+        """
+        return int(self.get_property(props.rw_GATE_MODE))
+
+    @gate_mode.setter
+    def gate_mode(self, value):
+        """
+        Set the external gate mode.
+
+        Args:
+            value (int): 0 - gate is off, 1 - pause while the gate is low, 2 - hardware gating
+        """
+        self.set_property(props.rw_GATE_MODE, value)
+
+    def get_latency_stats(self, reset=False):
+        """
+        Get the dispatch lateness statistics of the event queue.
+
+        For every fired event, the device records the difference between the
+        actual counter value at dispatch and the event timestamp. The values are
+        accumulated into a log2 histogram together with min/max/mean and the
+        number of missed events (later than the missed-event tolerance).
+
+        Args:
+            reset (bool): Clear the statistics after reading them
+
+        Returns:
+            dict: Keys "count", "missed", "min_ns", "max_ns", "mean_ns", and
+                "histogram" - a list of (upper_ns, count) tuples, where upper_ns
+                is the exclusive upper edge of the bin (None for the last bin)
+
+        Example:
+            >>> sd.get_latency_stats(reset=True)  # start from a clean slate
+            >>> # ... run the acquisition ...
+            >>> stats = sd.get_latency_stats()
+            >>> print(f"{stats['missed']} of {stats['count']} events missed, worst {stats['max_ns']} ns")
+        """
+        self.write("LAT", int(bool(reset)))
+        lines = self.com.readall().decode().splitlines()
+        count, missed, min_ns, max_ns, mean_ns = (int(v) for v in lines[0].split())
+        histogram = []
+        for line in lines[1:]:
+            upper_ns, n = (int(v) for v in line.split())
+            histogram.append((upper_ns if upper_ns >= 0 else None, n))
+        return {"count": count, "missed": missed, "min_ns": min_ns,
+                "max_ns": max_ns, "mean_ns": mean_ns, "histogram": histogram}
+
+    def get_profile(self, reset=False):
+        """
+        Get the execution time statistics of the firmware, measured with the
+        cycle counter of the microcontroller.
+
+        The device profiles its interrupt handlers, the event dispatcher, the
+        command parser, and every event function that has been executed.
+        Interrupts that preempt a section are included in its time.
+
+        Args:
+            reset (bool): Clear the statistics after reading them
+
+        Returns:
+            dict: Section or event function name -> dict with "count" and the
+                "min_us", "max_us", and "mean_us" execution times
+
+        Example:
+            >>> sd.get_profile(reset=True)
+            >>> # ... run the acquisition ...
+            >>> for name, p in sd.get_profile().items():
+            ...     print(f"{name}: worst {p['max_us']:.2f} us over {p['count']} calls")
+        """
+        self.write("PRF", int(bool(reset)))
+        lines = self.com.readall().decode().splitlines()
+        profile = {}
+        for line in lines:
+            if line.startswith("ERR"):
+                raise SyncDeviceError(line)
+            name, count, cmin, cmax, cmean = line.split()
+            if name.isdigit():  # event functions are reported by opcode
+                name = event_ops.get(int(name), name)
+            profile[name] = {"count": int(count),
+                             "min_us": int(cmin) * MHz / MCK,
+                             "max_us": int(cmax) * MHz / MCK,
+                             "mean_us": int(cmean) * MHz / MCK}
+        return profile
+
+    def read_trace(self, unit="us"):
+        """
+        Read the execution trace of the events fired since the previous call.
+
+        The device logs every executed event to a ring buffer in RAM. This method
+        drains the buffer, so it can be called repeatedly while the acquisition
+        is running; each call returns only new records.
+
+        Args:
+            unit (str): Time unit for timestamps ("cts", "us", or "ms")
+
+        Returns:
+            tuple: (records, overflows), where records is a list of dicts with keys
+                "func", "arg1", "arg2", "ts" (scheduled time), "actual_ts" (time of
+                the dispatch), and "late" (actual_ts - ts); overflows is the total
+                number of records dropped because the buffer was full since the
+                trace was cleared.
+
+        Example:
+            >>> sd.clear_trace()
+            >>> sd.go()
+            >>> records, overflows = sd.read_trace()
+            >>> cam = [r["actual_ts"] for r in records if r["arg1"] == "D2"]
+        """
+        presc = self.prescaler
+        scale = {"cts": None, "us": 1, "ms": 0.001}[unit]
+
+        self.write("TRC")
+        r = self.com.readall()
+        n, overflows = struct.unpack_from("<II", r, 0)
+        records = []
+        for func, arg1, arg2, late, ts in struct.iter_unpack("<IIIiQ", r[8 : 8 + 24*n]):
+            func = event_ops.get(func, func)
+            if func in ["SET_PIN", "TGL_PIN", "EN__PIN", "DIS_PIN"]:
+                arg1 = rev_pin_map[arg1]
+            ts -= us2cts(UNIFORM_TIME_DELAY, presc)
+            actual_ts = ts + late
+            if scale is not None:
+                ts = cts2us(ts, presc) * scale
+                actual_ts = cts2us(actual_ts, presc) * scale
+                late = actual_ts - ts
+            records.append({"func": func, "arg1": arg1, "arg2": arg2,
+                            "ts": ts, "actual_ts": actual_ts, "late": late})
+        return records, overflows
+
+    def clear_trace(self):
+        """
+        Discard the execution trace on the device and reset its overflow count.
+        """
+        self.write("TRC", 1)
 
     def get_events(self, unit="ms"):
         """
@@ -856,7 +1548,8 @@ class SyncDevice(object):
             unit (str): Time unit for timestamps ("cts", "us", or "ms")
         
         Returns:
-            list: List of Event objects representing scheduled events
+            list: List of Event objects representing scheduled events,
+                sorted by timestamp
         
         Example:
             >>> events = sd.get_events("us")
@@ -867,16 +1560,19 @@ class SyncDevice(object):
 
         self.write("QUE")
         r = self.com.readall()
+        ts_base = uint64_to_py(r[0:8])  # timestamps are offsets from this base
         events = []
-        for offset in range(0, len(r), 28):  # Event is 28 bytes
-            e = Event(r[offset : offset + 28])
-            e.map_func(self.func_map)
+        for offset in range(8, len(r), 16):  # Event is 16 bytes
+            e = Event(r[offset : offset + 16], ts_base)
+            e.map_func(event_ops)
             e.ts -= us2cts(UNIFORM_TIME_DELAY, presc)
             if unit in ["us", "ms"]:
                 e.unit = unit
                 e.ts = round(cts2us(e.ts, presc)*(0.001 if unit == "ms" else 1))
                 e.intvl = round(cts2us(e.intvl, presc)*(0.001 if unit == "ms" else 1))
             events.append(e)
+        # the device sends events in heap order
+        events.sort(key=lambda e: e.ts)
         return events
 
     ## pTIRF extension
@@ -119,3 +119,15 @@ Example:
     >>> rev_pin_map[16]
     'A0'
 """
+
+pin_map = {name: pin_id for pin_id, name in rev_pin_map.items()}
+# D54-D69 share their IDs with A0-A15, which take precedence in rev_pin_map
+pin_map.update({f"D{54 + i}": pin_map[f"A{i}"] for i in range(16)})
+"""Mapping from Arduino Due pin names to internal pin IDs.
+
+The device accepts these IDs in place of pin names and skips the name lookup.
+
+Example:
+    >>> pin_map["D0"]
+    8
+"""